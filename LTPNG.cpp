@@ -2,10 +2,11 @@
  * Lowe Technologies PNG Encoder (LTPNG)
  *
  * A PNG encoder built to the ISO/IEC 15948:2003 Portable Network Graphics Standard Rev 10 Nov 03
- * Supports only 8-bit and 16-bit truecolour PNG images with or without alpha.
+ * Supports 8-bit and 16-bit truecolour and greyscale PNG images with or without alpha, and indexed-colour
+ * images reduced from them.
  *
  * @author Rich Lowe
- * @version 1.1.0
+ * @version 1.25.0
  */
  
 /**
@@ -15,12 +16,62 @@
  *        filtering and standard zlib compression without buffering support.
  * 1.0.1: Minor formatting and bug fixes, added static ramping and pattern functions.
  * 1.1.0: Added support for all filter types defined by the standard, inefficiency fixes.
+ * 1.2.0: Row-streaming encoder with bounded memory, images are written as they are pushed in
+ *        multiple fixed-size IDAT chunks rather than one giant IDAT.
+ * 1.3.0: Chunks are built in a buffered chunk writer with an incremental CRC, removing the
+ *        per-byte file writes and the image-sized CRC buffer.
+ * 1.4.0: CRC-32 engine with compile-time tables, slice-by-8 and runtime-selected PCLMULQDQ
+ *        update paths, and CRC combining for independently calculated blocks.
+ * 1.5.0: Adaptive filtering, picking the filter for each row by minimum sum of absolute differences
+ *        or by estimated entropy.
+ * 1.6.0: Whole-row filter kernels with SSE2 and AVX2 versions picked at runtime, checked against
+ *        a scalar reference.
+ * 1.7.0: Interleaved RGB/RGBA 8-bit, big endian 16-bit, and planar 8-bit pixel input, with rows
+ *        already in PNG byte order filtered without an intermediate copy.
+ * 1.8.0: Parallel deflate, compressing bands of filtered rows on worker threads and stitching them
+ *        into one zlib stream at sync flush boundaries.
+ * 1.9.0: Output sinks, so images can be written to memory, a caller's buffer, or a callback as well
+ *        as to a file.
+ * 1.10.0: Reusable encoder, keeping its buffers and deflate stream from one image to the next and
+ *        growing them only when needed, and abort_image() to recover from a failed image.
+ * 1.11.0: Compression options for the zlib level, strategy, memory level, and window size, with
+ *        fastest, balanced, and smallest presets.
+ * 1.12.0: Streaming decoder, checking chunk CRCs and inflating and unfiltering a scanline at a time,
+ *        and the png_info program to check images with it.
+ * 1.13.0: Optional analysis pass in create_image(), writing images of 256 colours or fewer as
+ *        indexed-colour with PLTE and tRNS chunks and 1, 2, 4, or 8-bit indices.
+ * 1.14.0: Greyscale and greyscale with alpha images, from single-plane grey pixels or from truecolour
+ *        pixels the analysis pass finds are all grey.
+ * 1.15.0: Lossless alpha and bit depth reduction, dropping alpha that is fully opaque throughout, writing
+ *        16-bit samples that repeat their high byte at 8 bits, and packing greyscale into 1, 2, or 4 bits.
+ * 1.16.0: Adam7 interlacing, holding the image once in the output format and filtering and compressing
+ *        each of the seven reduced images from it a row at a time.
+ * 1.17.0: Optional per-image statistics, with the time and bytes of each stage, the rows written with
+ *        each filter, the memory held, and the compression ratio.
+ * 1.18.0: 64-bit image sizes throughout, and encoding straight from raw pixels in a file, mapped into
+ *        memory a band of rows at a time, for images larger than memory.
+ * 1.19.0: Batch encoding on a work-stealing pool of workers that each reuse one encoder, and batch
+ *        manifests for png_gradient and png_imprint.
+ * 1.20.0: Channel patterns compiled once into programs of the ramps, x, y, and arithmetic, evaluated a
+ *        row at a time with terms that do not change along a row or down the image worked out once.
+ * 1.21.0: Generated images, rows made on a pool of threads into a bounded ring of bands and encoded as
+ *        they come, so png_gradient and png_imprint no longer hold the whole image in memory.
+ * 1.22.0: Animated PNG, each frame written as the region that changed with the blend and dispose
+ *        operations that keep regions smallest, through one deflate stream reset between frames, and
+ *        png_animate.
+ * 1.23.0: Incremental encoding, caching each band of rows as its own compressed block and compressing
+ *        only the bands a dirty rectangle touches, splicing the rest back into one zlib stream.
+ * 1.24.0: Content-addressed encode cache in front of create_image(), keyed by an xxHash64 of the pixels
+ *        and the encode parameters, with an in-memory LRU under a byte budget and an on-disk tier.
+ * 1.25.0: Row packing kernels templated on the source layout, bit depth, and channels and picked once per
+ *        call, and filter kernels specialised on the filter method, leaving no branches in the row loops.
  */
 
 /** Header includes */
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <cstring>
 #include <zlib.h>
 #include "LTPNG.h"
 
@@ -29,15 +80,63 @@ using namespace std;
 /**
  * Create a truecolour or truecolour with alpha image of resolution width x height pixels with each pixel containing either
  * an 8 or 16-bit value in three channels (red, green, and blue) for truecolour, and four channels (red, green, blue, and alpha)
- * for truecolour with alpha.  Each value represents the amount of expression of the quality the channel represents, with 0 being 
- * the least expressed, and 255 (8-bit) or 65535 (16-bit) being the most expressed.
+ * for truecolour with alpha, or one channel (grey) and two channels (grey and alpha) for greyscale and greyscale with
+ * alpha.  Each value represents the amount of expression of the quality the channel represents, with 0 being the least
+ * expressed, and 255 (8-bit) or 65535 (16-bit) being the most expressed.
  */  
 LTPNG::LTPNG(unsigned char depth, unsigned char type, unsigned char filter) {
 	/** Initialize CRC vars */
-	crc_index = 0;
-	crc_allocated = 0;
-	crc_table_exists = 0;
+	crc = 0;
 	file_size = 0;
+	in_progress = 0;
+	animating = 0;
+	frame_chunks = 0;
+	
+	/** Default to 64 KiB IDAT chunks, compressing on the calling thread, and generating on every hardware thread */
+	idat_size = 65536;
+	threads = 1;
+	band_rows = 0;
+	map_size = 64 << 20;
+	generators = 0;
+	interlace = 0;
+	band = NULL;
+	workers = NULL;
+	image = NULL;
+	sink = NULL;
+	
+	/** Write the pixels in the format they come in unless asked to reduce it */
+	reduce = 0;
+	stats = NULL;
+	cache = NULL;
+	output_bit_depth = depth;
+	output_colour_type = type;
+	palette_size = 0;
+	convert = 0;
+	analysing = 0;
+	analysed = 0;
+	
+	/** Buffers and the deflate stream are allocated by the first image and kept for the ones after */
+	source_row = NULL;
+	source_capacity = 0;
+	image_rows = NULL;
+	image_capacity = 0;
+	prior_row = NULL;
+	current_row = NULL;
+	filtered_row = NULL;
+	trial_row = NULL;
+	idat_buf = NULL;
+	out_buf = NULL;
+	row_capacity = 0;
+	idat_capacity = 0;
+	stream_ready = 0;
+	
+	/** The band cache is filled by the first incremental image */
+	cache_width = 0;
+	cache_height = 0;
+	cache_rows = 0;
+	cache_depth = 0;
+	cache_type = 0;
+	cache_filter = 0;
 	
 	/** If 8-bit, max expression is at 0xFF (255) */
 	max_val = 255;
@@ -52,121 +151,672 @@ LTPNG::LTPNG(unsigned char depth, unsigned char type, unsigned char filter) {
 	filter_type = filter;
 }
 
+/** Statistics start out empty */
+LTPNGStats::LTPNGStats() {
+	reset();
+}
+
+/** Empty the statistics for the next image */
+void LTPNGStats::reset() {
+	analyse_seconds = pack_seconds = filter_seconds = deflate_seconds = crc_seconds = write_seconds = total_seconds = 0;
+	pack_in = pack_out = filter_in = filter_out = deflate_in = deflate_out = crc_bytes = write_bytes = 0;
+	memset(filter_rows, 0, sizeof(filter_rows));
+	bands_encoded = bands_reused = 0;
+	allocated = 0;
+	ratio = 0;
+}
+
+/** Compression options, defaulting to zlib's own defaults */
+LTPNGOptions::LTPNGOptions(int compression_level, int compression_strategy, int memory_level, int window_size_bits) {
+	level = compression_level;
+	strategy = compression_strategy;
+	mem_level = memory_level;
+	window_bits = window_size_bits;
+}
+
+/** Fastest preset, the shallowest match search; Z_RLE can be faster still on flat imagery but loses badly on gradients */
+LTPNGOptions LTPNGOptions::fastest() {
+	return LTPNGOptions(1, Z_DEFAULT_STRATEGY, 9, 15);
+}
+
+/** Balanced preset, zlib's defaults */
+LTPNGOptions LTPNGOptions::balanced() {
+	return LTPNGOptions(6, Z_DEFAULT_STRATEGY, 8, 15);
+}
+
+/** Smallest preset, the most thorough match search with the most memory */
+LTPNGOptions LTPNGOptions::smallest() {
+	return LTPNGOptions(9, Z_DEFAULT_STRATEGY, 9, 15);
+}
+
+/** Look up a preset by name */
+LTPNGOptions LTPNGOptions::preset(const char *name) {
+	if ( !strcmp(name, "fastest") )
+		return fastest();
+	else if ( !strcmp(name, "balanced") )
+		return balanced();
+	else if ( !strcmp(name, "smallest") )
+		return smallest();
+	
+	throw "LTPNGOptions::preset(): unknown preset, use fastest, balanced, or smallest";
+}
+
+/** Release the buffers and deflate stream kept between images */
+LTPNG::~LTPNG() {
+	abort_image();
+	
+	delete workers;
+	delete[] source_row;
+	delete[] image_rows;
+	delete[] prior_row;
+	delete[] current_row;
+	delete[] filtered_row;
+	delete[] trial_row;
+	delete[] idat_buf;
+	delete[] out_buf;
+	
+	if ( stream_ready )
+		deflateEnd(&strm);
+}
+
 /** Create a PNG image of set size with provided pixel channels */
 void LTPNG::create_image(ofstream &file, unsigned int pixel_width, unsigned int pixel_height, unsigned short *red, unsigned short *green, unsigned short *blue, unsigned short *alpha) {	
+	use_file(file);
+	create_image(file_sink, pixel_width, pixel_height, red, green, blue, alpha);
 	image = &file;
-	width = pixel_width;
-	height = pixel_height;
+}
+
+/** Create a PNG image of set size with provided 8-bit pixel channels, each holding width*height values */
+void LTPNG::create_image(ofstream &file, unsigned int pixel_width, unsigned int pixel_height, const unsigned char *red, const unsigned char *green, const unsigned char *blue, const unsigned char *alpha) {
+	use_file(file);
+	create_image(file_sink, pixel_width, pixel_height, red, green, blue, alpha);
+	image = &file;
+}
+
+/** 
+ * Create a PNG image of set size from interleaved pixels in one of the PIXELS_* formats, with rows stride bytes
+ * apart (0 for tightly packed rows)
+ */
+void LTPNG::create_image(ofstream &file, unsigned int pixel_width, unsigned int pixel_height, const unsigned char *pixels, unsigned char format, size_t stride) {
+	use_file(file);
+	create_image(file_sink, pixel_width, pixel_height, pixels, format, stride);
+	image = &file;
+}
+
+/** 
+ * Create a PNG image of set size with provided pixel channels, written to a sink.  With reduce set, the image is
+ * analysed first and written in the smallest format that holds it exactly.  With a cache, an image encoded the same
+ * way before is written straight from the cache, and any other is kept in the cache once written
+ */
+void LTPNG::create_image(LTPNGSink &out, unsigned int pixel_width, unsigned int pixel_height, unsigned short *red, unsigned short *green, unsigned short *blue, unsigned short *alpha) {
+	encode_cached(out, pixel_width, pixel_height, [&]() { return planes_key(pixel_width, pixel_height, red, green, blue, alpha, sizeof(unsigned short)); }, [&]() { write_rows(pixel_height, red, green, blue, alpha); });
+}
+
+/** Create a PNG image of set size with provided 8-bit pixel channels, written to a sink, or from the cache if it is there */
+void LTPNG::create_image(LTPNGSink &out, unsigned int pixel_width, unsigned int pixel_height, const unsigned char *red, const unsigned char *green, const unsigned char *blue, const unsigned char *alpha) {
+	encode_cached(out, pixel_width, pixel_height, [&]() { return planes_key(pixel_width, pixel_height, red, green, blue, alpha, 1); }, [&]() { write_rows(pixel_height, red, green, blue, alpha); });
+}
+
+/** 
+ * Create a PNG image of set size from interleaved pixels in one of the PIXELS_* formats, written to a sink, or from
+ * the cache if it is there
+ */
+void LTPNG::create_image(LTPNGSink &out, unsigned int pixel_width, unsigned int pixel_height, const unsigned char *pixels, unsigned char format, size_t stride) {
+	encode_cached(out, pixel_width, pixel_height, [&]() { return pixels_key(pixel_width, pixel_height, pixels, format, stride); }, [&]() { write_rows(pixel_height, pixels, format, stride); });
+}
+
+/** Begin a streamed image written to a file stream, which must stay open until end_image() */
+void LTPNG::begin_image(ofstream &file, unsigned int pixel_width, unsigned int pixel_height, unsigned char depth, unsigned char type) {
+	use_file(file);
+	begin_image(file_sink, pixel_width, pixel_height, depth, type);
+	image = &file;
+}
+
+/** Point the file sink at a file stream, as long as no image in progress is still writing to it */
+void LTPNG::use_file(ofstream &file) {
+	if ( in_progress )
+		throw "LTPNG::begin_image(): previous image was not finished with end_image()";
 	
-	/** Calculate pixel size */
-	unsigned char pixel_size = colour_type == 2 ? 3 : 4;
+	file_sink.file = &file;
+}
 
-	if ( bit_depth == 16 )
-		pixel_size *= 2;
+/** 
+ * Begin a streamed image of resolution width x height, writing the signature and header chunk and preparing the 
+ * scanline buffers and deflate stream so that rows can be pushed with write_rows() as they become available
+ */
+void LTPNG::begin_image(LTPNGSink &out, unsigned int pixel_width, unsigned int pixel_height, unsigned char depth, unsigned char type) {
+	/** Verify the encoder is free and the image parameters are supported, and set up for the caller's pixels */
+	if ( in_progress )
+		throw "LTPNG::begin_image(): previous image was not finished with end_image()";
+	
+	check_options();
+	setup_source(pixel_width, pixel_height, depth, type);
+	
+	image = NULL;
+	sink = &out;
 	
-	/** Set max data size for buffers */
-	unsigned int data_size = height*(width*pixel_size + 1);
+	/** Write the format picked by analyse_image() if it just ran, otherwise the format the pixels come in */
+	if ( !analysed ) {
+		output_bit_depth = bit_depth;
+		output_colour_type = colour_type;
+		palette_size = 0;
 		
-	/** Self-allocate uncompressed, filtered, and compressed IDAT data stream arrays */
-	uncompressed_data = new unsigned char[data_size];
-	filtered_data = new unsigned char[data_size];
-	compressed_data = new unsigned char[data_size];
-
-	unsigned int row, col;
-	unsigned int uncompressed_len = 0;
-	unsigned int filtered_len = 0;
-	unsigned int compressed_len = 0;
-
-	/** Loop through each pixel row in the image to load the channel data */
-	for ( row = 0; row < height; row++ ) {
-		/** Save the filter bit (currently 0 for unfiltered) as the first byte of the uncompressed stream */
-		uncompressed_data[uncompressed_len++] = filter_type;
-		filtered_data[filtered_len++] = uncompressed_data[uncompressed_len - 1];
-
-		/** 
-		 * Loop through each pixel column on this row, saving each of the channels for each pixel in the 
-		 * uncompressed stream in the proper order, including alpha channels for colour_type (6)
-		 */
-		for ( col = 0; col < width; col++ ) {
-			/** If 8-bit */
-			if ( bit_depth == 8 ) {
-				/** Store the raw, uncompressed 8-bit RGB(A) pixel data in the uncompressed data array */
-				uncompressed_data[uncompressed_len++] = red[row*width + col];
-				uncompressed_data[uncompressed_len++] = green[row*width + col];
-				uncompressed_data[uncompressed_len++] = blue[row*width + col];
-				
-				if ( colour_type == 6 )
-					uncompressed_data[uncompressed_len++] = alpha[row*width + col];
-
-				/** Now that the uncompressed data is stored, we can go ahead and filter those bytes */
-				filtered_data[filtered_len++] = filter_byte(row, col, 1);
-				filtered_data[filtered_len++] = filter_byte(row, col, 2);
-				filtered_data[filtered_len++] = filter_byte(row, col, 3);
-				
-				if ( colour_type == 6 )
-					filtered_data[filtered_len++] = filter_byte(row, col, 4);
-			}
-			
-			/** If 16-bit */
-			if ( bit_depth == 16 ) {
-				/** Store the raw, uncompressed 16-bit RGB(A) pixel data in the uncompressed data array */
-				uncompressed_data[uncompressed_len++] = get_byte_from_two_bytes(red[row*width + col], 1);
-				uncompressed_data[uncompressed_len++] = get_byte_from_two_bytes(red[row*width + col], 2);
-				uncompressed_data[uncompressed_len++] = get_byte_from_two_bytes(green[row*width + col], 1);
-				uncompressed_data[uncompressed_len++] = get_byte_from_two_bytes(green[row*width + col], 2);
-				uncompressed_data[uncompressed_len++] = get_byte_from_two_bytes(blue[row*width + col], 1);
-				uncompressed_data[uncompressed_len++] = get_byte_from_two_bytes(blue[row*width + col], 2);
-				
-				if ( colour_type == 6 ) {
-					uncompressed_data[uncompressed_len++] = get_byte_from_two_bytes(alpha[row*width + col], 1);
-					uncompressed_data[uncompressed_len++] = get_byte_from_two_bytes(alpha[row*width + col], 2);
-				}
-				
-				/** Now that the uncompressed data is stored, we can go ahead and filter those bytes */
-				filtered_data[filtered_len++] = filter_byte(row, col, 1);
-				filtered_data[filtered_len++] = filter_byte(row, col, 2);
-				filtered_data[filtered_len++] = filter_byte(row, col, 3);
-				filtered_data[filtered_len++] = filter_byte(row, col, 4);
-				filtered_data[filtered_len++] = filter_byte(row, col, 5);
-				filtered_data[filtered_len++] = filter_byte(row, col, 6);
-				
-				if ( colour_type == 6 ) {
-					filtered_data[filtered_len++] = filter_byte(row, col, 7);
-					filtered_data[filtered_len++] = filter_byte(row, col, 8);
-				}
-			} 
+		/** The statistics cover the analysis pass too when there was one, and start here when there was not */
+		if ( stats ) {
+			stats->reset();
+			stats_start = stats_clock();
 		}
 	}
 	
-	/** Compress the data using the zlib library */    
-	def(filtered_data, filtered_len, compressed_data, data_size, compressed_len, Z_DEFAULT_COMPRESSION);
+	analysed = 0;
+	
+	setup_buffers();
+	out_len = 0;
+	begin_stream();
 	
-	/** Allocate space for the CRC buffer */
-	allocate_crc_size(bit_depth, colour_type);
+	file_size = 0;
+	in_progress = 1;
 	
 	/** Write the PNG file signature per section 5.2 */
 	write_png_signature();
 
-	/** Write the IHDR header chunk per 11.2.2 */
-	write_header_chunk(bit_depth, colour_type, 0);
+	/** Write the IHDR header chunk per 11.2.2, and the palette chunks an indexed-colour image needs per 11.2.3 and 11.3.2 */
+	write_header_chunk(output_bit_depth, output_colour_type, interlace);
+	
+	if ( output_colour_type == 3 ) {
+		write_palette_chunk();
+		write_transparency_chunk();
+	}
+}
+
+/** 
+ * Work out the pixel and scanline size of the image or frame about to be written, growing the buffers kept between
+ * images if they are too small for it
+ */
+void LTPNG::setup_buffers() {
+	/** Calculate pixel and scanline size, pixels under 8 bits are packed into bytes and filtered a byte at a time per 9.2 */
+	unsigned int bits = channel_count(output_colour_type)*output_bit_depth;
+	
+	pixel_size = bits < 8 ? 1 : bits/8;
+	row_size = ((unsigned long long) width*bits + 7)/8;
+	convert = output_bit_depth != bit_depth || output_colour_type != colour_type;
+	
+	/** Grow the scanline buffers only for rows longer than any image before, the prior row starts as all zeros per 9.2 */
+	if ( row_size > row_capacity ) {
+		delete[] prior_row;
+		delete[] current_row;
+		delete[] filtered_row;
+		delete[] trial_row;
+		
+		prior_row = new unsigned char[row_size];
+		current_row = new unsigned char[row_size];
+		filtered_row = new unsigned char[row_size + 1];
+		trial_row = new unsigned char[row_size + 1];
+		row_capacity = row_size;
+	}
+	
+	memset(prior_row, 0, row_size);
+	prior = prior_row;
+	
+	/** An interlaced image needs every row before the first pass can be written, so it is held until end_image() */
+	if ( interlace && (size_t) height*row_size > image_capacity ) {
+		delete[] image_rows;
+		
+		image_capacity = (size_t) height*row_size;
+		image_rows = new unsigned char[image_capacity];
+	}
+	
+	/** Likewise the IDAT buffer, and the output buffer which holds a full IDAT chunk along with any small chunks around it */
+	if ( idat_size > idat_capacity ) {
+		delete[] idat_buf;
+		delete[] out_buf;
 		
-	/** Write the compressed data as a single IDAT chunk per 4.1 and 11.2.4 */
-	write_data_chunk(compressed_data, compressed_len);
+		idat_buf = new unsigned char[idat_size];
+		out_size = idat_size + 4096;
+		out_buf = new unsigned char[out_size];
+		idat_capacity = idat_size;
+	}
+}
 
+/** Start the compressed data of an image or frame, on worker threads in bands or through the kept deflate stream */
+void LTPNG::begin_stream() {
+	if ( threads > 1 ) {
+		/** With worker threads, filtered rows are gathered into bands of about 1 MiB unless told otherwise */
+		band_limit = band_rows ? band_rows : (1 << 20)/(row_size + 1) + 1;
+		band = new LTPNGBand;
+		band->in.reserve((size_t) band_limit*(row_size + 1));
+		stream_adler = adler32(0L, Z_NULL, 0);
+	} else {
+		/** The deflate stream is set up once and reset for each image after, unless the options it was set up with changed */
+		if ( stream_ready && (options.window_bits != stream_options.window_bits || options.mem_level != stream_options.mem_level) ) {
+			deflateEnd(&strm);
+			stream_ready = 0;
+		}
+		
+		if ( stream_ready ) {
+			if ( deflateReset(&strm) != Z_OK )
+				throw "LTPNG::begin_image(): deflateReset() stream state was inconsistent";
+			
+			if ( (options.level != stream_options.level || options.strategy != stream_options.strategy) && deflateParams(&strm, options.level, options.strategy) != Z_OK )
+				throw "LTPNG::begin_image(): deflateParams() received invalid parameters";
+		} else {
+			/** Allocate deflate state */
+			strm.zalloc = Z_NULL;
+			strm.zfree = Z_NULL;
+			strm.opaque = Z_NULL;
+			
+			/** Initialize the zlib deflate stream */
+			int ret = deflateInit2(&strm, options.level, Z_DEFLATED, options.window_bits, options.mem_level, options.strategy);
+			
+			/** Handle any errors */
+			if ( ret != Z_OK ) {
+				switch ( ret ) {
+					case Z_MEM_ERROR: throw "LTPNG::begin_image(): not enough memory for deflateInit2()";
+					case Z_STREAM_ERROR: throw "LTPNG::begin_image(): deflateInit2() received invalid parameters";
+					case Z_VERSION_ERROR: throw "LTPNG::begin_image(): zlib library version is incompatible with the version of deflateInit2() assumed";
+					default: throw "LTPNG::begin_image(): unknown error on deflateInit2()";
+				}
+			}
+			
+			stream_ready = 1;
+		}
+		
+		stream_options = options;
+		
+		/** Compressed output collects in the IDAT buffer until a full chunk is ready */
+		strm.next_out = idat_buf;
+		strm.avail_out = idat_size;
+	}
+	
+	rows_written = 0;
+}
+
+/** Validate the format and size of the caller's pixels and set up the source row they are packed into before conversion */
+void LTPNG::setup_source(unsigned int pixel_width, unsigned int pixel_height, unsigned char depth, unsigned char type) {
+	if ( depth != 8 && depth != 16 )
+		throw "LTPNG::begin_image(): only 8 and 16-bit depths are supported";
+	
+	if ( type != 0 && type != 2 && type != 4 && type != 6 )
+		throw "LTPNG::begin_image(): only greyscale (0), truecolour (2), greyscale with alpha (4), and truecolour with alpha (6) are supported";
+	
+	if ( filter_type > FILTER_ADAPTIVE_ENTROPY )
+		throw "LTPNG::begin_image(): Invalid filter type.";
+	
+	if ( interlace > 1 )
+		throw "LTPNG::begin_image(): interlace method must be 0 (none) or 1 (Adam7)";
+	
+	if ( pixel_width == 0 || pixel_height == 0 || idat_size == 0 )
+		throw "LTPNG::begin_image(): width, height, and IDAT size must be non-zero";
+	
+	/** Width and height are limited to 2^31 - 1 per 11.2.2, and each row must fit the 32-bit scanline buffers */
+	if ( pixel_width > 0x7FFFFFFF || pixel_height > 0x7FFFFFFF )
+		throw "LTPNG::begin_image(): width and height must be no more than 2^31 - 1";
+	
+	if ( (unsigned long long) pixel_width*channel_count(type)*(depth/8) >= 0x7FFFFFFF )
+		throw "LTPNG::begin_image(): image rows are too large";
+	
+	width = pixel_width;
+	height = pixel_height;
+	bit_depth = depth;
+	colour_type = type;
+	max_val = depth == 16 ? 65535 : 255;
+	source_size = width*channel_count(colour_type)*(bit_depth/8);
+	
+	if ( source_size > source_capacity ) {
+		delete[] source_row;
+		
+		source_row = new unsigned char[source_size];
+		source_capacity = source_size;
+	}
+	
+	rows_written = 0;
+}
+
+/** Number of samples per pixel for a colour type per table 11.1 */
+unsigned char LTPNG::channel_count(unsigned char type) {
+	return type == 2 ? 3 : type == 4 ? 2 : type == 6 ? 4 : 1;
+}
+
+/** Number of samples per pixel for one of the PIXELS_* formats */
+unsigned char LTPNG::format_channels(unsigned char format) {
+	switch ( format ) {
+		case PIXELS_RGB8: case PIXELS_RGB16BE: return 3;
+		case PIXELS_RGBA8: case PIXELS_RGBA16BE: return 4;
+		case PIXELS_GREY8: case PIXELS_GREY16BE: return 1;
+		default: return 2;
+	}
+}
+
+/** 
+ * Push the next rows of the image in progress, each channel pointing at rows*width values laid out row by row, 
+ * with 0 being the least expressed and max_val the most expressed; alpha is only read for colour types (4) and (6),
+ * and greyscale images take their grey channel from red, leaving green and blue unread
+ */
+void LTPNG::write_rows(unsigned int rows, unsigned short *red, unsigned short *green, unsigned short *blue, unsigned short *alpha) {
+	if ( !in_progress )
+		throw "LTPNG::write_rows(): begin_image() must be called first";
+	
+	if ( rows > height - rows_written )
+		throw "LTPNG::write_rows(): more rows written than the image height";
+	
+	/** Pick the kernel for the image's bit depth and colour type once, rather than for each pixel */
+	LTPNGPlanesKernel pack = planes_packer(sizeof(unsigned short));
+	unsigned int row;
+	
+	/** Loop through each pixel row to pack the channel data in PNG byte order */
+	for ( row = 0; row < rows; row++ ) {
+		unsigned char *packed = pack_target();
+		double start = stats ? stats_clock() : 0;
+		
+		pack(packed, red, green, blue, alpha, (size_t) row*width, width);
+		
+		if ( stats && !analysing ) {
+			stats->pack_seconds += stats_clock() - start;
+			stats->pack_in += (unsigned long long) width*channel_count(colour_type)*sizeof(unsigned short);
+		}
+		
+		/** Filter and compress the row now that it is packed */
+		encode_row(packed);
+	}
+}
+
+/** Push the next rows of the image in progress from 8-bit channels, each pointing at rows*width values */
+void LTPNG::write_rows(unsigned int rows, const unsigned char *red, const unsigned char *green, const unsigned char *blue, const unsigned char *alpha) {
+	if ( !in_progress )
+		throw "LTPNG::write_rows(): begin_image() must be called first";
+	
+	if ( rows > height - rows_written )
+		throw "LTPNG::write_rows(): more rows written than the image height";
+	
+	/** 16-bit images scale each channel up by repeating it in both bytes, so 0xFF becomes 0xFFFF */
+	LTPNGPlanesKernel pack = planes_packer(1);
+	unsigned int row;
+	
+	for ( row = 0; row < rows; row++ ) {
+		unsigned char *packed = pack_target();
+		double start = stats ? stats_clock() : 0;
+		
+		pack(packed, red, green, blue, alpha, (size_t) row*width, width);
+		
+		if ( stats && !analysing ) {
+			stats->pack_seconds += stats_clock() - start;
+			stats->pack_in += (unsigned long long) width*channel_count(colour_type);
+		}
+		
+		encode_row(packed);
+	}
+}
+
+/** 
+ * Push the next rows of the image in progress from interleaved pixels in one of the PIXELS_* formats, with rows 
+ * stride bytes apart (0 for tightly packed rows).  Rows already in PNG byte order for the image's bit depth and 
+ * colour type are filtered straight from the caller's memory, anything else is converted a row at a time.
+ */
+void LTPNG::write_rows(unsigned int rows, const unsigned char *pixels, unsigned char format, size_t stride) {
+	if ( !in_progress )
+		throw "LTPNG::write_rows(): begin_image() must be called first";
+	
+	if ( rows > height - rows_written )
+		throw "LTPNG::write_rows(): more rows written than the image height";
+	
+	if ( format > PIXELS_GREYA16BE )
+		throw "LTPNG::write_rows(): invalid pixel format";
+	
+	/** Work out the source layout */
+	unsigned char channels = format_channels(format);
+	unsigned char depth = format == PIXELS_RGB8 || format == PIXELS_RGBA8 || format == PIXELS_GREY8 || format == PIXELS_GREYA8 ? 8 : 16;
+	unsigned int row;
+	
+	/** Grey pixels fill every colour channel, but colour pixels cannot be narrowed to grey without losing them */
+	if ( channels >= 3 && !(colour_type & 2) )
+		throw "LTPNG::write_rows(): truecolour pixels cannot be written to a greyscale image";
+	
+	if ( stride == 0 )
+		stride = (size_t) width*channels*depth/8;
+	
+	/** The source is in PNG byte order if the bit depth and channels agree, otherwise the kernel is picked once */
+	bool direct = depth == bit_depth && channels == channel_count(colour_type);
+	LTPNGPixelsKernel pack = direct ? NULL : pixels_packer(format);
+	
+	for ( row = 0; row < rows; row++, pixels += stride ) {
+		if ( direct ) {
+			encode_row(pixels);
+		} else {
+			double start = stats ? stats_clock() : 0;
+			
+			pack(pack_target(), pixels, width);
+			
+			if ( stats && !analysing ) {
+				stats->pack_seconds += stats_clock() - start;
+				stats->pack_in += (unsigned long long) width*channels*depth/8;
+			}
+			
+			encode_row(pack_target());
+		}
+	}
+	
+	/** The caller's memory may not outlive this call, so hold on to a copy of the last row */
+	keep_prior_row();
+}
+
+/** Finish the image in progress, flushing the remaining compressed data and writing the end chunk */
+void LTPNG::end_image() {
+	if ( !in_progress )
+		throw "LTPNG::end_image(): begin_image() must be called first";
+	
+	if ( animating )
+		throw "LTPNG::end_image(): an animation is in progress, finish it with end_animation()";
+	
+	if ( rows_written != height )
+		throw "LTPNG::end_image(): fewer rows written than the image height";
+	
+	end_stream();
+	
 	/** Write the IEND end chunk and 11.2.5 */
 	write_end_chunk();
 	
-	/** Clean up self-allocated memory */
-	delete[] uncompressed_data;
-	delete[] filtered_data;
-	delete[] compressed_data;
+	/** Write out whatever is still sitting in the output buffer, the buffers and deflate stream are kept for the next image */
+	flush_output();
 	
-	file_size = compressed_len;
+	if ( stats )
+		finish_stats();
 	
-	/** Initialize CRC vars */
-	crc_index = 0;
-	crc_allocated = 0;
-	crc_table_exists = 0;
+	in_progress = 0;
+}
+
+/** Finish the compressed data of an image or frame, writing out everything still held as data chunks */
+void LTPNG::end_stream() {
+	/** An interlaced image only now has every row it needs to write its passes */
+	if ( interlace )
+		encode_passes();
+	
+	if ( band ) {
+		/** Send off the final band and write out every band still in flight */
+		dispatch_band(true);
+		
+		while ( !bands.empty() ) {
+			write_band(bands.front());
+			bands.pop_front();
+		}
+	} else {
+		/** Drain the deflate stream and write whatever is left as the last IDAT chunk */
+		deflate_data(Z_NULL, 0, Z_FINISH);
+		flush_data_chunk();
+		
+		file_size += strm.total_out;
+	}
+}
+
+/** 
+ * Abandon the image in progress after an error so the encoder can begin another, discarding anything not yet
+ * written to the sink
+ */
+void LTPNG::abort_image() {
+	if ( !in_progress )
+		return;
+	
+	/** Bands still compressing must finish before their memory can go */
+	while ( !bands.empty() ) {
+		if ( bands.front()->done.valid() )
+			bands.front()->done.wait();
+		
+		delete bands.front();
+		bands.pop_front();
+	}
+	
+	delete band;
+	band = NULL;
+	out_len = 0;
+	in_progress = 0;
+	analysing = 0;
+	analysed = 0;
+	animating = 0;
+	frame_chunks = 0;
+}
+
+/** Take the next row in PNG byte order, filtering and compressing it, or holding it if the image is interlaced */
+void LTPNG::encode_row(const unsigned char *raw) {
+	/** While analysing, rows are only looked at */
+	if ( analysing ) {
+		analyse_row(raw);
+		rows_written++;
+		return;
+	}
+	
+	/** Rows packed here count towards packing, along with the time to convert them to the format being written */
+	double start = stats ? stats_clock() : 0;
+	
+	if ( stats && (raw == pack_target() || convert) )
+		stats->pack_out += row_size;
+	
+	/** An interlaced image keeps the row in the output format for its passes */
+	if ( interlace ) {
+		unsigned char *kept = image_rows + (size_t) rows_written*row_size;
+		
+		if ( convert )
+			convert_row(raw, kept);
+		else
+			memcpy(kept, raw, row_size);
+		
+		if ( stats && convert )
+			stats->pack_seconds += stats_clock() - start;
+		
+		rows_written++;
+		return;
+	}
+	
+	/** Convert the row into the format being written */
+	if ( convert ) {
+		convert_row(raw, current_row);
+		raw = current_row;
+		
+		if ( stats )
+			stats->pack_seconds += stats_clock() - start;
+	}
+	
+	compress_row(raw, rows_written + 1 == height);
+	rows_written++;
+}
+
+/** 
+ * Filter a row in the output format against the prior row and compress it, or gather it into the current band and
+ * send the band off once it is full unless it is the last row of the image
+ */
+void LTPNG::compress_row(const unsigned char *raw, bool last) {
+	double start = stats ? stats_clock() : 0;
+	
+	/** Save the filter type as the first byte of the filtered scanline per 7.3 */
+	if ( filter_type < FILTER_ADAPTIVE ) {
+		filtered_row[0] = filter_type;
+		filter_row(filtered_row + 1, raw, prior, row_size, pixel_size, filter_type);
+	} else {
+		select_filter(raw);
+	}
+	
+	if ( stats ) {
+		stats->filter_seconds += stats_clock() - start;
+		stats->filter_in += row_size;
+		stats->filter_out += row_size + 1;
+		stats->deflate_in += row_size + 1;
+		stats->filter_rows[filtered_row[0]]++;
+	}
+	
+	/** Compress the row here, or gather it into the current band and send the band off once it is full */
+	if ( band ) {
+		band->in.insert(band->in.end(), filtered_row, filtered_row + row_size + 1);
+		
+		if ( band->in.size() >= (size_t) band_limit*(row_size + 1) && !last )
+			dispatch_band(false);
+	} else {
+		deflate_data(filtered_row, row_size + 1, Z_NO_FLUSH);
+	}
+	
+	/** The row just encoded becomes the prior row of the next one, swapping buffers if it was packed here */
+	if ( raw == current_row ) {
+		current_row = prior_row;
+		prior_row = (unsigned char *) raw;
+	}
+	
+	prior = raw;
+}
+
+/** Convert one row of interleaved pixels in one of the PIXELS_* formats into PNG byte order in out, or the pack target */
+void LTPNG::pack_row(const unsigned char *src, unsigned char format, unsigned char *out) {
+	pixels_packer(format)(out ? out : pack_target(), src, width);
+}
+
+/** 
+ * The buffer rows are packed into in the caller's format, current_row when they are encoded as they are, or the
+ * source row when they are converted to another format into current_row first
+ */
+unsigned char *LTPNG::pack_target() {
+	return convert || analysing ? source_row : current_row;
+}
+
+/** Copy the prior row into our own buffer if it still points at the caller's memory */
+void LTPNG::keep_prior_row() {
+	if ( prior == prior_row )
+		return;
+	
+	memcpy(prior_row, prior, row_size);
+	prior = prior_row;
+}
+
+/** Feed data to the deflate stream, writing an IDAT chunk each time the IDAT buffer fills up */
+void LTPNG::deflate_data(unsigned char *in, unsigned int len, int flush) {
+	int ret;
+	
+	strm.next_in = in;
+	strm.avail_in = len;
+	
+	do {
+		double start = stats ? stats_clock() : 0;
+		
+		ret = deflate(&strm, flush);
+		
+		if ( stats )
+			stats->deflate_seconds += stats_clock() - start;
+		
+		if ( ret == Z_STREAM_ERROR )
+			throw "LTPNG::deflate_data(): deflate() stream state was inconsistent";
+		
+		if ( strm.avail_out == 0 )
+			flush_data_chunk();
+	} while ( strm.avail_in > 0 || (flush == Z_FINISH && ret != Z_STREAM_END) );
+}
+
+/** Write the compressed data gathered so far as one IDAT chunk and reset the IDAT buffer */
+void LTPNG::flush_data_chunk() {
+	unsigned int len = idat_size - strm.avail_out;
+	
+	if ( len == 0 )
+		return;
+	
+	/** Write the compressed data as an IDAT chunk per 4.1 and 11.2.4 */
+	write_data_chunk(idat_buf, len);
+	
+	strm.next_out = idat_buf;
+	strm.avail_out = idat_size;
 }
 
 /** Write the 8-byte PNG file signature per section 5.2 */
@@ -184,7 +834,7 @@ void LTPNG::write_png_signature() {
 /** Write the IHDR image header chunk */
 void LTPNG::write_header_chunk(unsigned char bit_depth, unsigned char colour_type, unsigned char interlace_method) {	
 	fwrite_32(13);				/** Write the 4-byte data length to start the header chunk */
-	crc_init();					/** Reset the CRC buffer */
+	crc_init();					/** Reset the running CRC */
 	fwrite_8(73);				/** Write the 4-byte chunk type per 11.2.2 */
 	fwrite_8(72);
 	fwrite_8(68);
@@ -199,28 +849,96 @@ void LTPNG::write_header_chunk(unsigned char bit_depth, unsigned char colour_typ
 	fwrite_32(get_crc());		/** Calculate and write the 4-byte CRC value per Annex D */
 }
 
-/** Write an IDAT image data chunk */
+/** Write an IDAT image data chunk, or an fdAT frame data chunk for the frames of an animation after the first */
 void LTPNG::write_data_chunk(unsigned char *compressed_data, unsigned int len) {
+	write_data_chunk_start(len);
+	
+	/** Write the compressed data per 4.1 and 11.2.4 */
+	fwrite_data(compressed_data, len);
+
+	fwrite_32(get_crc());		/** Calculate and write the 4-byte CRC value per Annex D */
+}
+
+/** Write an IDAT or fdAT data chunk whose data CRC was already calculated elsewhere */
+void LTPNG::write_data_chunk(unsigned char *compressed_data, unsigned int len, unsigned int data_crc) {
+	write_data_chunk_start(len);
+	
+	/** Write the compressed data and combine its CRC with the CRC of the chunk type */
+	fwrite_raw(compressed_data, len);
+	crc = crc_combine(get_crc(), data_crc, len) ^ 0xffffffffL;
+	
+	fwrite_32(get_crc());		/** Write the 4-byte CRC value per Annex D */
+}
+
+/** Write the length and type of a data chunk, an fdAT chunk leading its data with the next sequence number */
+void LTPNG::write_data_chunk_start(unsigned int len) {
+	if ( frame_chunks ) {
+		fwrite_32(len + 4);		/** Write the 4-byte data length, counting the sequence number */
+		crc_init();				/** Reset the running CRC */
+		fwrite_8(102);			/** Write the 4-byte chunk type */
+		fwrite_8(100);
+		fwrite_8(65);
+		fwrite_8(84);
+		fwrite_32(sequence++);	/** Write the 4-byte sequence number shared with the frame control chunks */
+		return;
+	}
+	
 	fwrite_32(len);				/** Write the 4-byte data length to start the data chunk */
-	crc_init();					/** Reset the CRC buffer */
+	crc_init();					/** Reset the running CRC */
 	fwrite_8(73);				/** Write the 4-byte chunk type per 11.2.4 */
 	fwrite_8(68);
 	fwrite_8(65);
 	fwrite_8(84);
-    	
-    /** Write the compressed data per 4.1 and 11.2.4 */
-    unsigned int i;
-    
-    for ( i = 0; i < len; i++ )
-		fwrite_8(compressed_data[i]);
+}
+
+/** Write the PLTE palette chunk, the red, green, and blue of each palette entry in order */
+void LTPNG::write_palette_chunk() {
+	unsigned int i;
+	
+	fwrite_32(palette_size*3);	/** Write the 4-byte data length to start the palette chunk */
+	crc_init();					/** Reset the running CRC */
+	fwrite_8(80);				/** Write the 4-byte chunk type per 11.2.3 */
+	fwrite_8(76);
+	fwrite_8(84);
+	fwrite_8(69);
+	
+	for ( i = 0; i < palette_size; i++ ) {
+		fwrite_8(palette[i] >> 24);
+		fwrite_8(palette[i] >> 16);
+		fwrite_8(palette[i] >> 8);
+	}
+	
+	fwrite_32(get_crc());		/** Calculate and write the 4-byte CRC value per Annex D */
+}
 
+/** Write the tRNS transparency chunk for an indexed-colour image, if any palette entries are not fully opaque */
+void LTPNG::write_transparency_chunk() {
+	unsigned int count = 0, i;
+	
+	/** Entries past the end of the chunk are opaque, and the palette keeps the translucent entries first */
+	while ( count < palette_size && (palette[count] & 0xFF) != 0xFF )
+		count++;
+	
+	if ( count == 0 )
+		return;
+	
+	fwrite_32(count);			/** Write the 4-byte data length to start the transparency chunk */
+	crc_init();					/** Reset the running CRC */
+	fwrite_8(116);				/** Write the 4-byte chunk type per 11.3.2 */
+	fwrite_8(82);
+	fwrite_8(78);
+	fwrite_8(83);
+	
+	for ( i = 0; i < count; i++ )
+		fwrite_8(palette[i] & 0xFF);
+	
 	fwrite_32(get_crc());		/** Calculate and write the 4-byte CRC value per Annex D */
 }
 
 /** Write the IEND image end chunk */
 void LTPNG::write_end_chunk() {
 	fwrite_32(0);				/** Write the 4-byte data length to start the end chunk */
-	crc_init();					/** Reset the CRC buffer */
+	crc_init();					/** Reset the running CRC */
 	fwrite_8(73);				/** Write the 4-byte chunk type per 11.2.5 */
 	fwrite_8(69);
 	fwrite_8(78);
@@ -228,24 +946,24 @@ void LTPNG::write_end_chunk() {
 	fwrite_32(get_crc());		/** Calculate and write the 4-byte CRC value per Annex D */
 }
 
-/** Write one 8-bit unsigned int to an image file and append it to the CRC buffer */
+/** Write one 8-bit unsigned int to the output buffer and fold it into the running CRC */
 void LTPNG::fwrite_8(unsigned char val) { 
-	/** Verify we won't exceeded the CRC buffer size */ 
-	if ( crc_index == crc_allocated )
-		throw "LTPNG: CRC buffer out of room, was allocate_crc_size() called?";
+	/** Make room by writing out the buffer if it is full */ 
+	if ( out_len == out_size )
+		flush_output();
 
-	image->write((char *) &val, 1);
-	crc_buf[crc_index++] = val;
+	out_buf[out_len++] = val;
+	crc = update_crc(crc, &val, 1);
 }
 
-/** Write one 16-bit unsigned int to an image file in big endian order and append append each byte to the CRC buffer */
+/** Write one 16-bit unsigned int to the output buffer in big endian order and fold each byte into the running CRC */
 void LTPNG::fwrite_16(unsigned short val) {
 	/** PNG prefers big endian, so have to re-order the 32-bit unsigned int */
 	fwrite_8(get_byte_from_two_bytes(val, 1));
 	fwrite_8(get_byte_from_two_bytes(val, 2));
 }
 
-/** Write one 32-bit unsigned int to an image file in big endian order and append append each byte to the CRC buffer */
+/** Write one 32-bit unsigned int to the output buffer in big endian order and fold each byte into the running CRC */
 void LTPNG::fwrite_32(unsigned int val) {
 	/** PNG prefers big endian, so have to re-order the 32-bit unsigned int */
 	fwrite_8(get_byte_from_four_bytes(val, 1));
@@ -254,6 +972,60 @@ void LTPNG::fwrite_32(unsigned int val) {
 	fwrite_8(get_byte_from_four_bytes(val, 4));
 }
 
+/** Write a block of chunk data, folding it into the running CRC in one pass */
+void LTPNG::fwrite_data(unsigned char *data, unsigned int len) {
+	double start = stats ? stats_clock() : 0;
+	
+	crc = update_crc(crc, data, len);
+	
+	if ( stats ) {
+		stats->crc_seconds += stats_clock() - start;
+		stats->crc_bytes += len;
+	}
+	
+	fwrite_raw(data, len);
+}
+
+/** 
+ * Write a block of chunk data without touching the running CRC; data that does not fit in the output buffer 
+ * is written straight to the sink in one bulk write once the buffer is written out
+ */
+void LTPNG::fwrite_raw(unsigned char *data, unsigned int len) {
+	if ( len <= out_size - out_len ) {
+		memcpy(out_buf + out_len, data, len);
+		out_len += len;
+		return;
+	}
+	
+	flush_output();
+	
+	double start = stats ? stats_clock() : 0;
+	
+	sink->write(data, len);
+	
+	if ( stats ) {
+		stats->write_seconds += stats_clock() - start;
+		stats->write_bytes += len;
+	}
+}
+
+/** Write the contents of the output buffer to the sink and empty it */
+void LTPNG::flush_output() {
+	if ( out_len == 0 )
+		return;
+	
+	double start = stats ? stats_clock() : 0;
+	
+	sink->write(out_buf, out_len);
+	
+	if ( stats ) {
+		stats->write_seconds += stats_clock() - start;
+		stats->write_bytes += out_len;
+	}
+	
+	out_len = 0;
+}
+
 /** Retrieves one 8-bit unsigned int segment from a 16-bit unsigned int value */
 unsigned char LTPNG::get_byte_from_two_bytes(unsigned int val, unsigned char byte_num) {
 	/** Verify a valid byte number was provided (byte 1 = bits 31..24, byte 2 = bits 23..16, byte 3 = bits 15..8, byte 4 = bits 7..0) */
@@ -280,31 +1052,66 @@ unsigned char LTPNG::get_byte_from_four_bytes(unsigned int val, unsigned char by
 	return (val>>shift) & 0xFF;
 }
 
-/** Perform the filter conversion using the 5 supported filter methods */
-unsigned char LTPNG::filter_byte(unsigned int row, unsigned int col, unsigned char offset) {
-	unsigned char x, a, b, c;
-	unsigned char pixel_size = colour_type == 2 ? 3 : 4;
-	
-	if ( bit_depth == 16 )
-		pixel_size *= 2;
-	
-	x = uncompressed_data[row*(width*pixel_size + 1) + col*pixel_size + offset];
-	a = col > 0 ? uncompressed_data[row*(width*pixel_size + 1) + col*pixel_size - pixel_size + offset] : 0;
-	b = row > 0 ? uncompressed_data[row*(width*pixel_size + 1) + col*pixel_size - width*pixel_size + offset - 1] : 0;
-	c = col > 0 && row > 0 ? uncompressed_data[row*(width*pixel_size + 1) + col*pixel_size - pixel_size - width*pixel_size + offset - 1] : 0;
-	
-	if ( filter_type == 0 )
-		return x;
-	else if ( filter_type == 1 )
-		return x - a;
-	else if ( filter_type == 2 )
-		return x - b;
-	else if ( filter_type == 3 )
-		return x - floor((a + b)/2);
-	else if ( filter_type == 4 )
-		return x - paeth_predictor(a, b, c);
+/** 
+ * Try all 5 filter methods on the current row and keep the best scoring one in filtered_row, scoring by the
+ * minimum sum of absolute differences (FILTER_ADAPTIVE) or by the estimated entropy (FILTER_ADAPTIVE_ENTROPY)
+ */
+void LTPNG::select_filter(const unsigned char *raw) {
+	unsigned char filter;
+	double score, best = 0;
+	
+	for ( filter = 0; filter < 5; filter++ ) {
+		trial_row[0] = filter;
+		filter_row(trial_row + 1, raw, prior, row_size, pixel_size, filter);
+		
+		if ( filter_type == FILTER_ADAPTIVE )
+			score = score_sad(trial_row + 1, row_size, filter == 0 ? -1 : best);
+		else
+			score = score_entropy(trial_row + 1, row_size);
+		
+		/** Keep the best row so far by swapping it into filtered_row */
+		if ( filter == 0 || score < best ) {
+			unsigned char *swap = filtered_row;
+			filtered_row = trial_row;
+			trial_row = swap;
+			best = score;
+		}
+	}
+}
+
+/** 
+ * Sum the absolute values of the filtered bytes taken as signed differences, giving up as soon as the sum 
+ * reaches the best score so far unless best is negative
+ */
+double LTPNG::score_sad(unsigned char *row, unsigned int len, double best) {
+	unsigned long sum = 0;
+	unsigned int i;
+	
+	for ( i = 0; i < len; i++ ) {
+		sum += row[i] < 128 ? row[i] : 256 - row[i];
 		
-	throw "LTPNG::filter_byte(): Invalid filter type.";
+		/** Check for a lost cause every 256 bytes */
+		if ( (i & 255) == 255 && best >= 0 && sum >= best )
+			return sum;
+	}
+	
+	return sum;
+}
+
+/** Estimate the number of bits needed to code the filtered bytes from their order-0 entropy */
+double LTPNG::score_entropy(unsigned char *row, unsigned int len) {
+	unsigned int counts[256] = {0};
+	double bits = len*log2((double) len);
+	unsigned int i;
+	
+	for ( i = 0; i < len; i++ )
+		counts[row[i]]++;
+	
+	for ( i = 0; i < 256; i++ )
+		if ( counts[i] )
+			bits -= counts[i]*log2((double) counts[i]);
+	
+	return bits;
 }
 
 /** Paeth predictor for PNG filter method 4 defined in the PNG specification */
@@ -324,71 +1131,43 @@ unsigned char LTPNG::paeth_predictor(short a, short b, short c) {
 	return c;
 }
 
-/** Make the table for a fast CRC */
-void LTPNG::make_crc_table() {
-	unsigned int c;
-	unsigned short n, k;
-
-	for (n = 0; n < 256; n++) {
-		c = (unsigned int) n;
-
-		for (k = 0; k < 8; k++) {
-			if (c & 1)
-				c = 0xEDB88320L ^ (c>>1);
-			else
-				c = c >> 1;
-		}
-
-		crc_table[n] = c;
-	}
-	
-	crc_table_exists = 1;
-}
-
-/** Simple helper method for resetting the CRC buffer index */
-void LTPNG::crc_init() {
-	crc_index = 0;
+/** Wall clock time in seconds, for the statistics */
+double LTPNG::stats_clock() {
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-/** Allocate enough space for the CRC buffer */
-void LTPNG::allocate_crc_size(unsigned char bit_depth, unsigned char colour_type) {
-	/** Calculate pixel size */
-	unsigned char pixel_size = colour_type == 2 ? 3 : 4;
+/**
+ * Finish the statistics of an image once it is written, adding up the memory held for it: the scanline, IDAT, and
+ * output buffers, the held image when interlaced, the canvases of an animation, the band cache, and either the
+ * deflate stream or the bands in flight, each with its own deflate stream, dictionary, and compressed output, using
+ * zlib's own estimate of the memory deflate uses
+ */
+void LTPNG::finish_stats() {
+	size_t deflate_state = ((size_t) 1 << (options.window_bits + 2)) + ((size_t) 1 << (options.mem_level + 9));
 	
-	/** Calculate max CRC length */
-	unsigned int len = width*height*pixel_size*(3-16/bit_depth) + height + 4 + 1;
+	stats->total_seconds = stats_clock() - stats_start;
+	stats->deflate_out = file_size;
+	stats->ratio = stats->write_bytes ? (double) stats->filter_in/stats->write_bytes : 0;
+	stats->allocated = source_capacity + image_capacity + (size_t) row_capacity*4 + 2 + idat_capacity + out_size;
+	stats->allocated += canvas_base.capacity() + canvas_pending.capacity() + canvas_next.capacity();
 	
-	/** If CRC buffer already allocated, free so new block can be allocated */
-	if ( crc_allocated )
-		delete[] crc_buf;
-		
-	/** Allocate new blcok */
-	crc_buf = new unsigned char[len];
+	for ( const LTPNGCachedBand &cached : band_cache )
+		stats->allocated += cached.out.capacity();
 	
-	/** Store new block length in global */
-	crc_allocated = len;
+	if ( threads > 1 )
+		stats->allocated += (threads + 1)*((size_t) band_limit*(row_size + 1)*2 + ((size_t) 1 << options.window_bits) + deflate_state);
+	else
+		stats->allocated += deflate_state;
 }
 
-/** Returns the CRC of the bytes buf[0..len-1] */
-unsigned int LTPNG::get_crc() {
-	return update_crc(0xffffffffL, crc_buf, crc_index) ^ 0xffffffffL;
+/** Simple helper method for resetting the running CRC to all 1's at the start of a chunk */
+void LTPNG::crc_init() {
+	crc = 0xffffffffL;
 }
 
-/** 
- * Update a running CRC with the bytes buf[0..len-1]--the CRC should be initialized to 
- * all 1's, and the transmitted value is the 1's complement of the final running CRC 
- */
-unsigned int LTPNG::update_crc(unsigned int crc, unsigned char *buf, unsigned int len) {
-	unsigned int c = crc;
-	unsigned int n;
-
-	if ( !crc_table_exists )
-		make_crc_table();
-		
-	for (n = 0; n < len; n++)
-		c = crc_table[(c ^ buf[n]) & 0xff] ^ (c>>8);
-
-	return c;
+/** Returns the CRC of the chunk bytes written since crc_init() */
+unsigned int LTPNG::get_crc() {
+	return crc ^ 0xffffffffL;
 }
 
 /** 
@@ -598,3 +1377,42 @@ double LTPNG::pattern_half(unsigned int row, unsigned int col, unsigned int widt
 double LTPNG::pattern_none(unsigned int row, unsigned int col, unsigned int width, unsigned int height) {
 	return 0;
 }
+
+/** Verify the compression options are within the ranges zlib accepts */
+void LTPNG::check_options() {
+	if ( options.level < Z_DEFAULT_COMPRESSION || options.level > 9 )
+		throw "LTPNG::check_options(): compression level must be 0-9 or Z_DEFAULT_COMPRESSION";
+	
+	if ( options.strategy < Z_DEFAULT_STRATEGY || options.strategy > Z_FIXED )
+		throw "LTPNG::check_options(): unknown compression strategy";
+	
+	if ( options.mem_level < 1 || options.mem_level > 9 )
+		throw "LTPNG::check_options(): memory level must be 1-9";
+	
+	/** zlib no longer supports a 256-byte window (8) for raw deflate, which the parallel bands use */
+	if ( options.window_bits < 9 || options.window_bits > 15 )
+		throw "LTPNG::check_options(): window bits must be 9-15";
+}
+
+/** 
+ * The 2-byte zlib header per RFC 1950 that deflate() would write for these options, for streams put together 
+ * from raw deflate pieces: the window size, a hint at the compression level, and a check value
+ */
+unsigned short LTPNG::zlib_header(const LTPNGOptions &opts) {
+	unsigned int header = (Z_DEFLATED + ((opts.window_bits - 8) << 4)) << 8;
+	unsigned int level_flags;
+	
+	if ( opts.strategy >= Z_HUFFMAN_ONLY || (opts.level >= 0 && opts.level < 2) )
+		level_flags = 0;
+	else if ( opts.level >= 0 && opts.level < 6 )
+		level_flags = 1;
+	else if ( opts.level == 6 || opts.level == Z_DEFAULT_COMPRESSION )
+		level_flags = 2;
+	else
+		level_flags = 3;
+	
+	header |= level_flags << 6;
+	header += 31 - header % 31;
+	
+	return header;
+}
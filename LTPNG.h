@@ -2,31 +2,372 @@
  * Lowe Technologies PNG Encoder (LTPNG)
  *
  * A PNG encoder built to the ISO/IEC 15948:2003 Portable Network Graphics Standard Rev 10 Nov 03
- * Supports only 8-bit and 16-bit truecolour PNG images with or without alpha and no filtering.
+ * Takes 8-bit and 16-bit truecolour or greyscale pixels with or without alpha, and can write images whose pixels
+ * are all grey as greyscale and images of 256 colours or fewer as indexed-colour, dropping opaque alpha and bit
+ * depth the pixels do not use.
  *
  * @author Rich Lowe
  * @version See CPP for revision and revision history
  */
- 
+
+/** Header includes */
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <list>
+#include <map>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <chrono>
+#include <zlib.h>
+
 using namespace std;
 
+/** zlib parameters for the image data stream, see deflateInit2() in zlib.h */
+struct LTPNGOptions {
+	int level;			/** 0 (stored) to 9 (smallest), or Z_DEFAULT_COMPRESSION */
+	int strategy;		/** Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, or Z_FIXED */
+	int mem_level;		/** 1 to 9, memory used for the match finder */
+	int window_bits;	/** 9 to 15, the log2 of the LZ77 window size */
+	
+	LTPNGOptions(int = Z_DEFAULT_COMPRESSION, int = Z_DEFAULT_STRATEGY, int = 8, int = 15);
+	
+	/** Presets trading size for speed */
+	static LTPNGOptions fastest();
+	static LTPNGOptions balanced();
+	static LTPNGOptions smallest();
+	static LTPNGOptions preset(const char *);
+};
+
+/** Statistics of one encoded image, filled in by the encoder when it is given somewhere to put them */
+struct LTPNGStats {
+	/** Wall time in seconds of each stage, and of the whole image from the start of any analysis pass to end_image() */
+	double analyse_seconds;
+	double pack_seconds;
+	double filter_seconds;
+	double deflate_seconds;
+	double crc_seconds;
+	double write_seconds;
+	double total_seconds;
+	
+	/** Bytes into and out of each stage, packing counting only rows that had to be packed or converted */
+	unsigned long long pack_in;
+	unsigned long long pack_out;
+	unsigned long long filter_in;
+	unsigned long long filter_out;
+	unsigned long long deflate_in;
+	unsigned long long deflate_out;
+	unsigned long long crc_bytes;
+	unsigned long long write_bytes;
+	
+	/** Scanlines written with each filter method, showing what adaptive filtering picked */
+	unsigned int filter_rows[5];
+	
+	/** Bands of an incremental image compressed afresh, and those spliced back in from the band cache */
+	unsigned int bands_encoded;
+	unsigned int bands_reused;
+	
+	/** Bytes of buffers and deflate state the encoder held for the image, and the scanline bytes over the bytes written */
+	size_t allocated;
+	double ratio;
+	
+	LTPNGStats();
+	void reset();
+};
+
+/** Where one frame of an animation was written and what it cost, the bytes in being the scanlines of its region */
+struct LTPNGFrameStats {
+	unsigned int x;
+	unsigned int y;
+	unsigned int width;
+	unsigned int height;
+	unsigned char dispose_op;
+	unsigned char blend_op;
+	unsigned long long bytes_in;
+	unsigned long long bytes_out;
+	double seconds;
+};
+
+/** A band of filtered scanlines compressed on a worker thread as one piece of a raw deflate stream */
+struct LTPNGBand {
+	vector<unsigned char> in;		/** Filtered scanlines, filter type bytes included */
+	vector<unsigned char> dict;		/** The last window or less of the band before, for back references */
+	vector<unsigned char> out;		/** Compressed data, led by the zlib header if this is the first band */
+	unsigned int adler;				/** Adler-32 of in */
+	unsigned int crc;				/** CRC-32 of out */
+	double deflate_seconds;			/** Time the worker spent compressing */
+	double crc_seconds;				/** Time the worker spent on the CRC-32 */
+	LTPNGOptions options;
+	bool first;
+	bool last;
+	future<void> done;
+};
+
+/**
+ * Fixed pool of worker threads compressing bands, started by the first image compressed on more than one thread and
+ * kept for the images after it, so a large image does not start and stop a thread for every band
+ */
+class LTPNGWorkers {
+	public:
+		LTPNGWorkers(unsigned int);
+		~LTPNGWorkers();
+		future<void> run(function<void ()>);
+		unsigned int size();
+		
+	protected:
+		/** Tasks waiting for a worker, oldest first */
+		deque<packaged_task<void ()> > tasks;
+		vector<thread> pool;
+		mutex lock;
+		condition_variable changed;
+		bool stop;
+		
+		void work();
+};
+
+/** A band of an incremental image as it was last compressed, kept to be spliced into the next image unchanged */
+struct LTPNGCachedBand {
+	vector<unsigned char> out;		/** Compressed data, led by the zlib header if this is the first band */
+	unsigned int adler;				/** Adler-32 of the filtered scanlines */
+	unsigned int crc;				/** CRC-32 of out */
+	size_t length;					/** Bytes of filtered scanlines, filter type bytes included */
+};
+
+/** Destination for encoded PNG bytes, which arrive in order in blocks of any size */
+class LTPNGSink {
+	public:
+		virtual ~LTPNGSink() {}
+		virtual void write(const unsigned char *, size_t) = 0;
+};
+
+/** Sink writing to an open file stream */
+class LTPNGFileSink : public LTPNGSink {
+	public:
+		ofstream *file;
+		
+		LTPNGFileSink(ofstream * = NULL);
+		void write(const unsigned char *, size_t);
+};
+
+/** Sink collecting the image in a growable memory buffer */
+class LTPNGMemorySink : public LTPNGSink {
+	public:
+		vector<unsigned char> data;
+		
+		void write(const unsigned char *, size_t);
+};
+
+/** Sink filling a caller-provided buffer of fixed size, throwing if the image does not fit */
+class LTPNGBufferSink : public LTPNGSink {
+	public:
+		unsigned char *buffer;
+		size_t size;
+		size_t length;
+		
+		LTPNGBufferSink(unsigned char *, size_t);
+		void write(const unsigned char *, size_t);
+};
+
+/** Sink handing each block to a user callback, such as a socket or cache writer */
+class LTPNGCallbackSink : public LTPNGSink {
+	public:
+		function<void (const unsigned char *, size_t)> callback;
+		
+		LTPNGCallbackSink(function<void (const unsigned char *, size_t)>);
+		void write(const unsigned char *, size_t);
+};
+
+/** Sink passing each block on to another sink and keeping a copy of the image, dropped if it grows past limit bytes */
+class LTPNGCopySink : public LTPNGSink {
+	public:
+		LTPNGSink *out;
+		vector<unsigned char> data;
+		size_t limit;
+		bool complete;
+		
+		LTPNGCopySink(LTPNGSink *, size_t);
+		void write(const unsigned char *, size_t);
+};
+
+/** Key of an image in the encode cache, a hash of its pixels and a hash of everything deciding how they are encoded */
+struct LTPNGCacheKey {
+	unsigned long long pixels;
+	unsigned long long params;
+	
+	bool operator<(const LTPNGCacheKey &) const;
+};
+
+/** An encoded image held in memory by the encode cache */
+struct LTPNGCacheEntry {
+	LTPNGCacheKey key;
+	vector<unsigned char> png;
+};
+
+/**
+ * Content-addressed cache of encoded images in front of create_image(), so pixels encoded before the same way are
+ * written out again without being filtered or compressed.  Images are held in memory up to a byte budget, the least
+ * recently used going first, and also kept as files in a directory if one is given, where they outlive the process
+ * and are read back into memory when asked for.  One cache may be shared by encoders on any number of threads
+ */
+class LTPNGCache {
+	public:
+		/** Bytes of encoded images held in memory, and the directory of the on-disk tier, empty for memory only */
+		size_t budget;
+		string directory;
+		
+		/** Lookups found in memory, found on disk, and not found, and the images and bytes evicted from memory */
+		unsigned long long hits;
+		unsigned long long disk_hits;
+		unsigned long long misses;
+		unsigned long long evictions;
+		unsigned long long evicted_bytes;
+		
+		LTPNGCache(size_t = 64 << 20, const char * = NULL);
+		bool fetch(const LTPNGCacheKey &, vector<unsigned char> &);
+		void store(const LTPNGCacheKey &, const vector<unsigned char> &);
+		void clear();
+		size_t bytes();
+		size_t entries();
+		static unsigned long long digest(const unsigned char *, size_t, unsigned long long = 0);
+		
+	protected:
+		/** Images most recently used first, indexed by key */
+		list<LTPNGCacheEntry> recent;
+		map<LTPNGCacheKey, list<LTPNGCacheEntry>::iterator> index;
+		size_t held;
+		mutex lock;
+		
+		void hold(const LTPNGCacheKey &, const vector<unsigned char> &);
+		string disk_path(const LTPNGCacheKey &);
+};
+
+/**
+ * Row packing kernels, specialised on the source layout, bit depth, and channels: count pixels from channels of
+ * samples starting at a pixel, or from interleaved pixels, into a scanline in PNG byte order
+ */
+typedef void (*LTPNGPlanesKernel)(unsigned char *, const void *, const void *, const void *, const void *, size_t, unsigned int);
+typedef void (*LTPNGPixelsKernel)(unsigned char *, const unsigned char *, unsigned int);
+
+/** Generator filling one row of width samples per channel, given the row number, for create_image_from_generator() */
+typedef function<void (unsigned int, unsigned short *, unsigned short *, unsigned short *, unsigned short *)> LTPNGGenerator;
+
+/**
+ * Bands of generated rows waiting to be encoded, a ring of slots that generator threads fill in any order and the
+ * encoding thread empties in row order, so no more than the ring is ever held however large the image
+ */
+struct LTPNGGenerateQueue {
+	mutex lock;
+	condition_variable changed;
+	vector<unsigned short> samples;
+	vector<unsigned char> ready;
+	unsigned int next;
+	unsigned int written;
+	bool stop;
+	const char *error;
+};
+
 class LTPNG {
 	public:
 		/** Public properties */
-		unsigned int file_size;
+		unsigned long long file_size;
 		unsigned int max_val;
 		unsigned char bit_depth;
 		unsigned char colour_type;
 		unsigned char filter_type;
 		unsigned int width;
 		unsigned int height;
+		unsigned int idat_size;
+		unsigned int threads;
+		unsigned int band_rows;
+		size_t map_size;
+		unsigned int generators;
+		unsigned char interlace;
+		LTPNGOptions options;
+		unsigned char reduce;
+		LTPNGStats *stats;
+		LTPNGCache *cache;
+		vector<LTPNGFrameStats> frame_stats;
 		ofstream *image;
 		
-		/** Constructor declaration */
+		/** Format create_image() or begin_image() actually wrote, which reduce may have made smaller than the pixels given */
+		unsigned char output_bit_depth;
+		unsigned char output_colour_type;
+		unsigned int palette_size;
+		
+		/** Filter types beyond the 5 standard methods which pick the best method for each row */
+		static const unsigned char FILTER_ADAPTIVE = 5;
+		static const unsigned char FILTER_ADAPTIVE_ENTROPY = 6;
+		
+		/** Packed pixel formats accepted by create_image() and write_rows(), 16-bit samples are big endian */
+		static const unsigned char PIXELS_RGB8 = 0;
+		static const unsigned char PIXELS_RGBA8 = 1;
+		static const unsigned char PIXELS_RGB16BE = 2;
+		static const unsigned char PIXELS_RGBA16BE = 3;
+		static const unsigned char PIXELS_GREY8 = 4;
+		static const unsigned char PIXELS_GREYA8 = 5;
+		static const unsigned char PIXELS_GREY16BE = 6;
+		static const unsigned char PIXELS_GREYA16BE = 7;
+		
+		/** How an animation frame's region is left for the next frame and drawn over the canvas, per the APNG fcTL chunk */
+		static const unsigned char DISPOSE_NONE = 0;
+		static const unsigned char DISPOSE_BACKGROUND = 1;
+		static const unsigned char DISPOSE_PREVIOUS = 2;
+		static const unsigned char BLEND_SOURCE = 0;
+		static const unsigned char BLEND_OVER = 1;
+		
+		/** Lossless reductions create_image() may make to the format it writes, combined in reduce */
+		static const unsigned char REDUCE_PALETTE = 1;		/** Indexed-colour when there are 256 colours or fewer */
+		static const unsigned char REDUCE_GREY = 2;			/** Greyscale when every pixel has equal red, green, and blue */
+		static const unsigned char REDUCE_ALPHA = 4;		/** No alpha channel when every pixel is fully opaque */
+		static const unsigned char REDUCE_DEPTH = 8;		/** 8-bit samples when 16-bit ones repeat their high byte, and 1, 2, or 4-bit greyscale */
+		static const unsigned char REDUCE_ALL = 15;
+		
+		/** Constructor and destructor declarations, an encoder owns its buffers so it cannot be copied */
 		LTPNG(unsigned char, unsigned char, unsigned char);
+		~LTPNG();
+		LTPNG(const LTPNG &) = delete;
+		LTPNG &operator=(const LTPNG &) = delete;
 		
 		/** Main function declaration */
 		void create_image(ofstream &, unsigned int, unsigned int, unsigned short *, unsigned short *, unsigned short *, unsigned short *);
+		void create_image(ofstream &, unsigned int, unsigned int, const unsigned char *, const unsigned char *, const unsigned char *, const unsigned char *);
+		void create_image(ofstream &, unsigned int, unsigned int, const unsigned char *, unsigned char, size_t = 0);
+		void create_image(LTPNGSink &, unsigned int, unsigned int, unsigned short *, unsigned short *, unsigned short *, unsigned short *);
+		void create_image(LTPNGSink &, unsigned int, unsigned int, const unsigned char *, const unsigned char *, const unsigned char *, const unsigned char *);
+		void create_image(LTPNGSink &, unsigned int, unsigned int, const unsigned char *, unsigned char, size_t = 0);
+		
+		/** Out-of-core function declarations, for raw interleaved pixels in a file rather than in memory */
+		void create_image_from_file(ofstream &, unsigned int, unsigned int, const char *, unsigned char, unsigned long long = 0, size_t = 0);
+		void create_image_from_file(LTPNGSink &, unsigned int, unsigned int, const char *, unsigned char, unsigned long long = 0, size_t = 0);
+		void write_file_rows(unsigned int, int, unsigned char, unsigned long long = 0, size_t = 0);
+		
+		/** Generated image function declarations, for pixels made a row at a time on a pool of threads as they are encoded */
+		void create_image_from_generator(ofstream &, unsigned int, unsigned int, LTPNGGenerator);
+		void create_image_from_generator(LTPNGSink &, unsigned int, unsigned int, LTPNGGenerator);
+		void write_generated_rows(unsigned int, LTPNGGenerator);
+		
+		/** Animated PNG function declarations, whole frames given in one of the PIXELS_* formats */
+		void begin_animation(ofstream &, unsigned int, unsigned int, unsigned int, unsigned int = 0);
+		void begin_animation(LTPNGSink &, unsigned int, unsigned int, unsigned int, unsigned int = 0);
+		void write_frame(const unsigned char *, unsigned char, size_t = 0, unsigned short = 1, unsigned short = 10);
+		void end_animation();
+		
+		/** Incremental function declarations, re-encoding only the bands of rows a dirty rectangle touches */
+		void update_image(ofstream &, unsigned int, unsigned int, const unsigned char *, unsigned char, unsigned int, unsigned int, unsigned int, unsigned int, size_t = 0);
+		void update_image(LTPNGSink &, unsigned int, unsigned int, const unsigned char *, unsigned char, unsigned int, unsigned int, unsigned int, unsigned int, size_t = 0);
+		void clear_band_cache();
+		
+		/** Row-streaming function declarations */
+		void begin_image(ofstream &, unsigned int, unsigned int, unsigned char, unsigned char);
+		void begin_image(LTPNGSink &, unsigned int, unsigned int, unsigned char, unsigned char);
+		void write_rows(unsigned int, unsigned short *, unsigned short *, unsigned short *, unsigned short *);
+		void write_rows(unsigned int, const unsigned char *, const unsigned char *, const unsigned char *, const unsigned char *);
+		void write_rows(unsigned int, const unsigned char *, unsigned char, size_t = 0);
+		void end_image();
+		void abort_image();
 		
 		/** Channel map/ramp function declarations */
 		static double ramp_n(unsigned int, unsigned int, unsigned int, unsigned int);
@@ -40,47 +381,434 @@ class LTPNG {
 		static double pattern_full(unsigned int, unsigned int, unsigned int, unsigned int);
 		static double pattern_half(unsigned int, unsigned int, unsigned int, unsigned int);
 		static double pattern_none(unsigned int, unsigned int, unsigned int, unsigned int);
+		
+		/** CRC-32 engine declarations */
+		static unsigned int update_crc(unsigned int, const unsigned char *, size_t);
+		static unsigned int update_crc_reference(unsigned int, const unsigned char *, size_t);
+		static unsigned int update_crc_slice(unsigned int, const unsigned char *, size_t);
+		static unsigned int update_crc_clmul(unsigned int, const unsigned char *, size_t);
+		static unsigned int crc_combine(unsigned int, unsigned int, size_t);
+		static bool crc_clmul_supported();
+		static const char *crc_engine();
+		
+		/** Scanline filter kernel declarations */
+		static void filter_row(unsigned char *, const unsigned char *, const unsigned char *, unsigned int, unsigned char, unsigned char);
+		static void filter_row_reference(unsigned char *, const unsigned char *, const unsigned char *, unsigned int, unsigned char, unsigned char);
+		static void filter_row_sse2(unsigned char *, const unsigned char *, const unsigned char *, unsigned int, unsigned char, unsigned char);
+		static void filter_row_avx2(unsigned char *, const unsigned char *, const unsigned char *, unsigned int, unsigned char, unsigned char);
+		static void unfilter_row(unsigned char *, const unsigned char *, const unsigned char *, unsigned int, unsigned char, unsigned char);
+		static unsigned char paeth_predictor(short, short, short);
+		
+		/** Starting column and row, and column and row spacing, of each Adam7 pass per figure 8.3 */
+		static const unsigned char adam7[7][4];
+		static bool filter_avx2_supported();
+		static const char *filter_engine();
 
 	protected:
-		/** Image data pointers */
-		unsigned char *uncompressed_data;
-		unsigned char *filtered_data;
-		unsigned char *compressed_data;
+		/** 
+		 * Scanline buffers, only the current and prior rows are ever held in memory, and prior points either 
+		 * at prior_row or straight at the caller's previous row when it was already in PNG byte order
+		 */
+		unsigned char *prior_row;
+		unsigned char *current_row;
+		const unsigned char *prior;
+		unsigned char *filtered_row;
+		unsigned char *trial_row;
+		unsigned int row_size;
+		unsigned char pixel_size;
+		
+		/** Rows in the caller's format are packed into the source row when they are converted to another format */
+		unsigned char *source_row;
+		unsigned int source_size;
+		unsigned char convert;
 		
-		/** Buffer and index counter for holding CRC data */
-		unsigned char *crc_buf;
-		unsigned int crc_index;
-		unsigned int crc_allocated;
+		/** An interlaced image is held whole in the output format until end_image() pulls each pass out of it */
+		unsigned char *image_rows;
+		size_t image_capacity;
 		
-		/** Table of CRCs of all 8-bit messages. */
-		unsigned int crc_table[256];
-		unsigned char crc_table_exists;
+		/** Sizes the buffers kept between images were allocated for */
+		unsigned int source_capacity;
+		unsigned int row_capacity;
+		unsigned int idat_capacity;
+		
+		/** Analysis state, and the palette as RGBA colours found through an open addressing hash of their slots */
+		unsigned char analysing;
+		unsigned char analysed;
+		unsigned char palette_possible;
+		unsigned char grey_possible;
+		unsigned char alpha_possible;
+		unsigned char depth_possible;
+		unsigned char grey_depth;
+		unsigned int colour_count;
+		unsigned int palette[256];
+		short colour_slots[1024];
+		
+		/** Streaming state for the image in progress */
+		z_stream strm;
+		unsigned char *idat_buf;
+		unsigned int rows_written;
+		unsigned char in_progress;
+		unsigned char stream_ready;
+		LTPNGOptions stream_options;
+		
+		/** Start of the image for its statistics */
+		double stats_start;
+		
+		/** 
+		 * Animation state, with the canvas a viewer holds before the pending frame is drawn, the pending frame, and the
+		 * frame after it, each whole and in PNG byte order.  A frame is only written once the next one is known, as how
+		 * it is disposed of depends on what follows it
+		 */
+		vector<unsigned char> canvas_base;
+		vector<unsigned char> canvas_pending;
+		vector<unsigned char> canvas_next;
+		unsigned int canvas_width;
+		unsigned int canvas_height;
+		unsigned int canvas_row_size;
+		unsigned int frame_count;
+		unsigned int frames_written;
+		unsigned int sequence;
+		unsigned short delay_num;
+		unsigned short delay_den;
+		double frame_seconds;
+		unsigned char animating;
+		unsigned char frame_pending;
+		unsigned char frame_chunks;
+		
+		/** 
+		 * Compressed bands of the last incremental image, each an independent raw deflate stream ending byte aligned,
+		 * and what they were encoded with, any change to which means every band has to be encoded again
+		 */
+		vector<LTPNGCachedBand> band_cache;
+		unsigned int cache_width;
+		unsigned int cache_height;
+		unsigned int cache_rows;
+		unsigned char cache_depth;
+		unsigned char cache_type;
+		unsigned char cache_filter;
+		LTPNGOptions cache_options;
+		
+		/** Parallel deflate state, the band being filled and the bands in flight oldest first */
+		LTPNGBand *band;
+		deque<LTPNGBand *> bands;
+		LTPNGWorkers *workers;
+		unsigned int band_limit;
+		unsigned int stream_adler;
+		
+		/** Where the image in progress is written, file_sink wraps the file stream for the ofstream overloads */
+		LTPNGSink *sink;
+		LTPNGFileSink file_sink;
+		
+		/** Output buffer chunks are built in before being written out, and the running CRC of the chunk being built */
+		unsigned char *out_buf;
+		unsigned int out_len;
+		unsigned int out_size;
+		unsigned int crc;
 		
 		/** PNG formatting helpers */
 		void write_png_signature();
 		void write_header_chunk(unsigned char, unsigned char, unsigned char);
 		void write_data_chunk(unsigned char *, unsigned int);
+		void write_data_chunk(unsigned char *, unsigned int, unsigned int);
+		void write_data_chunk_start(unsigned int);
+		void write_palette_chunk();
+		void write_transparency_chunk();
 		void write_end_chunk();
 		
+		/** Row-streaming helper declarations */
+		void use_file(ofstream &);
+		void setup_source(unsigned int, unsigned int, unsigned char, unsigned char);
+		void setup_buffers();
+		void begin_stream();
+		void end_stream();
+		static unsigned char channel_count(unsigned char);
+		static unsigned char format_channels(unsigned char);
+		void encode_row(const unsigned char *);
+		void compress_row(const unsigned char *, bool);
+		void pack_row(const unsigned char *, unsigned char, unsigned char * = NULL);
+		LTPNGPixelsKernel pixels_packer(unsigned char);
+		LTPNGPlanesKernel planes_packer(unsigned char);
+		unsigned char *pack_target();
+		void keep_prior_row();
+		void deflate_data(unsigned char *, unsigned int, int);
+		void flush_data_chunk();
+		
+		/** Format reduction declarations */
+		void begin_analysis(unsigned int, unsigned int, unsigned char, unsigned char);
+		void analyse_row(const unsigned char *);
+		void end_analysis();
+		void convert_row(const unsigned char *, unsigned char *);
+		unsigned int pixel_key(const unsigned char *);
+		unsigned int colour_slot(unsigned int);
+		void index_palette();
+		
+		/** Interlacing declarations */
+		void encode_passes();
+		void interlace_row(unsigned char *, const unsigned char *, unsigned int, unsigned int, unsigned int);
+		
+		/** Animation declarations */
+		void write_animation_control_chunk(unsigned int);
+		void write_frame_control_chunk(const unsigned int *, unsigned short, unsigned short, unsigned char, unsigned char);
+		unsigned long long frame_bounds(const unsigned char *, const unsigned char *, const unsigned int *, unsigned int *);
+		unsigned char frame_blend(const unsigned int *);
+		unsigned char frame_dispose(const unsigned int *);
+		void write_pending_frame(bool);
+		
+		/** Encode cache declarations */
+		LTPNGCacheKey planes_key(unsigned int, unsigned int, const void *, const void *, const void *, const void *, unsigned char);
+		LTPNGCacheKey pixels_key(unsigned int, unsigned int, const unsigned char *, unsigned char, size_t);
+		LTPNGCacheKey cache_key(unsigned int, unsigned int, unsigned char, unsigned long long);
+		bool cached_image(LTPNGSink &, const LTPNGCacheKey &, unsigned int, unsigned int);
+		void encode_cached(LTPNGSink &, unsigned int, unsigned int, function<LTPNGCacheKey ()>, function<void ()>);
+		
+		/** Incremental image declarations */
+		bool band_cache_matches(unsigned int);
+		LTPNGBand *filter_band(const unsigned char *, unsigned char, size_t, unsigned int, unsigned int);
+		void cache_band(LTPNGBand *, unsigned int);
+		
+		/** Generated image declarations */
+		static void generate_bands(LTPNGGenerateQueue &, LTPNGGenerator, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int);
+		
+		/** Parallel deflate declarations */
+		void dispatch_band(bool);
+		void start_band(LTPNGBand *);
+		void write_band(LTPNGBand *);
+		static void compress_band(LTPNGBand *);
+		
 		/** Filter function declarations */
-		unsigned char filter_byte(unsigned int, unsigned int, unsigned char);
-		unsigned char paeth_predictor(short, short, short);
+		void select_filter(const unsigned char *);
+		double score_sad(unsigned char *, unsigned int, double);
+		double score_entropy(unsigned char *, unsigned int);
+		
+		/** Statistics function declarations */
+		static double stats_clock();
+		void finish_stats();
 		
 		/** CRC function declarations */
-		void make_crc_table();
 		void crc_init();
-		void allocate_crc_size(unsigned char, unsigned char);
 		unsigned int get_crc();
-		unsigned int update_crc(unsigned int, unsigned char *, unsigned int);
 		
 		/** File I/O helper declarations */
 		void fwrite_8(unsigned char);
 		void fwrite_16(unsigned short);
 		void fwrite_32(unsigned int);
+		void fwrite_data(unsigned char *, unsigned int);
+		void fwrite_raw(unsigned char *, unsigned int);
+		void flush_output();
 		unsigned char get_byte_from_two_bytes(unsigned int, unsigned char);
 		unsigned char get_byte_from_four_bytes(unsigned int, unsigned char);
 
 		/** zLib function declarations */
 		void def(unsigned char *, unsigned int, unsigned char *, unsigned int, unsigned int &, int);
 		void inf(unsigned char *, unsigned int, unsigned char *, unsigned int, unsigned int &);
+		void check_options();
+		static unsigned short zlib_header(const LTPNGOptions &);
+};
+
+/** One instruction of a compiled pattern, computed from the results of instructions before it */
+struct LTPNGPatternOp {
+	unsigned char code;
+	unsigned char varies;		/** 1 if it varies along a row, 2 if it varies down the image, 3 if both */
+	unsigned int a;				/** Operands, or the edges a diagonal ramp runs from */
+	unsigned int b;
+	double value;				/** Value of a number */
+	size_t slot;				/** Start of its row of results when it varies along a row */
+};
+
+/**
+ * Channel pattern compiled from an expression, evaluated a whole row at a time.  Parts of the expression that do
+ * not change along a row are worked out once per row, and parts that do not change down the image once per image
+ */
+class LTPNGPattern {
+	public:
+		/** Instruction codes */
+		static const unsigned char OP_NUMBER = 0;
+		static const unsigned char OP_X = 1;
+		static const unsigned char OP_Y = 2;
+		static const unsigned char OP_DIAGONAL = 3;
+		static const unsigned char OP_ADD = 4;
+		static const unsigned char OP_SUBTRACT = 5;
+		static const unsigned char OP_MULTIPLY = 6;
+		static const unsigned char OP_DIVIDE = 7;
+		static const unsigned char OP_NEGATE = 8;
+		static const unsigned char OP_SIN = 9;
+		static const unsigned char OP_COS = 10;
+		static const unsigned char OP_ABS = 11;
+		static const unsigned char OP_SQRT = 12;
+		
+		LTPNGPattern(const string & = "none");
+		void compile(const string &);
+		void begin(unsigned int, unsigned int);
+		void fill_row(unsigned short *, unsigned int, unsigned int);
+		static bool valid(const string &);
+		
+	protected:
+		vector<LTPNGPatternOp> program;
+		vector<double> scalars;
+		vector<double> rows;
+		unsigned int width;
+		unsigned int height;
+		
+		/** Parser state while compiling */
+		string source;
+		size_t position;
+		
+		/** Compiler declarations, a recursive descent parser emitting each instruction once its operands are known */
+		unsigned int parse_sum();
+		unsigned int parse_product();
+		unsigned int parse_unary();
+		unsigned int parse_primary();
+		unsigned int emit(unsigned char, unsigned int = 0, unsigned int = 0, double = 0);
+		bool accept(char);
+		
+		/** Evaluation declarations */
+		void evaluate(unsigned int, unsigned int);
+		double evaluate_scalar(const LTPNGPatternOp &, unsigned int);
+};
+
+/** One worker's queue of batch jobs, taken from the back by its owner and stolen from the front by the others */
+struct LTPNGBatchQueue {
+	mutex lock;
+	deque<size_t> jobs;
+};
+
+/**
+ * Work-stealing pool encoding a batch of images, each worker keeping one encoder for every job it runs so its
+ * buffers and deflate stream are reused from image to image
+ */
+class LTPNGBatch {
+	public:
+		/** Number of workers, 0 for one per hardware thread */
+		unsigned int workers;
+		
+		/** Totals of the last run(), scanline bytes encoded and compressed image data written by the images that succeeded */
+		unsigned int images;
+		unsigned int failed;
+		unsigned long long bytes_in;
+		unsigned long long bytes_out;
+		double seconds;
+		
+		/** Index and error of each job that threw, in no particular order */
+		vector<pair<size_t, const char *> > errors;
+		
+		LTPNGBatch(unsigned int = 0);
+		void add(function<void (LTPNG &)>);
+		void run();
+		
+	protected:
+		vector<function<void (LTPNG &)> > jobs;
+		mutex totals_lock;
+		
+		void work(vector<LTPNGBatchQueue> &, unsigned int);
+		static bool take(vector<LTPNGBatchQueue> &, unsigned int, size_t &);
+};
+
+/** Source of PNG bytes for the decoder, returning how many bytes were read, which is 0 only at the end of the data */
+class LTPNGSource {
+	public:
+		virtual ~LTPNGSource() {}
+		virtual size_t read(unsigned char *, size_t) = 0;
+};
+
+/** Source reading from an open input stream */
+class LTPNGFileSource : public LTPNGSource {
+	public:
+		istream *file;
+		
+		LTPNGFileSource(istream * = NULL);
+		size_t read(unsigned char *, size_t);
+};
+
+/** Source reading from a PNG held in memory */
+class LTPNGMemorySource : public LTPNGSource {
+	public:
+		const unsigned char *data;
+		size_t size;
+		size_t position;
+		
+		LTPNGMemorySource(const unsigned char *, size_t);
+		size_t read(unsigned char *, size_t);
+};
+
+/**
+ * Streaming PNG decoder, reading rows back out in PNG byte order (big endian 16-bit samples) with only the current
+ * and prior scanlines and one read buffer held in memory
+ */
+class LTPNGDecoder {
+	public:
+		/** Image header properties, set by begin_read() */
+		unsigned int width;
+		unsigned int height;
+		unsigned char bit_depth;
+		unsigned char colour_type;
+		unsigned char interlace;
+		unsigned int row_size;
+		
+		/** Contents of the PLTE and tRNS chunks, empty if the image has none */
+		vector<unsigned char> palette;
+		vector<unsigned char> transparency;
+		
+		/** Size of each read from the source */
+		unsigned int read_size;
+		
+		/** Constructor and destructor declarations, a decoder owns its buffers so it cannot be copied */
+		LTPNGDecoder();
+		~LTPNGDecoder();
+		LTPNGDecoder(const LTPNGDecoder &) = delete;
+		LTPNGDecoder &operator=(const LTPNGDecoder &) = delete;
+		
+		/** Whole image function declaration */
+		vector<unsigned char> read_image(LTPNGSource &);
+		
+		/** Row-streaming function declarations */
+		void begin_read(LTPNGSource &);
+		void read_rows(unsigned int, unsigned char *, size_t = 0);
+		void end_read();
+		void abort_read();
+		
+	protected:
+		/** Scanline buffers, the filtered row includes its filter type byte */
+		unsigned char *prior_row;
+		unsigned char *filtered_row;
+		unsigned char *pass_row;
+		unsigned int row_capacity;
+		unsigned char pixel_size;
+		unsigned char pixel_bits;
+		
+		/** An interlaced image is read whole, its passes put back together here before its rows are handed out */
+		unsigned char *image_rows;
+		size_t image_capacity;
+		
+		/** Streaming state for the image being read */
+		LTPNGSource *source;
+		z_stream strm;
+		unsigned char *in_buf;
+		unsigned int in_capacity;
+		unsigned int rows_read;
+		unsigned char in_progress;
+		unsigned char stream_ready;
+		unsigned char stream_end;
+		
+		/** The chunk being read, its data bytes still to come, and its running CRC */
+		unsigned char chunk_type[4];
+		unsigned int chunk_left;
+		unsigned int crc;
+		
+		/** PNG parsing helpers */
+		void read_png_signature();
+		void read_header_chunk();
+		void read_chunk_start();
+		void read_chunk_data(unsigned char *, unsigned int);
+		void read_chunk_end();
+		void skip_chunk();
+		bool chunk_is(const char *);
+		
+		/** Image data helpers */
+		void read_passes();
+		void fill_input();
+		unsigned int inflate_data(unsigned char *, unsigned int);
+		
+		/** Source I/O helpers */
+		void read_bytes(unsigned char *, size_t);
+		unsigned int read_32();
 };
@@ -0,0 +1,390 @@
+/**
+ * Lowe Technologies PNG Encoder (LTPNG)
+ *
+ * Animated PNG.  Frames are given whole, and each is written as only the region that changed from the canvas a
+ * viewer holds when it is drawn, found by comparing the two.  Regions with pixels that stay the same are blended
+ * over the canvas with those pixels fully transparent where the image has alpha, and once the frame after is known,
+ * each frame is disposed of whichever way leaves the smallest region for the next.  Every frame goes through the
+ * same filters and the same deflate stream, which is reset rather than set up again for each frame.
+ *
+ * @author Rich Lowe
+ * @version See LTPNG.cpp for revision and revision history
+ */
+
+/** Header includes */
+#include <cstring>
+#include "LTPNG.h"
+
+using namespace std;
+
+/** Begin an animation of frames frames, played plays times (0 for forever), written to a file stream */
+void LTPNG::begin_animation(ofstream &file, unsigned int pixel_width, unsigned int pixel_height, unsigned int frames, unsigned int plays) {
+	use_file(file);
+	begin_animation(file_sink, pixel_width, pixel_height, frames, plays);
+	image = &file;
+}
+
+/**
+ * Begin an animation of frames frames, played plays times (0 for forever), written to a sink.  The first frame is
+ * also the image shown by decoders that do not support animation
+ */
+void LTPNG::begin_animation(LTPNGSink &out, unsigned int pixel_width, unsigned int pixel_height, unsigned int frames, unsigned int plays) {
+	if ( in_progress )
+		throw "LTPNG::begin_animation(): previous image was not finished with end_image()";
+
+	if ( frames == 0 )
+		throw "LTPNG::begin_animation(): an animation needs at least one frame";
+
+	/** Every frame shares the header's format, which one frame alone cannot pick */
+	if ( reduce )
+		throw "LTPNG::begin_animation(): animations cannot be reduced";
+
+	check_options();
+	setup_source(pixel_width, pixel_height, bit_depth, colour_type);
+
+	image = NULL;
+	sink = &out;
+	output_bit_depth = bit_depth;
+	output_colour_type = colour_type;
+	palette_size = 0;
+	analysed = 0;
+
+	if ( stats ) {
+		stats->reset();
+		stats_start = stats_clock();
+	}
+
+	/** Buffers are set up for the whole canvas, so every frame region fits them */
+	setup_buffers();
+	out_len = 0;
+
+	/** The canvas starts fully transparent black per the APNG specification */
+	canvas_width = pixel_width;
+	canvas_height = pixel_height;
+	canvas_row_size = row_size;
+	canvas_base.assign((size_t) canvas_height*canvas_row_size, 0);
+	canvas_pending.resize(canvas_base.size());
+	canvas_next.resize(canvas_base.size());
+
+	frame_count = frames;
+	frames_written = 0;
+	sequence = 0;
+	frame_pending = 0;
+	frame_chunks = 0;
+	frame_stats.clear();
+
+	file_size = 0;
+	in_progress = 1;
+	animating = 1;
+
+	/** Write the PNG file signature per section 5.2, the IHDR header chunk per 11.2.2, and the animation control chunk */
+	write_png_signature();
+	write_header_chunk(bit_depth, colour_type, interlace);
+	write_animation_control_chunk(plays);
+}
+
+/**
+ * Give the next frame as interleaved pixels in one of the PIXELS_* formats with rows stride bytes apart (0 for
+ * tightly packed rows), shown for delay_num/delay_den seconds.  The frame before it is written now that it is known
+ * what follows it
+ */
+void LTPNG::write_frame(const unsigned char *pixels, unsigned char format, size_t stride, unsigned short delay_numerator, unsigned short delay_denominator) {
+	if ( !animating )
+		throw "LTPNG::write_frame(): begin_animation() must be called first";
+
+	if ( frames_written + frame_pending >= frame_count )
+		throw "LTPNG::write_frame(): more frames written than begin_animation() was given";
+
+	if ( format > PIXELS_GREYA16BE )
+		throw "LTPNG::write_frame(): invalid pixel format";
+
+	unsigned char channels = format_channels(format);
+	unsigned char depth = format == PIXELS_RGB8 || format == PIXELS_RGBA8 || format == PIXELS_GREY8 || format == PIXELS_GREYA8 ? 8 : 16;
+	double start = stats_clock();
+	unsigned int row;
+
+	if ( channels >= 3 && !(colour_type & 2) )
+		throw "LTPNG::write_frame(): truecolour pixels cannot be written to a greyscale image";
+
+	if ( stride == 0 )
+		stride = (size_t) canvas_width*channels*depth/8;
+
+	/** Pack the frame into PNG byte order across the whole canvas */
+	width = canvas_width;
+	height = canvas_height;
+
+	for ( row = 0; row < canvas_height; row++, pixels += stride ) {
+		unsigned char *packed = canvas_next.data() + (size_t) row*canvas_row_size;
+
+		if ( depth == bit_depth && channels == channel_count(colour_type) )
+			memcpy(packed, pixels, canvas_row_size);
+		else
+			pack_row(pixels, format, packed);
+	}
+
+	double pack_seconds = stats_clock() - start;
+
+	if ( frame_pending )
+		write_pending_frame(false);
+
+	canvas_pending.swap(canvas_next);
+	frame_pending = 1;
+	delay_num = delay_numerator;
+	delay_den = delay_denominator;
+	frame_seconds = pack_seconds;
+}
+
+/** Finish the animation, writing the last frame and the end chunk */
+void LTPNG::end_animation() {
+	if ( !animating )
+		throw "LTPNG::end_animation(): begin_animation() must be called first";
+
+	if ( frames_written + frame_pending != frame_count )
+		throw "LTPNG::end_animation(): fewer frames written than begin_animation() was given";
+
+	write_pending_frame(true);
+
+	width = canvas_width;
+	height = canvas_height;
+	row_size = canvas_row_size;
+
+	/** Write the IEND end chunk per 11.2.5, and whatever is still sitting in the output buffer */
+	write_end_chunk();
+	flush_output();
+
+	if ( stats )
+		finish_stats();
+
+	/** The canvases are only needed while the animation is written */
+	vector<unsigned char>().swap(canvas_base);
+	vector<unsigned char>().swap(canvas_pending);
+	vector<unsigned char>().swap(canvas_next);
+
+	animating = 0;
+	in_progress = 0;
+}
+
+/**
+ * Write the pending frame as the region that changed from the canvas, blended and disposed of whichever way keeps
+ * the regions smallest, and leave the canvas as a viewer would have it for the next frame
+ */
+void LTPNG::write_pending_frame(bool last) {
+	double start = stats_clock();
+	unsigned long long written = file_size;
+	unsigned int region[4] = { 0, 0, canvas_width, canvas_height };
+	unsigned char blend = BLEND_SOURCE, dispose = DISPOSE_NONE;
+	unsigned int row, col;
+
+	/** The first frame is the default image, so it must cover the whole canvas */
+	if ( frames_written > 0 ) {
+		/** A region cannot be empty, so a frame that changes nothing draws one pixel as it already is */
+		if ( frame_bounds(canvas_pending.data(), canvas_base.data(), NULL, region) == 0 ) {
+			region[2] = 1;
+			region[3] = 1;
+		}
+
+		blend = frame_blend(region);
+	}
+
+	if ( !last )
+		dispose = frame_dispose(region);
+
+	write_frame_control_chunk(region, delay_num, delay_den, dispose, blend);
+
+	/** Encode the region as an image of its own, in fdAT chunks after the first frame */
+	width = region[2];
+	height = region[3];
+	setup_buffers();
+	begin_stream();
+	frame_chunks = frames_written > 0;
+
+	size_t offset = (size_t) region[0]*pixel_size;
+
+	for ( row = 0; row < region[3]; row++ ) {
+		const unsigned char *source = canvas_pending.data() + (size_t) (region[1] + row)*canvas_row_size + offset;
+
+		if ( blend == BLEND_SOURCE ) {
+			encode_row(source);
+			continue;
+		}
+
+		/** Blended over the canvas, pixels that have not changed are left fully transparent */
+		const unsigned char *was = canvas_base.data() + (size_t) (region[1] + row)*canvas_row_size + offset;
+
+		for ( col = 0; col < region[2]; col++ ) {
+			if ( memcmp(source + col*pixel_size, was + col*pixel_size, pixel_size) == 0 )
+				memset(current_row + col*pixel_size, 0, pixel_size);
+			else
+				memcpy(current_row + col*pixel_size, source + col*pixel_size, pixel_size);
+		}
+
+		encode_row(current_row);
+	}
+
+	end_stream();
+	frame_chunks = 0;
+
+	/** The canvas becomes the frame, with the region cleared when disposed of to the background, or stays as it was */
+	if ( dispose != DISPOSE_PREVIOUS )
+		canvas_base.swap(canvas_pending);
+
+	if ( dispose == DISPOSE_BACKGROUND )
+		for ( row = 0; row < region[3]; row++ )
+			memset(canvas_base.data() + (size_t) (region[1] + row)*canvas_row_size + offset, 0, (size_t) region[2]*pixel_size);
+
+	LTPNGFrameStats frame;
+
+	frame.x = region[0];
+	frame.y = region[1];
+	frame.width = region[2];
+	frame.height = region[3];
+	frame.dispose_op = dispose;
+	frame.blend_op = blend;
+	frame.bytes_in = (unsigned long long) region[3]*row_size;
+	frame.bytes_out = file_size - written;
+	frame.seconds = frame_seconds + stats_clock() - start;
+	frame_stats.push_back(frame);
+
+	frames_written++;
+}
+
+/**
+ * Find the bounds of the pixels that differ between a frame and a canvas, as x, y, width, and height, with the
+ * canvas taken as fully transparent black within cleared if it is given.  Returns the area, 0 if nothing differs
+ */
+unsigned long long LTPNG::frame_bounds(const unsigned char *frame, const unsigned char *canvas, const unsigned int *cleared, unsigned int *bounds) {
+	static const unsigned char clear[8] = { 0 };
+	unsigned int bytes = canvas_row_size/canvas_width;
+	unsigned int left = canvas_width, right = 0, top = canvas_height, bottom = 0;
+	unsigned int row, first, last;
+
+	for ( row = 0; row < canvas_height; row++ ) {
+		const unsigned char *frame_row = frame + (size_t) row*canvas_row_size;
+		const unsigned char *canvas_row = canvas + (size_t) row*canvas_row_size;
+		bool clearing = cleared && row >= cleared[1] && row < cleared[1] + cleared[3];
+
+		/** Most rows of a status animation stay the same, so rule whole rows out first */
+		if ( !clearing && memcmp(frame_row, canvas_row, canvas_row_size) == 0 )
+			continue;
+
+		auto differs = [&](unsigned int col) {
+			bool was_cleared = clearing && col >= cleared[0] && col < cleared[0] + cleared[2];
+
+			return memcmp(frame_row + (size_t) col*bytes, was_cleared ? clear : canvas_row + (size_t) col*bytes, bytes) != 0;
+		};
+
+		for ( first = 0; first < canvas_width && !differs(first); first++ );
+
+		if ( first == canvas_width )
+			continue;
+
+		for ( last = canvas_width - 1; !differs(last); last-- );
+
+		left = first < left ? first : left;
+		right = last + 1 > right ? last + 1 : right;
+		top = row < top ? row : top;
+		bottom = row + 1;
+	}
+
+	if ( top == canvas_height )
+		return 0;
+
+	bounds[0] = left;
+	bounds[1] = top;
+	bounds[2] = right - left;
+	bounds[3] = bottom - top;
+
+	return (unsigned long long) bounds[2]*bounds[3];
+}
+
+/**
+ * Blend the pending frame's region over the canvas when it has pixels that stay the same, so they can be written
+ * fully transparent, as long as the image has alpha and every pixel that changes is fully opaque so it replaces
+ * the canvas exactly
+ */
+unsigned char LTPNG::frame_blend(const unsigned int *region) {
+	if ( !(colour_type & 4) )
+		return BLEND_SOURCE;
+
+	unsigned int bytes = bit_depth/8;
+	unsigned int alpha = (channel_count(colour_type) - 1)*bytes;
+	unsigned int row, col, same = 0;
+
+	for ( row = region[1]; row < region[1] + region[3]; row++ ) {
+		const unsigned char *pixel = canvas_pending.data() + (size_t) row*canvas_row_size + (size_t) region[0]*pixel_size;
+		const unsigned char *was = canvas_base.data() + (size_t) row*canvas_row_size + (size_t) region[0]*pixel_size;
+
+		for ( col = 0; col < region[2]; col++, pixel += pixel_size, was += pixel_size ) {
+			if ( memcmp(pixel, was, pixel_size) == 0 )
+				same++;
+			else if ( pixel[alpha] != 0xFF || pixel[alpha + bytes - 1] != 0xFF )
+				return BLEND_SOURCE;
+		}
+	}
+
+	return same ? BLEND_OVER : BLEND_SOURCE;
+}
+
+/**
+ * Pick how the pending frame is disposed of by which leaves the next frame the smallest region: keeping it, clearing
+ * its region to transparent black where the image has alpha to show it, or going back to the canvas before it,
+ * which for the first frame would also clear it.  Ties keep the frame
+ */
+unsigned char LTPNG::frame_dispose(const unsigned int *region) {
+	unsigned int bounds[4];
+	unsigned long long area, best = frame_bounds(canvas_next.data(), canvas_pending.data(), NULL, bounds);
+	unsigned char dispose = DISPOSE_NONE;
+
+	if ( best > 0 && frames_written > 0 ) {
+		area = frame_bounds(canvas_next.data(), canvas_base.data(), NULL, bounds);
+
+		if ( area < best ) {
+			best = area;
+			dispose = DISPOSE_PREVIOUS;
+		}
+	}
+
+	if ( best > 0 && (colour_type & 4) ) {
+		area = frame_bounds(canvas_next.data(), canvas_pending.data(), region, bounds);
+
+		if ( area < best ) {
+			best = area;
+			dispose = DISPOSE_BACKGROUND;
+		}
+	}
+
+	return dispose;
+}
+
+/** Write the acTL animation control chunk, giving the number of frames and how many times they play */
+void LTPNG::write_animation_control_chunk(unsigned int plays) {
+	fwrite_32(8);				/** Write the 4-byte data length to start the animation control chunk */
+	crc_init();					/** Reset the running CRC */
+	fwrite_8(97);				/** Write the 4-byte chunk type */
+	fwrite_8(99);
+	fwrite_8(84);
+	fwrite_8(76);
+	fwrite_32(frame_count);		/** Write the 4-byte number of frames */
+	fwrite_32(plays);			/** Write the 4-byte number of times to play, 0 for forever */
+	fwrite_32(get_crc());		/** Calculate and write the 4-byte CRC value per Annex D */
+}
+
+/** Write the fcTL frame control chunk placing the region of a frame on the canvas */
+void LTPNG::write_frame_control_chunk(const unsigned int *region, unsigned short delay_numerator, unsigned short delay_denominator, unsigned char dispose, unsigned char blend) {
+	fwrite_32(26);					/** Write the 4-byte data length to start the frame control chunk */
+	crc_init();						/** Reset the running CRC */
+	fwrite_8(102);					/** Write the 4-byte chunk type */
+	fwrite_8(99);
+	fwrite_8(84);
+	fwrite_8(76);
+	fwrite_32(sequence++);			/** Write the 4-byte sequence number shared with the frame data chunks */
+	fwrite_32(region[2]);			/** Write the 4-byte width and height of the region */
+	fwrite_32(region[3]);
+	fwrite_32(region[0]);			/** Write the 4-byte x and y offset of the region on the canvas */
+	fwrite_32(region[1]);
+	fwrite_16(delay_numerator);		/** Write the 2-byte numerator and denominator of the frame delay in seconds */
+	fwrite_16(delay_denominator);
+	fwrite_8(dispose);				/** Write the 1-byte dispose and blend operations */
+	fwrite_8(blend);
+	fwrite_32(get_crc());			/** Calculate and write the 4-byte CRC value per Annex D */
+}
@@ -0,0 +1,136 @@
+/**
+ * Lowe Technologies PNG Encoder (LTPNG)
+ *
+ * Batch encoding.  Jobs are dealt out round robin to one queue per worker, and each worker runs the jobs at the
+ * back of its own queue on its own encoder, stealing from the front of the other queues once its own is empty, so
+ * a worker handed a run of large images does not hold up the batch while the others sit idle.
+ *
+ * @author Rich Lowe
+ * @version See LTPNG.cpp for revision and revision history
+ */
+
+/** Header includes */
+#include "LTPNG.h"
+
+using namespace std;
+
+/** Start an empty batch run by a number of workers, 0 for one per hardware thread */
+LTPNGBatch::LTPNGBatch(unsigned int worker_count) {
+	workers = worker_count;
+	images = 0;
+	failed = 0;
+	bytes_in = 0;
+	bytes_out = 0;
+	seconds = 0;
+}
+
+/** Add a job, which sets up the encoder it is given and writes one image with it */
+void LTPNGBatch::add(function<void (LTPNG &)> job) {
+	jobs.push_back(job);
+}
+
+/** Run every job added since the last run, returning once they have all finished or failed */
+void LTPNGBatch::run() {
+	unsigned int count = workers ? workers : thread::hardware_concurrency();
+	size_t job;
+
+	if ( count == 0 )
+		count = 1;
+
+	if ( count > jobs.size() )
+		count = jobs.size() ? jobs.size() : 1;
+
+	vector<LTPNGBatchQueue> queues(count);
+	vector<thread> pool;
+
+	for ( job = 0; job < jobs.size(); job++ )
+		queues[job % count].jobs.push_back(job);
+
+	images = 0;
+	failed = 0;
+	bytes_in = 0;
+	bytes_out = 0;
+	errors.clear();
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	for ( unsigned int i = 0; i < count; i++ )
+		pool.push_back(thread(&LTPNGBatch::work, this, ref(queues), i));
+
+	for ( thread &worker : pool )
+		worker.join();
+
+	seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	jobs.clear();
+}
+
+/** Run jobs on one worker's encoder until there are none left to take, adding its totals to the batch at the end */
+void LTPNGBatch::work(vector<LTPNGBatchQueue> &queues, unsigned int self) {
+	LTPNG image(8, 2, 4);
+
+	/** Workers already run one image each, so a generated image is made on one thread beside its encoder */
+	image.generators = 1;
+	unsigned int done = 0;
+	unsigned long long in = 0, out = 0;
+	vector<pair<size_t, const char *> > failures;
+	size_t job;
+
+	/** Channels of each colour type, for the scanline bytes of an image as it was written */
+	const unsigned char channels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+
+	while ( take(queues, self, job) ) {
+		/** Statistics are left off unless a job asks for them, and never left pointing at a finished job's */
+		image.stats = NULL;
+
+		try {
+			jobs[job](image);
+
+			in += ((unsigned long long) image.width*channels[image.output_colour_type]*image.output_bit_depth + 7)/8*image.height;
+			out += image.file_size;
+			done++;
+		} catch ( const char *error ) {
+			image.abort_image();
+			failures.push_back(make_pair(job, error));
+		} catch ( ... ) {
+			image.abort_image();
+			failures.push_back(make_pair(job, "LTPNGBatch::run(): job failed with an unexpected exception"));
+		}
+	}
+
+	lock_guard<mutex> guard(totals_lock);
+
+	images += done;
+	failed += failures.size();
+	bytes_in += in;
+	bytes_out += out;
+	errors.insert(errors.end(), failures.begin(), failures.end());
+}
+
+/** Take the newest job from a worker's own queue, or failing that the oldest job from any other queue */
+bool LTPNGBatch::take(vector<LTPNGBatchQueue> &queues, unsigned int self, size_t &job) {
+	unsigned int i;
+
+	{
+		lock_guard<mutex> guard(queues[self].lock);
+
+		if ( !queues[self].jobs.empty() ) {
+			job = queues[self].jobs.back();
+			queues[self].jobs.pop_back();
+			return true;
+		}
+	}
+
+	/** Jobs are never added while the batch runs, so once every queue has been found empty the worker is done */
+	for ( i = 1; i < queues.size(); i++ ) {
+		LTPNGBatchQueue &victim = queues[(self + i) % queues.size()];
+		lock_guard<mutex> guard(victim.lock);
+
+		if ( !victim.jobs.empty() ) {
+			job = victim.jobs.front();
+			victim.jobs.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
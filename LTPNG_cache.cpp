@@ -0,0 +1,368 @@
+/**
+ * Lowe Technologies PNG Encoder (LTPNG)
+ *
+ * Content-addressed encode cache.  create_image() hashes the pixels it is given, and everything deciding how they
+ * are encoded, into a key, and writes the image straight from the cache when it is held there.  Otherwise the image
+ * is encoded through a copy sink and stored once it is written, in memory up to a byte budget with the least
+ * recently used images evicted first, and in a directory of files named by key if the cache has one.
+ *
+ * @author Rich Lowe
+ * @version See LTPNG.cpp for revision and revision history
+ */
+
+/** Header includes */
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include "LTPNG.h"
+
+using namespace std;
+
+/** Rotate a 64-bit value left by r bits */
+static inline unsigned long long rotate_left(unsigned long long x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+/** Order keys by pixel hash then parameter hash, for the cache index */
+bool LTPNGCacheKey::operator<(const LTPNGCacheKey &other) const {
+	return pixels != other.pixels ? pixels < other.pixels : params < other.params;
+}
+
+/** Start an empty cache holding up to memory_budget bytes of images in memory, and on disk in path if not NULL */
+LTPNGCache::LTPNGCache(size_t memory_budget, const char *path) {
+	budget = memory_budget;
+	directory = path ? path : "";
+	hits = 0;
+	disk_hits = 0;
+	misses = 0;
+	evictions = 0;
+	evicted_bytes = 0;
+	held = 0;
+}
+
+/**
+ * Look up an image, copying it into png if it is held in memory or on disk.  An image read from disk is held in
+ * memory after, and a file that is not a whole PNG image, such as one cut short, counts as a miss
+ */
+bool LTPNGCache::fetch(const LTPNGCacheKey &key, vector<unsigned char> &png) {
+	{
+		lock_guard<mutex> guard(lock);
+		map<LTPNGCacheKey, list<LTPNGCacheEntry>::iterator>::iterator found = index.find(key);
+
+		if ( found != index.end() ) {
+			/** Move the image to the front as the most recently used */
+			recent.splice(recent.begin(), recent, found->second);
+			png = found->second->png;
+			hits++;
+			return true;
+		}
+
+		if ( directory.empty() ) {
+			misses++;
+			return false;
+		}
+	}
+
+	/** Read the file without holding the lock, so other encoders are not held up by the disk */
+	ifstream file(disk_path(key), ios::binary | ios::ate);
+	bool whole = false;
+
+	if ( file ) {
+		streamoff size = file.tellg();
+
+		png.resize(size > 0 ? size : 0);
+		file.seekg(0);
+		file.read((char *) png.data(), png.size());
+
+		/** The shortest image is the signature, IHDR, an IDAT, and IEND, and it must end with IEND per 5.6 */
+		whole = file && png.size() >= 57 && memcmp(png.data(), "\x89PNG\r\n\x1a\n", 8) == 0 && memcmp(png.data() + png.size() - 8, "IEND", 4) == 0;
+	}
+
+	lock_guard<mutex> guard(lock);
+
+	if ( !whole ) {
+		png.clear();
+		misses++;
+		return false;
+	}
+
+	disk_hits++;
+	hold(key, png);
+
+	return true;
+}
+
+/**
+ * Keep an encoded image in memory, and on disk if the cache has a directory.  The file is written under a name of
+ * its own and renamed into place, so a reader never finds half an image, and an image that cannot be written to
+ * disk is only held in memory, as the caller already has its image either way
+ */
+void LTPNGCache::store(const LTPNGCacheKey &key, const vector<unsigned char> &png) {
+	{
+		lock_guard<mutex> guard(lock);
+		hold(key, png);
+	}
+
+	if ( directory.empty() )
+		return;
+
+	string path = disk_path(key);
+	string temp = path + "." + to_string(getpid()) + "." + to_string(std::hash<thread::id>()(this_thread::get_id())) + ".tmp";
+	ofstream file(temp, ios::binary);
+
+	file.write((const char *) png.data(), png.size());
+	file.close();
+
+	if ( !file || rename(temp.c_str(), path.c_str()) != 0 )
+		remove(temp.c_str());
+}
+
+/** Drop every image held in memory, leaving the files on disk and the counters as they are */
+void LTPNGCache::clear() {
+	lock_guard<mutex> guard(lock);
+
+	recent.clear();
+	index.clear();
+	held = 0;
+}
+
+/** Bytes of encoded images held in memory */
+size_t LTPNGCache::bytes() {
+	lock_guard<mutex> guard(lock);
+
+	return held;
+}
+
+/** Number of encoded images held in memory */
+size_t LTPNGCache::entries() {
+	lock_guard<mutex> guard(lock);
+
+	return recent.size();
+}
+
+/**
+ * Hash a block of bytes with xxHash64, chaining blocks by passing the hash so far as the seed.  Input is read 8 bytes
+ * at a time in four independent lanes, so hashing runs at memory speed rather than a byte per multiply
+ */
+unsigned long long LTPNGCache::digest(const unsigned char *data, size_t len, unsigned long long seed) {
+	const unsigned long long prime1 = 0x9E3779B185EBCA87ULL, prime2 = 0xC2B2AE3D27D4EB4FULL, prime3 = 0x165667B19E3779F9ULL;
+	const unsigned long long prime4 = 0x85EBCA77C2B2AE63ULL, prime5 = 0x27D4EB2F165667C5ULL;
+	const unsigned char *end = data + len;
+	unsigned long long h, lane;
+	unsigned int word, i;
+
+	if ( len >= 32 ) {
+		unsigned long long v[4] = { seed + prime1 + prime2, seed + prime2, seed, seed - prime1 };
+
+		do {
+			for ( i = 0; i < 4; i++, data += 8 ) {
+				memcpy(&lane, data, 8);
+				v[i] = rotate_left(v[i] + lane*prime2, 31)*prime1;
+			}
+		} while ( data + 32 <= end );
+
+		h = rotate_left(v[0], 1) + rotate_left(v[1], 7) + rotate_left(v[2], 12) + rotate_left(v[3], 18);
+
+		for ( i = 0; i < 4; i++ )
+			h = (h ^ rotate_left(v[i]*prime2, 31)*prime1)*prime1 + prime4;
+	} else {
+		h = seed + prime5;
+	}
+
+	h += len;
+
+	/** Fold in the tail of fewer than 32 bytes */
+	for ( ; data + 8 <= end; data += 8 ) {
+		memcpy(&lane, data, 8);
+		h ^= rotate_left(lane*prime2, 31)*prime1;
+		h = rotate_left(h, 27)*prime1 + prime4;
+	}
+
+	if ( data + 4 <= end ) {
+		memcpy(&word, data, 4);
+		h ^= word*prime1;
+		h = rotate_left(h, 23)*prime2 + prime3;
+		data += 4;
+	}
+
+	for ( ; data < end; data++ ) {
+		h ^= *data*prime5;
+		h = rotate_left(h, 11)*prime1;
+	}
+
+	/** Mix the bits so every input bit affects every output bit */
+	h ^= h >> 33;
+	h *= prime2;
+	h ^= h >> 29;
+	h *= prime3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+/**
+ * Hold an image in memory as the most recently used, evicting the least recently used until the cache is back
+ * within its budget.  An image larger than the whole budget is not held, and one already held is left alone
+ */
+void LTPNGCache::hold(const LTPNGCacheKey &key, const vector<unsigned char> &png) {
+	if ( png.size() > budget || index.count(key) )
+		return;
+
+	recent.push_front(LTPNGCacheEntry());
+	recent.front().key = key;
+	recent.front().png = png;
+	index[key] = recent.begin();
+	held += png.size();
+
+	while ( held > budget ) {
+		LTPNGCacheEntry &oldest = recent.back();
+
+		held -= oldest.png.size();
+		evictions++;
+		evicted_bytes += oldest.png.size();
+		index.erase(oldest.key);
+		recent.pop_back();
+	}
+}
+
+/** File an image is kept in on disk, named by its key in hex */
+string LTPNGCache::disk_path(const LTPNGCacheKey &key) {
+	char name[40];
+
+	snprintf(name, sizeof(name), "%016llx%016llx.png", key.pixels, key.params);
+
+	return directory + "/" + name;
+}
+
+/**
+ * Key for 8 or 16-bit pixel channels of width*height samples each, hashing only the channels the image's colour
+ * type reads: grey from red alone, and alpha only for colour types (4) and (6)
+ */
+LTPNGCacheKey LTPNG::planes_key(unsigned int pixel_width, unsigned int pixel_height, const void *red, const void *green, const void *blue, const void *alpha, unsigned char sample_bytes) {
+	size_t len = (size_t) pixel_width*pixel_height*sample_bytes;
+	unsigned long long h = LTPNGCache::digest((const unsigned char *) red, len);
+
+	if ( colour_type & 2 ) {
+		h = LTPNGCache::digest((const unsigned char *) green, len, h);
+		h = LTPNGCache::digest((const unsigned char *) blue, len, h);
+	}
+
+	if ( colour_type & 4 )
+		h = LTPNGCache::digest((const unsigned char *) alpha, len, h);
+
+	/** Channels are told apart from the PIXELS_* formats by their sample size, after the last format */
+	return cache_key(pixel_width, pixel_height, PIXELS_GREYA16BE + sample_bytes, h);
+}
+
+/** Key for interleaved pixels in one of the PIXELS_* formats, hashing each row without any padding between rows */
+LTPNGCacheKey LTPNG::pixels_key(unsigned int pixel_width, unsigned int pixel_height, const unsigned char *pixels, unsigned char format, size_t stride) {
+	unsigned char depth = format == PIXELS_RGB8 || format == PIXELS_RGBA8 || format == PIXELS_GREY8 || format == PIXELS_GREYA8 ? 8 : 16;
+	size_t row_bytes = (size_t) pixel_width*format_channels(format)*depth/8;
+	unsigned long long h = 0;
+	unsigned int row;
+
+	if ( stride == 0 || stride == row_bytes )
+		return cache_key(pixel_width, pixel_height, format, LTPNGCache::digest(pixels, row_bytes*pixel_height));
+
+	for ( row = 0; row < pixel_height; row++, pixels += stride )
+		h = LTPNGCache::digest(pixels, row_bytes, h);
+
+	return cache_key(pixel_width, pixel_height, format, h);
+}
+
+/**
+ * Key for pixels of a given hash in a given source format, with the hash of everything else that changes the bytes
+ * written: the image size and format, filter, interlacing, reductions, compression options, IDAT size, whether the
+ * image is compressed in bands and how many rows they hold, and the zlib version doing the compressing
+ */
+LTPNGCacheKey LTPNG::cache_key(unsigned int pixel_width, unsigned int pixel_height, unsigned char source, unsigned long long pixel_hash) {
+	unsigned int params[] = { pixel_width, pixel_height, source, bit_depth, colour_type, filter_type, interlace, reduce, (unsigned int) options.level, (unsigned int) options.strategy, (unsigned int) options.mem_level, (unsigned int) options.window_bits, idat_size, threads > 1, threads > 1 ? band_rows : 0 };
+	const char *version = zlibVersion();
+	LTPNGCacheKey key;
+
+	key.pixels = pixel_hash;
+	key.params = LTPNGCache::digest((const unsigned char *) params, sizeof(params), LTPNGCache::digest((const unsigned char *) version, strlen(version)));
+
+	return key;
+}
+
+/**
+ * Write an image of set size straight from the cache if it is held there, leaving the encoder as if it had just
+ * encoded it: its size, the format in its header, and the bytes of its data chunks, with statistics for the write
+ */
+bool LTPNG::cached_image(LTPNGSink &out, const LTPNGCacheKey &key, unsigned int pixel_width, unsigned int pixel_height) {
+	if ( in_progress )
+		throw "LTPNG::create_image(): previous image was not finished with end_image()";
+
+	double start = stats ? stats_clock() : 0;
+	vector<unsigned char> png;
+	size_t pos, len;
+
+	if ( !cache->fetch(key, png) )
+		return false;
+
+	out.write(png.data(), png.size());
+
+	width = pixel_width;
+	height = pixel_height;
+	output_bit_depth = png[24];
+	output_colour_type = png[25];
+	palette_size = 0;
+	analysed = 0;
+	file_size = 0;
+
+	/**
+	 * Add up the IDAT chunks, each a 4-byte length and type, the data, and a 4-byte CRC per 5.3, and count the
+	 * entries of the PLTE chunk, 3 bytes each per 11.2.3, if the image has one
+	 */
+	for ( pos = 8; pos + 8 <= png.size(); pos += len + 12 ) {
+		len = (size_t) png[pos] << 24 | png[pos + 1] << 16 | png[pos + 2] << 8 | png[pos + 3];
+
+		if ( memcmp(png.data() + pos + 4, "IDAT", 4) == 0 )
+			file_size += len;
+		else if ( memcmp(png.data() + pos + 4, "PLTE", 4) == 0 )
+			palette_size = len/3;
+	}
+
+	if ( stats ) {
+		stats->reset();
+		stats->write_bytes = png.size();
+		stats->deflate_out = file_size;
+		stats->write_seconds = stats->total_seconds = stats_clock() - start;
+	}
+
+	return true;
+}
+
+/**
+ * Encode an image of set size to a sink, its rows written by write, with the cache in front of it if there is one:
+ * the image is written from the cache if its key is held there, and otherwise encoded through a copy sink and stored
+ * once it is written.  With reduce set, the rows are written twice, the first time to analyse them
+ */
+void LTPNG::encode_cached(LTPNGSink &out, unsigned int pixel_width, unsigned int pixel_height, function<LTPNGCacheKey ()> make_key, function<void ()> write) {
+	LTPNGCopySink copy(&out, cache && cache->directory.empty() ? cache->budget : (size_t) -1);
+	LTPNGCacheKey key;
+
+	if ( cache ) {
+		key = make_key();
+
+		if ( cached_image(out, key, pixel_width, pixel_height) )
+			return;
+	}
+
+	LTPNGSink &to = cache ? copy : out;
+
+	/** Look through the whole image first if it may be written in a smaller format */
+	if ( reduce ) {
+		begin_analysis(pixel_width, pixel_height, bit_depth, colour_type);
+		write();
+		end_analysis();
+	}
+
+	begin_image(to, pixel_width, pixel_height, bit_depth, colour_type);
+	write();
+	end_image();
+
+	if ( cache && copy.complete )
+		cache->store(key, copy.data);
+}
@@ -0,0 +1,266 @@
+/**
+ * Lowe Technologies PNG Encoder (LTPNG)
+ *
+ * CRC-32 engine used for the chunk CRCs defined in Annex D of the PNG standard.  The lookup tables are
+ * generated at compile time, a slice-by-8 table loop is used everywhere, and a carry-less multiply
+ * (PCLMULQDQ) folding loop is picked at runtime on CPUs that support it.
+ *
+ * @author Rich Lowe
+ * @version See LTPNG.cpp for revision and revision history
+ */
+
+/** Header includes */
+#include <cstddef>
+#include "LTPNG.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define LTPNG_CRC_CLMUL 1
+#endif
+
+using namespace std;
+
+/** Reflected CRC-32 polynomial per Annex D */
+#define CRC_POLY 0xEDB88320u
+
+/** Lookup tables for slice-by-8, table[0] is the classic table of CRCs of all 8-bit messages */
+struct crc_tables_t {
+	unsigned int table[8][256];
+};
+
+/** Build the slice-by-8 tables, each table advancing the previous one by a further zero byte */
+static constexpr crc_tables_t make_crc_tables() {
+	crc_tables_t t = {};
+	unsigned int c = 0, n = 0, k = 0;
+
+	for ( n = 0; n < 256; n++ ) {
+		c = n;
+
+		for ( k = 0; k < 8; k++ )
+			c = c & 1 ? CRC_POLY ^ (c >> 1) : c >> 1;
+
+		t.table[0][n] = c;
+	}
+
+	for ( n = 0; n < 256; n++ )
+		for ( k = 1; k < 8; k++ )
+			t.table[k][n] = (t.table[k - 1][n] >> 8) ^ t.table[0][t.table[k - 1][n] & 0xFF];
+
+	return t;
+}
+
+static constexpr crc_tables_t crc_tables = make_crc_tables();
+
+/** Multiply a(x) by b(x) modulo the CRC polynomial, both in reflected bit order */
+static constexpr unsigned int crc_multiply(unsigned int a, unsigned int b) {
+	unsigned int m = 1u << 31, p = 0;
+
+	while ( m ) {
+		if ( a & m )
+			p ^= b;
+
+		m >>= 1;
+		b = b & 1 ? CRC_POLY ^ (b >> 1) : b >> 1;
+	}
+
+	return p;
+}
+
+/** Table of x^(2^n) modulo the CRC polynomial, used to advance a CRC over runs of zero bytes */
+struct crc_powers_t {
+	unsigned int power[32];
+};
+
+static constexpr crc_powers_t make_crc_powers() {
+	crc_powers_t t = {};
+	unsigned int p = 1u << 30;	/** x^1 */
+	unsigned int n = 0;
+
+	t.power[0] = p;
+
+	for ( n = 1; n < 32; n++ )
+		t.power[n] = p = crc_multiply(p, p);
+
+	return t;
+}
+
+static constexpr crc_powers_t crc_powers = make_crc_powers();
+
+#ifdef LTPNG_CRC_CLMUL
+/**
+ * Fold 16-byte blocks with carry-less multiplies and Barrett reduce to 32 bits, using the reflected domain
+ * constants from Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction".  Requires
+ * len >= 64 and a multiple of 16, the CRC is the running (pre-inverted) value like update_crc()
+ */
+__attribute__((target("pclmul,sse4.1")))
+static unsigned int crc_clmul_blocks(unsigned int crc, const unsigned char *buf, size_t len) {
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+	const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+	/** Load the first 64 bytes into four lanes, folding the CRC into the first */
+	x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) buf), _mm_cvtsi32_si128(crc));
+	x2 = _mm_loadu_si128((const __m128i *) (buf + 16));
+	x3 = _mm_loadu_si128((const __m128i *) (buf + 32));
+	x4 = _mm_loadu_si128((const __m128i *) (buf + 48));
+	buf += 64;
+	len -= 64;
+
+	/** Fold 64 bytes at a time into the four lanes */
+	while ( len >= 64 ) {
+		x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *) buf));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *) (buf + 16)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *) (buf + 32)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *) (buf + 48)));
+
+		buf += 64;
+		len -= 64;
+	}
+
+	/** Fold the four lanes down into one */
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x4), x5);
+
+	/** Fold any remaining 16-byte blocks */
+	while ( len >= 16 ) {
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), _mm_loadu_si128((const __m128i *) buf)), x5);
+		buf += 16;
+		len -= 16;
+	}
+
+	/** Fold 128 bits down to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask), k5k0, 0x00), x2);
+
+	/** Barrett reduce 64 bits down to the 32-bit CRC */
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), poly, 0x10);
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask), poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_extract_epi32(x1, 1);
+}
+#endif
+
+/**
+ * Textbook byte-at-a-time CRC update, kept as the reference the faster engines are measured and checked against.
+ * Like all update functions the CRC should be initialized to all 1's and the final value inverted.
+ */
+unsigned int LTPNG::update_crc_reference(unsigned int crc, const unsigned char *buf, size_t len) {
+	unsigned int c = crc;
+	size_t n;
+
+	for ( n = 0; n < len; n++ )
+		c = crc_tables.table[0][(c ^ buf[n]) & 0xFF] ^ (c >> 8);
+
+	return c;
+}
+
+/** Slice-by-8 CRC update, consuming 8 bytes per step with one lookup in each of the 8 tables */
+unsigned int LTPNG::update_crc_slice(unsigned int crc, const unsigned char *buf, size_t len) {
+	const unsigned int (*t)[256] = crc_tables.table;
+	unsigned int c = crc;
+	unsigned int one, two;
+
+	while ( len >= 8 ) {
+		one = c ^ (buf[0] | buf[1] << 8 | buf[2] << 16 | (unsigned int) buf[3] << 24);
+		two = buf[4] | buf[5] << 8 | buf[6] << 16 | (unsigned int) buf[7] << 24;
+
+		c = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+			t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+
+		buf += 8;
+		len -= 8;
+	}
+
+	while ( len-- )
+		c = t[0][(c ^ *buf++) & 0xFF] ^ (c >> 8);
+
+	return c;
+}
+
+/** 
+ * Carry-less multiply CRC update for the bulk of the buffer, with the slice-by-8 loop handling the tail
+ * and the whole buffer on CPUs without PCLMULQDQ
+ */
+unsigned int LTPNG::update_crc_clmul(unsigned int crc, const unsigned char *buf, size_t len) {
+#ifdef LTPNG_CRC_CLMUL
+	if ( len >= 64 && crc_clmul_supported() ) {
+		size_t blocks = len & ~(size_t) 15;
+
+		crc = crc_clmul_blocks(crc, buf, blocks);
+		buf += blocks;
+		len -= blocks;
+	}
+#endif
+
+	return update_crc_slice(crc, buf, len);
+}
+
+/** Returns true if the CPU can run update_crc_clmul() */
+bool LTPNG::crc_clmul_supported() {
+#ifdef LTPNG_CRC_CLMUL
+	static const bool supported = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+
+	return supported;
+#else
+	return false;
+#endif
+}
+
+/** Returns the name of the CRC engine update_crc() dispatches to on this CPU */
+const char *LTPNG::crc_engine() {
+	return crc_clmul_supported() ? "pclmul" : "slice-by-8";
+}
+
+/**
+ * Update a running CRC with the bytes buf[0..len-1]--the CRC should be initialized to all 1's, and the
+ * transmitted value is the 1's complement of the final running CRC.  Short runs such as chunk headers
+ * stay on the table loop, everything else goes to the fastest engine the CPU supports.
+ */
+unsigned int LTPNG::update_crc(unsigned int crc, const unsigned char *buf, size_t len) {
+	if ( len >= 64 )
+		return update_crc_clmul(crc, buf, len);
+
+	return update_crc_slice(crc, buf, len);
+}
+
+/**
+ * Combine the final CRCs of two adjacent blocks into the final CRC of both, given only the length of the
+ * second block, so that blocks can have their CRCs calculated independently and in parallel
+ */
+unsigned int LTPNG::crc_combine(unsigned int crc1, unsigned int crc2, size_t len2) {
+	unsigned int p = 1u << 31;	/** x^0 */
+	unsigned int k = 3;			/** Start at x^(2^3), one byte of zeros */
+
+	/** Work out x^(8*len2) modulo the polynomial from the table of powers */
+	while ( len2 ) {
+		if ( len2 & 1 )
+			p = crc_multiply(crc_powers.power[k & 31], p);
+
+		len2 >>= 1;
+		k++;
+	}
+
+	/** Advance the first CRC over the second block's worth of zeros and fold in the second */
+	return crc_multiply(p, crc1) ^ crc2;
+}
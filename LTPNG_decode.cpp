@@ -0,0 +1,535 @@
+/**
+ * Lowe Technologies PNG Encoder (LTPNG)
+ *
+ * Streaming PNG decoder.  Chunks are parsed and their CRCs checked as they are read, IDAT data is inflated
+ * incrementally a scanline at a time, and each scanline is unfiltered against the one before, so only two
+ * scanlines and one read buffer are held in memory however large the image.  Rows come back in PNG byte order
+ * for any colour type and bit depth.  Interlaced images are the exception, as their first pass already needs
+ * rows from the bottom of the image, so all seven passes are read into one image-sized buffer first.
+ *
+ * @author Rich Lowe
+ * @version See LTPNG.cpp for revision and revision history
+ */
+
+/** Header includes */
+#include <cstring>
+#include <algorithm>
+#include "LTPNG.h"
+
+using namespace std;
+
+/** Wrap an open input stream */
+LTPNGFileSource::LTPNGFileSource(istream *stream) {
+	file = stream;
+}
+
+/** Read up to len bytes from the input stream */
+size_t LTPNGFileSource::read(unsigned char *buf, size_t len) {
+	if ( !file )
+		throw "LTPNGFileSource::read(): no input stream to read from";
+
+	file->read((char *) buf, len);
+
+	return file->gcount();
+}
+
+/** Wrap a PNG of size bytes held in memory, starting at the beginning */
+LTPNGMemorySource::LTPNGMemorySource(const unsigned char *png, size_t png_size) {
+	data = png;
+	size = png_size;
+	position = 0;
+}
+
+/** Copy up to len bytes out of memory */
+size_t LTPNGMemorySource::read(unsigned char *buf, size_t len) {
+	if ( len > size - position )
+		len = size - position;
+
+	memcpy(buf, data + position, len);
+	position += len;
+
+	return len;
+}
+
+/** Buffers and the inflate stream are allocated by the first image and kept for the ones after */
+LTPNGDecoder::LTPNGDecoder() {
+	width = 0;
+	height = 0;
+	bit_depth = 0;
+	colour_type = 0;
+	interlace = 0;
+	row_size = 0;
+	read_size = 65536;
+
+	prior_row = NULL;
+	filtered_row = NULL;
+	pass_row = NULL;
+	row_capacity = 0;
+	image_rows = NULL;
+	image_capacity = 0;
+	in_buf = NULL;
+	in_capacity = 0;
+	source = NULL;
+	in_progress = 0;
+	stream_ready = 0;
+}
+
+/** Release the buffers and inflate stream kept between images */
+LTPNGDecoder::~LTPNGDecoder() {
+	delete[] prior_row;
+	delete[] filtered_row;
+	delete[] pass_row;
+	delete[] image_rows;
+	delete[] in_buf;
+
+	if ( stream_ready )
+		inflateEnd(&strm);
+}
+
+/** Decode a whole image, returning height rows of row_size bytes each in PNG byte order */
+vector<unsigned char> LTPNGDecoder::read_image(LTPNGSource &in) {
+	vector<unsigned char> pixels;
+
+	begin_read(in);
+
+	try {
+		pixels.resize((size_t) row_size*height);
+		read_rows(height, pixels.data());
+		end_read();
+	} catch ( ... ) {
+		abort_read();
+		throw;
+	}
+
+	return pixels;
+}
+
+/**
+ * Begin reading an image, checking the signature and reading the header chunk and every chunk up to the first IDAT,
+ * after which the header properties, palette, and transparency are set and rows can be read with read_rows()
+ */
+void LTPNGDecoder::begin_read(LTPNGSource &in) {
+	if ( in_progress )
+		throw "LTPNGDecoder::begin_read(): previous image was not finished with end_read()";
+
+	if ( read_size == 0 )
+		throw "LTPNGDecoder::begin_read(): read size must be non-zero";
+
+	source = &in;
+	in_progress = 1;
+	palette.clear();
+	transparency.clear();
+
+	try {
+		read_png_signature();
+		read_header_chunk();
+
+		/** Read ahead to the image data, keeping the palette and transparency and skipping anything else ancillary */
+		for ( ;; ) {
+			read_chunk_start();
+
+			if ( chunk_is("IDAT") ) {
+				break;
+			} else if ( chunk_is("PLTE") ) {
+				if ( chunk_left % 3 || chunk_left == 0 || chunk_left > 768 )
+					throw "LTPNGDecoder::begin_read(): palette chunk has an invalid length";
+
+				palette.resize(chunk_left);
+				read_chunk_data(palette.data(), chunk_left);
+			} else if ( chunk_is("tRNS") ) {
+				transparency.resize(chunk_left);
+				read_chunk_data(transparency.data(), chunk_left);
+			} else if ( chunk_is("IEND") ) {
+				throw "LTPNGDecoder::begin_read(): image has no image data";
+			} else if ( !(chunk_type[0] & 0x20) ) {
+				/** Bit 5 of the first type byte is clear for critical chunks, which cannot be skipped per 5.4 */
+				throw "LTPNGDecoder::begin_read(): unknown critical chunk";
+			} else {
+				skip_chunk();
+				continue;
+			}
+
+			read_chunk_end();
+		}
+
+		if ( colour_type == 3 && palette.empty() )
+			throw "LTPNGDecoder::begin_read(): indexed-colour image has no palette";
+	} catch ( ... ) {
+		in_progress = 0;
+		throw;
+	}
+
+	/** Grow the scanline buffers only for rows longer than any image before, the prior row starts as all zeros per 9.2 */
+	if ( row_size > row_capacity ) {
+		delete[] prior_row;
+		delete[] filtered_row;
+		delete[] pass_row;
+
+		prior_row = new unsigned char[row_size];
+		filtered_row = new unsigned char[row_size + 1];
+		pass_row = new unsigned char[row_size];
+		row_capacity = row_size;
+	}
+
+	memset(prior_row, 0, row_size);
+
+	if ( read_size > in_capacity ) {
+		delete[] in_buf;
+
+		in_buf = new unsigned char[read_size];
+		in_capacity = read_size;
+	}
+
+	/** The inflate stream is set up once and reset for each image after */
+	if ( stream_ready ) {
+		if ( inflateReset(&strm) != Z_OK )
+			throw "LTPNGDecoder::begin_read(): inflateReset() stream state was inconsistent";
+	} else {
+		strm.zalloc = Z_NULL;
+		strm.zfree = Z_NULL;
+		strm.opaque = Z_NULL;
+		strm.avail_in = 0;
+		strm.next_in = Z_NULL;
+
+		int ret = inflateInit(&strm);
+
+		if ( ret != Z_OK ) {
+			in_progress = 0;
+
+			switch ( ret ) {
+				case Z_MEM_ERROR: throw "LTPNGDecoder::begin_read(): not enough memory for inflateInit()";
+				case Z_VERSION_ERROR: throw "LTPNGDecoder::begin_read(): zlib library version is incompatible with the version of inflateInit() assumed";
+				default: throw "LTPNGDecoder::begin_read(): unknown error on inflateInit()";
+			}
+		}
+
+		stream_ready = 1;
+	}
+
+	strm.avail_in = 0;
+	rows_read = 0;
+	stream_end = 0;
+}
+
+/** Read the next rows of the image into pixels in PNG byte order, with rows stride bytes apart (0 for row_size) */
+void LTPNGDecoder::read_rows(unsigned int rows, unsigned char *pixels, size_t stride) {
+	if ( !in_progress )
+		throw "LTPNGDecoder::read_rows(): begin_read() must be called first";
+
+	if ( rows > height - rows_read )
+		throw "LTPNGDecoder::read_rows(): more rows read than the image height";
+
+	if ( stride == 0 )
+		stride = row_size;
+
+	unsigned int row;
+
+	/** An interlaced image is put back together on the first read, and its rows copied out from then on */
+	if ( interlace ) {
+		if ( rows_read == 0 && rows > 0 )
+			read_passes();
+
+		for ( row = 0; row < rows; row++, rows_read++ )
+			memcpy(pixels + row*stride, image_rows + (size_t) rows_read*row_size, row_size);
+
+		return;
+	}
+
+	for ( row = 0; row < rows; row++ ) {
+		unsigned char *out = pixels + row*stride;
+
+		if ( inflate_data(filtered_row, row_size + 1) != row_size + 1 )
+			throw "LTPNGDecoder::read_rows(): image data ended before the last row";
+
+		/** Corrupt data usually shows here first, since a chunk's CRC can only be checked once all of it is read */
+		if ( filtered_row[0] > 4 )
+			throw "LTPNGDecoder::read_rows(): invalid filter type, the image data is corrupt";
+
+		/** Unfilter against the prior row, then keep this row as the prior for the next */
+		LTPNG::unfilter_row(out, filtered_row + 1, prior_row, row_size, pixel_size, filtered_row[0]);
+		memcpy(prior_row, out, row_size);
+
+		rows_read++;
+	}
+}
+
+/** Read the seven passes of an interlaced image per 8.2, each unfiltered as an image of its own and spread into place */
+void LTPNGDecoder::read_passes() {
+	unsigned int pass, pass_width, pass_height, pass_size, row, col, x, y;
+	unsigned int per_byte = pixel_bits < 8 ? 8/pixel_bits : 1;
+	unsigned char mask = pixel_bits < 8 ? (1 << pixel_bits) - 1 : 0xFF;
+	unsigned char value;
+
+	if ( (size_t) height*row_size > image_capacity ) {
+		delete[] image_rows;
+
+		image_capacity = (size_t) height*row_size;
+		image_rows = new unsigned char[image_capacity];
+	}
+
+	/** Pixels under 8 bits are set into their bytes, so start from all zeros */
+	memset(image_rows, 0, (size_t) height*row_size);
+
+	for ( pass = 0; pass < 7; pass++ ) {
+		const unsigned char *step = LTPNG::adam7[pass];
+
+		pass_width = width > step[0] ? (width - step[0] + step[2] - 1)/step[2] : 0;
+		pass_height = height > step[1] ? (height - step[1] + step[3] - 1)/step[3] : 0;
+
+		/** Passes with no pixels have no scanlines at all */
+		if ( !pass_width || !pass_height )
+			continue;
+
+		pass_size = ((unsigned long long) pass_width*pixel_bits + 7)/8;
+		memset(prior_row, 0, pass_size);
+
+		for ( row = 0, y = step[1]; row < pass_height; row++, y += step[3] ) {
+			if ( inflate_data(filtered_row, pass_size + 1) != pass_size + 1 )
+				throw "LTPNGDecoder::read_rows(): image data ended before the last pass";
+
+			if ( filtered_row[0] > 4 )
+				throw "LTPNGDecoder::read_rows(): invalid filter type, the image data is corrupt";
+
+			LTPNG::unfilter_row(pass_row, filtered_row + 1, prior_row, pass_size, pixel_size, filtered_row[0]);
+			swap(pass_row, prior_row);
+
+			unsigned char *image_row = image_rows + (size_t) y*row_size;
+
+			for ( col = 0, x = step[0]; col < pass_width; col++, x += step[2] ) {
+				if ( pixel_bits >= 8 ) {
+					memcpy(image_row + x*pixel_size, prior_row + col*pixel_size, pixel_size);
+				} else {
+					value = (prior_row[col/per_byte] >> (8 - pixel_bits*(col % per_byte + 1))) & mask;
+					image_row[x/per_byte] |= value << (8 - pixel_bits*(x % per_byte + 1));
+				}
+			}
+		}
+	}
+}
+
+/** Finish reading the image, checking the zlib stream ends with the last row and reading the chunks through IEND */
+void LTPNGDecoder::end_read() {
+	if ( !in_progress )
+		throw "LTPNGDecoder::end_read(): begin_read() must be called first";
+
+	if ( rows_read != height )
+		throw "LTPNGDecoder::end_read(): fewer rows read than the image height";
+
+	/** Inflating to the end of the stream checks its Adler-32 */
+	unsigned char extra;
+
+	if ( inflate_data(&extra, 1) )
+		throw "LTPNGDecoder::end_read(): more image data than the image height";
+
+	/** Anything left of the last IDAT chunk after the zlib stream is ignored, but its CRC must still match */
+	skip_chunk();
+
+	for ( ;; ) {
+		read_chunk_start();
+
+		if ( chunk_is("IEND") ) {
+			if ( chunk_left != 0 )
+				throw "LTPNGDecoder::end_read(): end chunk has data";
+
+			read_chunk_end();
+			break;
+		} else if ( chunk_is("IDAT") ) {
+			throw "LTPNGDecoder::end_read(): image data continues past the end of the zlib stream";
+		} else if ( !(chunk_type[0] & 0x20) ) {
+			throw "LTPNGDecoder::end_read(): unknown critical chunk";
+		}
+
+		skip_chunk();
+	}
+
+	in_progress = 0;
+}
+
+/** Abandon the image being read after an error so the decoder can begin another */
+void LTPNGDecoder::abort_read() {
+	in_progress = 0;
+}
+
+/** Check the 8-byte PNG signature per 5.2 */
+void LTPNGDecoder::read_png_signature() {
+	const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	unsigned char buf[8];
+
+	read_bytes(buf, 8);
+
+	if ( memcmp(buf, signature, 8) )
+		throw "LTPNGDecoder::read_png_signature(): not a PNG image";
+}
+
+/** Read and validate the IHDR image header chunk per 11.2.2 */
+void LTPNGDecoder::read_header_chunk() {
+	unsigned char buf[13];
+	unsigned char channels;
+
+	read_chunk_start();
+
+	if ( !chunk_is("IHDR") || chunk_left != 13 )
+		throw "LTPNGDecoder::read_header_chunk(): image does not start with a valid header chunk";
+
+	read_chunk_data(buf, 13);
+	read_chunk_end();
+
+	width = (unsigned int) buf[0] << 24 | buf[1] << 16 | buf[2] << 8 | buf[3];
+	height = (unsigned int) buf[4] << 24 | buf[5] << 16 | buf[6] << 8 | buf[7];
+	bit_depth = buf[8];
+	colour_type = buf[9];
+	interlace = buf[12];
+
+	if ( width == 0 || height == 0 || width > 0x7FFFFFFF || height > 0x7FFFFFFF )
+		throw "LTPNGDecoder::read_header_chunk(): invalid width or height";
+
+	/** Allowed bit depths for each colour type per table 11.1 */
+	switch ( colour_type ) {
+		case 0:
+			channels = 1;
+
+			if ( bit_depth != 1 && bit_depth != 2 && bit_depth != 4 && bit_depth != 8 && bit_depth != 16 )
+				throw "LTPNGDecoder::read_header_chunk(): invalid bit depth for greyscale";
+			break;
+		case 3:
+			channels = 1;
+
+			if ( bit_depth != 1 && bit_depth != 2 && bit_depth != 4 && bit_depth != 8 )
+				throw "LTPNGDecoder::read_header_chunk(): invalid bit depth for indexed-colour";
+			break;
+		case 2:
+		case 4:
+		case 6:
+			channels = colour_type == 2 ? 3 : colour_type == 4 ? 2 : 4;
+
+			if ( bit_depth != 8 && bit_depth != 16 )
+				throw "LTPNGDecoder::read_header_chunk(): invalid bit depth for colour type";
+			break;
+		default:
+			throw "LTPNGDecoder::read_header_chunk(): invalid colour type";
+	}
+
+	if ( buf[10] != 0 || buf[11] != 0 )
+		throw "LTPNGDecoder::read_header_chunk(): unknown compression or filter method";
+
+	if ( interlace > 1 )
+		throw "LTPNGDecoder::read_header_chunk(): unknown interlace method";
+
+	/** Scanlines are padded to whole bytes, and filters work on whole pixels or single bytes below 8 bits */
+	unsigned long long bytes = ((unsigned long long) width*channels*bit_depth + 7)/8;
+
+	if ( bytes >= 0x7FFFFFFF )
+		throw "LTPNGDecoder::read_header_chunk(): image rows are too large";
+
+	row_size = bytes;
+	pixel_bits = channels*bit_depth;
+	pixel_size = bit_depth < 8 ? 1 : pixel_bits/8;
+}
+
+/** Start reading a chunk, its length and type, and start its CRC with the type per 5.3 */
+void LTPNGDecoder::read_chunk_start() {
+	chunk_left = read_32();
+
+	if ( chunk_left > 0x7FFFFFFF )
+		throw "LTPNGDecoder::read_chunk_start(): chunk length is out of range";
+
+	read_bytes(chunk_type, 4);
+	crc = LTPNG::update_crc(0xffffffffL, chunk_type, 4);
+}
+
+/** Read len bytes of the current chunk's data, folding them into its CRC */
+void LTPNGDecoder::read_chunk_data(unsigned char *buf, unsigned int len) {
+	if ( len > chunk_left )
+		throw "LTPNGDecoder::read_chunk_data(): read past the end of the chunk";
+
+	read_bytes(buf, len);
+	crc = LTPNG::update_crc(crc, buf, len);
+	chunk_left -= len;
+}
+
+/** Finish reading a chunk, checking its CRC */
+void LTPNGDecoder::read_chunk_end() {
+	if ( read_32() != (crc ^ 0xffffffffL) )
+		throw "LTPNGDecoder::read_chunk_end(): chunk CRC does not match, the image is corrupt";
+}
+
+/** Read and discard the rest of the current chunk's data, still checking its CRC */
+void LTPNGDecoder::skip_chunk() {
+	unsigned char buf[4096];
+
+	while ( chunk_left > 0 )
+		read_chunk_data(buf, chunk_left < sizeof(buf) ? chunk_left : sizeof(buf));
+
+	read_chunk_end();
+}
+
+/** Returns true if the current chunk has the given 4-letter type */
+bool LTPNGDecoder::chunk_is(const char *type) {
+	return !memcmp(chunk_type, type, 4);
+}
+
+/** Refill the inflate input from the IDAT chunks, moving on to the next IDAT chunk when the current one runs out */
+void LTPNGDecoder::fill_input() {
+	while ( chunk_left == 0 ) {
+		read_chunk_end();
+		read_chunk_start();
+
+		if ( !chunk_is("IDAT") )
+			throw "LTPNGDecoder::fill_input(): image data ended before the end of the zlib stream";
+	}
+
+	unsigned int len = chunk_left < read_size ? chunk_left : read_size;
+
+	read_chunk_data(in_buf, len);
+	strm.next_in = in_buf;
+	strm.avail_in = len;
+}
+
+/** Inflate up to len bytes of image data into out, returning fewer than len only at the end of the zlib stream */
+unsigned int LTPNGDecoder::inflate_data(unsigned char *out, unsigned int len) {
+	strm.next_out = out;
+	strm.avail_out = len;
+
+	while ( strm.avail_out > 0 && !stream_end ) {
+		if ( strm.avail_in == 0 )
+			fill_input();
+
+		int ret = inflate(&strm, Z_NO_FLUSH);
+
+		if ( ret == Z_STREAM_END ) {
+			stream_end = 1;
+		} else if ( ret != Z_OK ) {
+			switch ( ret ) {
+				case Z_NEED_DICT: throw "LTPNGDecoder::inflate_data(): inflate() requires a preset dictionary, which PNG does not allow";
+				case Z_DATA_ERROR: throw "LTPNGDecoder::inflate_data(): inflate() input data is corrupted";
+				case Z_MEM_ERROR: throw "LTPNGDecoder::inflate_data(): not enough memory for inflate()";
+				case Z_BUF_ERROR: throw "LTPNGDecoder::inflate_data(): no progress possible for inflate()";
+				default: throw "LTPNGDecoder::inflate_data(): unknown error on inflate()";
+			}
+		}
+	}
+
+	return len - strm.avail_out;
+}
+
+/** Read exactly len bytes from the source */
+void LTPNGDecoder::read_bytes(unsigned char *buf, size_t len) {
+	while ( len > 0 ) {
+		size_t got = source->read(buf, len);
+
+		if ( got == 0 )
+			throw "LTPNGDecoder::read_bytes(): unexpected end of the image";
+
+		buf += got;
+		len -= got;
+	}
+}
+
+/** Read a 4-byte big endian unsigned integer per 7.1 */
+unsigned int LTPNGDecoder::read_32() {
+	unsigned char buf[4];
+
+	read_bytes(buf, 4);
+
+	return (unsigned int) buf[0] << 24 | buf[1] << 16 | buf[2] << 8 | buf[3];
+}
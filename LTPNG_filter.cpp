@@ -0,0 +1,306 @@
+/**
+ * Lowe Technologies PNG Encoder (LTPNG)
+ *
+ * Whole-row scanline filter kernels for the 5 filter methods defined in section 9.2 of the PNG standard.
+ * Filtering works on bytes, so the same kernels serve 8 and 16-bit samples alike, with only the number
+ * of bytes per complete pixel (bpp) differing.  A scalar reference is always available, and SSE2 and AVX2
+ * kernels are picked at runtime on x86-64.
+ *
+ * @author Rich Lowe
+ * @version See LTPNG.cpp for revision and revision history
+ */
+
+/** Header includes */
+#include <cstring>
+#include "LTPNG.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define LTPNG_FILTER_SIMD 1
+#endif
+
+using namespace std;
+
+/**
+ * Scalar reference filter for one scanline of len bytes, which the vector kernels must match byte for byte.
+ * Bytes left of the first pixel and the prior row of the first scanline are treated as 0 per 9.2
+ */
+void LTPNG::filter_row_reference(unsigned char *out, const unsigned char *raw, const unsigned char *prior, unsigned int len, unsigned char bpp, unsigned char filter) {
+	unsigned int i;
+
+	if ( filter == 0 ) {
+		for ( i = 0; i < len; i++ )
+			out[i] = raw[i];
+	} else if ( filter == 1 ) {
+		for ( i = 0; i < bpp && i < len; i++ )
+			out[i] = raw[i];
+
+		for ( ; i < len; i++ )
+			out[i] = raw[i] - raw[i - bpp];
+	} else if ( filter == 2 ) {
+		for ( i = 0; i < len; i++ )
+			out[i] = raw[i] - prior[i];
+	} else if ( filter == 3 ) {
+		for ( i = 0; i < bpp && i < len; i++ )
+			out[i] = raw[i] - (prior[i] >> 1);
+
+		for ( ; i < len; i++ )
+			out[i] = raw[i] - ((raw[i - bpp] + prior[i]) >> 1);
+	} else if ( filter == 4 ) {
+		for ( i = 0; i < bpp && i < len; i++ )
+			out[i] = raw[i] - prior[i];
+
+		for ( ; i < len; i++ )
+			out[i] = raw[i] - paeth_predictor(raw[i - bpp], prior[i], prior[i - bpp]);
+	} else {
+		throw "LTPNG::filter_row(): Invalid filter type.";
+	}
+}
+
+#ifdef LTPNG_FILTER_SIMD
+/** Branchless Paeth predictor on 8 pixels' worth of bytes widened to 16-bit lanes */
+static inline __m128i paeth_sse2(__m128i a, __m128i b, __m128i c) {
+	const __m128i zero = _mm_setzero_si128();
+
+	/** pa = |p - a| = |b - c|, pb = |p - b| = |a - c|, and pc = |p - c| = |(b - c) + (a - c)| */
+	__m128i bc = _mm_sub_epi16(b, c);
+	__m128i ac = _mm_sub_epi16(a, c);
+	__m128i pc = _mm_add_epi16(bc, ac);
+	__m128i pa = _mm_max_epi16(bc, _mm_sub_epi16(zero, bc));
+	__m128i pb = _mm_max_epi16(ac, _mm_sub_epi16(zero, ac));
+	pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+
+	/** Pick a if pa <= pb and pa <= pc, else b if pb <= pc, else c */
+	__m128i not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+	__m128i use_c = _mm_cmpgt_epi16(pb, pc);
+	__m128i b_or_c = _mm_or_si128(_mm_and_si128(use_c, c), _mm_andnot_si128(use_c, b));
+
+	return _mm_or_si128(_mm_and_si128(not_a, b_or_c), _mm_andnot_si128(not_a, a));
+}
+
+/**
+ * Scalar filter of bytes [i, len) of a scanline, for the tails the vector loops leave behind.  The kernels below are
+ * each instantiated for one filter method, so the method is settled once per row rather than tested for every byte
+ */
+template <unsigned char Filter>
+static void filter_tail(unsigned char *out, const unsigned char *raw, const unsigned char *prior, unsigned int i, unsigned int len, unsigned char bpp) {
+	for ( ; i < len; i++ ) {
+		if ( Filter == 1 )
+			out[i] = raw[i] - raw[i - bpp];
+		else if ( Filter == 2 )
+			out[i] = raw[i] - prior[i];
+		else if ( Filter == 3 )
+			out[i] = raw[i] - ((raw[i - bpp] + prior[i]) >> 1);
+		else
+			out[i] = raw[i] - LTPNG::paeth_predictor(raw[i - bpp], prior[i], prior[i - bpp]);
+	}
+}
+
+/** Filter bytes [i, len) of a scanline 16 at a time with SSE2, returning where the vector loop stopped */
+template <unsigned char Filter>
+static unsigned int filter_span_sse2(unsigned char *out, const unsigned char *raw, const unsigned char *prior, unsigned int i, unsigned int len, unsigned char bpp) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi8(1);
+	__m128i x, a, b, c, pred;
+
+	for ( ; i + 16 <= len; i += 16 ) {
+		x = _mm_loadu_si128((const __m128i *) (raw + i));
+
+		if ( Filter == 1 ) {
+			pred = _mm_loadu_si128((const __m128i *) (raw + i - bpp));
+		} else if ( Filter == 2 ) {
+			pred = _mm_loadu_si128((const __m128i *) (prior + i));
+		} else if ( Filter == 3 ) {
+			/** floor((a + b)/2) is the rounded up average less the carry from the low bits */
+			a = _mm_loadu_si128((const __m128i *) (raw + i - bpp));
+			b = _mm_loadu_si128((const __m128i *) (prior + i));
+			pred = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+		} else {
+			a = _mm_loadu_si128((const __m128i *) (raw + i - bpp));
+			b = _mm_loadu_si128((const __m128i *) (prior + i));
+			c = _mm_loadu_si128((const __m128i *) (prior + i - bpp));
+
+			pred = _mm_packus_epi16(
+				paeth_sse2(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero)),
+				paeth_sse2(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero)));
+		}
+
+		_mm_storeu_si128((__m128i *) (out + i), _mm_sub_epi8(x, pred));
+	}
+
+	return i;
+}
+
+/** SSE2 filter of a scanline past its first pixel for one filter method, finishing the tail a byte at a time */
+template <unsigned char Filter>
+static void filter_rest_sse2(unsigned char *out, const unsigned char *raw, const unsigned char *prior, unsigned int len, unsigned char bpp) {
+	unsigned int i = filter_span_sse2<Filter>(out, raw, prior, bpp, len, bpp);
+
+	filter_tail<Filter>(out, raw, prior, i, len, bpp);
+}
+
+/** SSE2 filter kernel, 16 bytes at a time once past the first pixel */
+void LTPNG::filter_row_sse2(unsigned char *out, const unsigned char *raw, const unsigned char *prior, unsigned int len, unsigned char bpp, unsigned char filter) {
+	/** None, and rows too short to fill a vector, have nothing worth vectorizing */
+	if ( filter == 0 || filter > 4 || len < bpp + 16u ) {
+		filter_row_reference(out, raw, prior, len, bpp, filter);
+		return;
+	}
+
+	/** The first pixel has no left neighbour, so it goes through the reference */
+	filter_row_reference(out, raw, prior, bpp, bpp, filter);
+
+	switch ( filter ) {
+		case 1: filter_rest_sse2<1>(out, raw, prior, len, bpp); break;
+		case 2: filter_rest_sse2<2>(out, raw, prior, len, bpp); break;
+		case 3: filter_rest_sse2<3>(out, raw, prior, len, bpp); break;
+		default: filter_rest_sse2<4>(out, raw, prior, len, bpp); break;
+	}
+}
+
+/** Branchless Paeth predictor on 16 pixels' worth of bytes widened to 16-bit lanes */
+__attribute__((target("avx2")))
+static inline __m256i paeth_avx2(__m256i a, __m256i b, __m256i c) {
+	__m256i bc = _mm256_sub_epi16(b, c);
+	__m256i ac = _mm256_sub_epi16(a, c);
+	__m256i pa = _mm256_abs_epi16(bc);
+	__m256i pb = _mm256_abs_epi16(ac);
+	__m256i pc = _mm256_abs_epi16(_mm256_add_epi16(bc, ac));
+
+	__m256i not_a = _mm256_or_si256(_mm256_cmpgt_epi16(pa, pb), _mm256_cmpgt_epi16(pa, pc));
+	__m256i b_or_c = _mm256_blendv_epi8(b, c, _mm256_cmpgt_epi16(pb, pc));
+
+	return _mm256_blendv_epi8(a, b_or_c, not_a);
+}
+
+/** AVX2 filter of a scanline past its first pixel for one filter method, 32 bytes at a time and then 16 and 1 */
+template <unsigned char Filter>
+__attribute__((target("avx2")))
+static void filter_rest_avx2(unsigned char *out, const unsigned char *raw, const unsigned char *prior, unsigned int len, unsigned char bpp) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi8(1);
+	__m256i x, a, b, c, pred;
+	unsigned int i;
+
+	for ( i = bpp; i + 32 <= len; i += 32 ) {
+		x = _mm256_loadu_si256((const __m256i *) (raw + i));
+
+		if ( Filter == 1 ) {
+			pred = _mm256_loadu_si256((const __m256i *) (raw + i - bpp));
+		} else if ( Filter == 2 ) {
+			pred = _mm256_loadu_si256((const __m256i *) (prior + i));
+		} else if ( Filter == 3 ) {
+			a = _mm256_loadu_si256((const __m256i *) (raw + i - bpp));
+			b = _mm256_loadu_si256((const __m256i *) (prior + i));
+			pred = _mm256_sub_epi8(_mm256_avg_epu8(a, b), _mm256_and_si256(_mm256_xor_si256(a, b), one));
+		} else {
+			a = _mm256_loadu_si256((const __m256i *) (raw + i - bpp));
+			b = _mm256_loadu_si256((const __m256i *) (prior + i));
+			c = _mm256_loadu_si256((const __m256i *) (prior + i - bpp));
+
+			/** Unpacking and packing both work within 128-bit lanes, so byte order comes back out unchanged */
+			pred = _mm256_packus_epi16(
+				paeth_avx2(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero), _mm256_unpacklo_epi8(c, zero)),
+				paeth_avx2(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero), _mm256_unpackhi_epi8(c, zero)));
+		}
+
+		_mm256_storeu_si256((__m256i *) (out + i), _mm256_sub_epi8(x, pred));
+	}
+
+	/** Finish what is left 16 bytes and then 1 byte at a time */
+	i = filter_span_sse2<Filter>(out, raw, prior, i, len, bpp);
+	filter_tail<Filter>(out, raw, prior, i, len, bpp);
+}
+
+/** AVX2 filter kernel, 32 bytes at a time once past the first pixel */
+__attribute__((target("avx2")))
+void LTPNG::filter_row_avx2(unsigned char *out, const unsigned char *raw, const unsigned char *prior, unsigned int len, unsigned char bpp, unsigned char filter) {
+	/** Rows too short to fill a 32-byte vector go to the SSE2 kernel */
+	if ( filter == 0 || filter > 4 || len < bpp + 32u ) {
+		filter_row_sse2(out, raw, prior, len, bpp, filter);
+		return;
+	}
+
+	filter_row_reference(out, raw, prior, bpp, bpp, filter);
+
+	switch ( filter ) {
+		case 1: filter_rest_avx2<1>(out, raw, prior, len, bpp); break;
+		case 2: filter_rest_avx2<2>(out, raw, prior, len, bpp); break;
+		case 3: filter_rest_avx2<3>(out, raw, prior, len, bpp); break;
+		default: filter_rest_avx2<4>(out, raw, prior, len, bpp); break;
+	}
+}
+#else
+/** Without x86-64 vector support the SIMD kernels are the reference */
+void LTPNG::filter_row_sse2(unsigned char *out, const unsigned char *raw, const unsigned char *prior, unsigned int len, unsigned char bpp, unsigned char filter) {
+	filter_row_reference(out, raw, prior, len, bpp, filter);
+}
+
+void LTPNG::filter_row_avx2(unsigned char *out, const unsigned char *raw, const unsigned char *prior, unsigned int len, unsigned char bpp, unsigned char filter) {
+	filter_row_reference(out, raw, prior, len, bpp, filter);
+}
+#endif
+
+/**
+ * Reconstruct one scanline of len bytes from its filtered bytes per 9.2, the inverse of filter_row().  out may be
+ * the same buffer as filtered, and prior is the reconstructed row above (all zeros for the first scanline)
+ */
+void LTPNG::unfilter_row(unsigned char *out, const unsigned char *filtered, const unsigned char *prior, unsigned int len, unsigned char bpp, unsigned char filter) {
+	unsigned int i;
+
+	if ( filter == 0 ) {
+		if ( out != filtered )
+			memcpy(out, filtered, len);
+	} else if ( filter == 1 ) {
+		for ( i = 0; i < bpp && i < len; i++ )
+			out[i] = filtered[i];
+
+		for ( ; i < len; i++ )
+			out[i] = filtered[i] + out[i - bpp];
+	} else if ( filter == 2 ) {
+		for ( i = 0; i < len; i++ )
+			out[i] = filtered[i] + prior[i];
+	} else if ( filter == 3 ) {
+		for ( i = 0; i < bpp && i < len; i++ )
+			out[i] = filtered[i] + (prior[i] >> 1);
+
+		for ( ; i < len; i++ )
+			out[i] = filtered[i] + ((out[i - bpp] + prior[i]) >> 1);
+	} else if ( filter == 4 ) {
+		for ( i = 0; i < bpp && i < len; i++ )
+			out[i] = filtered[i] + prior[i];
+
+		for ( ; i < len; i++ )
+			out[i] = filtered[i] + paeth_predictor(out[i - bpp], prior[i], prior[i - bpp]);
+	} else {
+		throw "LTPNG::unfilter_row(): Invalid filter type.";
+	}
+}
+
+/** Returns true if the CPU can run filter_row_avx2() */
+bool LTPNG::filter_avx2_supported() {
+#ifdef LTPNG_FILTER_SIMD
+	static const bool supported = __builtin_cpu_supports("avx2");
+
+	return supported;
+#else
+	return false;
+#endif
+}
+
+/** Returns the name of the filter kernels filter_row() dispatches to on this CPU */
+const char *LTPNG::filter_engine() {
+#ifdef LTPNG_FILTER_SIMD
+	return filter_avx2_supported() ? "avx2" : "sse2";
+#else
+	return "scalar";
+#endif
+}
+
+/** Filter one scanline of len bytes with the fastest kernel the CPU supports */
+void LTPNG::filter_row(unsigned char *out, const unsigned char *raw, const unsigned char *prior, unsigned int len, unsigned char bpp, unsigned char filter) {
+	if ( filter_avx2_supported() )
+		filter_row_avx2(out, raw, prior, len, bpp, filter);
+	else
+		filter_row_sse2(out, raw, prior, len, bpp, filter);
+}
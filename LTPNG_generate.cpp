@@ -0,0 +1,186 @@
+/**
+ * Lowe Technologies PNG Encoder (LTPNG)
+ *
+ * Generated images.  Pixels made by a generator are never held whole: bands of rows are generated on a pool of
+ * threads into a small ring of slots, and the calling thread pushes each band through write_rows() in row order as
+ * soon as it is ready.  A generator thread that gets too far ahead of the encoder waits for a slot to come free, so
+ * memory is bounded by the ring rather than the size of the image.
+ *
+ * @author Rich Lowe
+ * @version See LTPNG.cpp for revision and revision history
+ */
+
+/** Header includes */
+#include "LTPNG.h"
+
+using namespace std;
+
+/** Create a PNG image of set size from rows made by a generator, written to a file stream */
+void LTPNG::create_image_from_generator(ofstream &file, unsigned int pixel_width, unsigned int pixel_height, LTPNGGenerator generate) {
+	use_file(file);
+	create_image_from_generator(file_sink, pixel_width, pixel_height, generate);
+	image = &file;
+}
+
+/**
+ * Create a PNG image of set size from rows made by a generator, written to a sink.  With reduce set every row is
+ * generated twice, once to analyse it and once to encode it, so the generator must give the same row each time
+ */
+void LTPNG::create_image_from_generator(LTPNGSink &out, unsigned int pixel_width, unsigned int pixel_height, LTPNGGenerator generate) {
+	if ( reduce ) {
+		begin_analysis(pixel_width, pixel_height, bit_depth, colour_type);
+		write_generated_rows(pixel_height, generate);
+		end_analysis();
+	}
+
+	begin_image(out, pixel_width, pixel_height, bit_depth, colour_type);
+	write_generated_rows(pixel_height, generate);
+	end_image();
+}
+
+/**
+ * Push the next rows of the image in progress from a generator, run on generators threads (0 for one per hardware
+ * thread) that each work on a copy of it, so state the generator keeps for itself is never shared between threads.
+ * Channels the colour type does not use are ignored
+ */
+void LTPNG::write_generated_rows(unsigned int rows, LTPNGGenerator generate) {
+	if ( !in_progress )
+		throw "LTPNG::write_generated_rows(): begin_image() must be called first";
+
+	if ( rows > height - rows_written )
+		throw "LTPNG::write_generated_rows(): more rows written than the image height";
+
+	if ( rows == 0 )
+		return;
+
+	/** Bands of about 1 MiB of samples, with two slots per thread so each has one to fill while the other waits */
+	unsigned int per_band = (1 << 20)/((size_t) width*8) + 1;
+	unsigned int bands = (rows - 1)/per_band + 1;
+	unsigned int count = generators ? generators : thread::hardware_concurrency();
+	unsigned int slots, band, i;
+
+	if ( count == 0 )
+		count = 1;
+
+	if ( count > bands )
+		count = bands;
+
+	slots = count*2 < bands ? count*2 : bands;
+
+	LTPNGGenerateQueue queue;
+	vector<thread> pool;
+	size_t plane = (size_t) per_band*width;
+
+	queue.samples.resize(plane*4*slots);
+	queue.ready.assign(slots, 0);
+	queue.next = 0;
+	queue.written = 0;
+	queue.stop = false;
+	queue.error = NULL;
+
+	for ( i = 0; i < count; i++ )
+		pool.push_back(thread(&LTPNG::generate_bands, ref(queue), generate, width, rows_written, rows, per_band, slots));
+
+	try {
+		for ( band = 0; band < bands; band++ ) {
+			unsigned int slot = band % slots;
+			unsigned int band_size = rows - band*per_band < per_band ? rows - band*per_band : per_band;
+			unsigned short *samples = queue.samples.data() + plane*4*slot;
+
+			{
+				unique_lock<mutex> guard(queue.lock);
+
+				queue.changed.wait(guard, [&queue, slot] { return queue.stop || queue.ready[slot]; });
+
+				if ( queue.stop )
+					throw queue.error;
+			}
+
+			write_rows(band_size, samples, samples + plane, samples + plane*2, samples + plane*3);
+
+			{
+				lock_guard<mutex> guard(queue.lock);
+
+				queue.ready[slot] = 0;
+				queue.written++;
+			}
+
+			queue.changed.notify_all();
+		}
+	} catch ( ... ) {
+		/** Stop the generator threads before anything they write into goes away */
+		{
+			lock_guard<mutex> guard(queue.lock);
+
+			queue.stop = true;
+		}
+
+		queue.changed.notify_all();
+
+		for ( thread &worker : pool )
+			worker.join();
+
+		throw;
+	}
+
+	for ( thread &worker : pool )
+		worker.join();
+}
+
+/**
+ * Generate bands of rows into the ring until every band has been taken, each band waiting for its slot to be
+ * emptied by the encoder before it is filled.  A generator that throws stops the whole image
+ */
+void LTPNG::generate_bands(LTPNGGenerateQueue &queue, LTPNGGenerator generate, unsigned int width, unsigned int first, unsigned int rows, unsigned int per_band, unsigned int slots) {
+	size_t plane = (size_t) per_band*width;
+	unsigned int bands = (rows - 1)/per_band + 1;
+	unsigned int band, row, count;
+
+	while ( true ) {
+		{
+			unique_lock<mutex> guard(queue.lock);
+
+			if ( queue.stop || queue.next == bands )
+				return;
+
+			band = queue.next++;
+
+			/** The band before it in the same slot has to be encoded first */
+			queue.changed.wait(guard, [&queue, band, slots] { return queue.stop || band < queue.written + slots; });
+
+			if ( queue.stop )
+				return;
+		}
+
+		unsigned short *samples = queue.samples.data() + plane*4*(band % slots);
+
+		count = rows - band*per_band < per_band ? rows - band*per_band : per_band;
+
+		try {
+			for ( row = 0; row < count; row++ ) {
+				size_t start = (size_t) row*width;
+
+				generate(first + band*per_band + row, samples + start, samples + plane + start, samples + plane*2 + start, samples + plane*3 + start);
+			}
+		} catch ( const char *error ) {
+			lock_guard<mutex> guard(queue.lock);
+
+			queue.stop = true;
+			queue.error = error;
+		} catch ( ... ) {
+			lock_guard<mutex> guard(queue.lock);
+
+			queue.stop = true;
+			queue.error = "LTPNG::write_generated_rows(): generator failed with an unexpected exception";
+		}
+
+		{
+			lock_guard<mutex> guard(queue.lock);
+
+			if ( !queue.stop )
+				queue.ready[band % slots] = 1;
+		}
+
+		queue.changed.notify_all();
+	}
+}
@@ -0,0 +1,270 @@
+/**
+ * Lowe Technologies PNG Encoder (LTPNG)
+ *
+ * Incremental encoding.  The image is split into bands of rows, each band filtered and compressed as a raw deflate
+ * stream of its own with no dictionary, ending byte aligned at a sync flush so any band can follow any other.  The
+ * compressed bands and their Adler-32s are cached, and the next image of the same shape only compresses the bands a
+ * dirty rectangle touches, splicing the rest back in from the cache and combining the Adler-32s into one zlib stream.
+ *
+ * @author Rich Lowe
+ * @version See LTPNG.cpp for revision and revision history
+ */
+
+/** Header includes */
+#include <cstring>
+#include "LTPNG.h"
+
+using namespace std;
+
+/** Re-encode an image that changed only within a dirty rectangle since the last one, written to a file stream */
+void LTPNG::update_image(ofstream &file, unsigned int pixel_width, unsigned int pixel_height, const unsigned char *pixels, unsigned char format, unsigned int dirty_x, unsigned int dirty_y, unsigned int dirty_width, unsigned int dirty_height, size_t stride) {
+	use_file(file);
+	update_image(file_sink, pixel_width, pixel_height, pixels, format, dirty_x, dirty_y, dirty_width, dirty_height, stride);
+	image = &file;
+}
+
+/**
+ * Re-encode an image from interleaved pixels in one of the PIXELS_* formats, with rows stride bytes apart (0 for
+ * tightly packed rows), written to a sink.  Pixels outside the dirty rectangle must be unchanged since the last
+ * image written this way, and an empty rectangle means nothing changed.  Every band is compressed the first time,
+ * and again whenever the size, format, filter, band rows, or compression options change.  Each band is compressed
+ * the same way whatever the number of threads, so an updated image is byte for byte the image encoded from scratch
+ */
+void LTPNG::update_image(LTPNGSink &out, unsigned int pixel_width, unsigned int pixel_height, const unsigned char *pixels, unsigned char format, unsigned int dirty_x, unsigned int dirty_y, unsigned int dirty_width, unsigned int dirty_height, size_t stride) {
+	if ( in_progress )
+		throw "LTPNG::update_image(): previous image was not finished with end_image()";
+
+	if ( interlace || reduce )
+		throw "LTPNG::update_image(): interlaced and reduced images cannot be encoded incrementally";
+
+	if ( format > PIXELS_GREYA16BE )
+		throw "LTPNG::update_image(): invalid pixel format";
+
+	if ( (unsigned long long) dirty_x + dirty_width > pixel_width || (unsigned long long) dirty_y + dirty_height > pixel_height )
+		throw "LTPNG::update_image(): dirty rectangle is outside the image";
+
+	/** Verify the image parameters are supported, and set up for the caller's pixels */
+	check_options();
+	setup_source(pixel_width, pixel_height, bit_depth, colour_type);
+
+	unsigned char channels = format_channels(format);
+	unsigned char depth = format == PIXELS_RGB8 || format == PIXELS_RGBA8 || format == PIXELS_GREY8 || format == PIXELS_GREYA8 ? 8 : 16;
+
+	if ( channels >= 3 && !(colour_type & 2) )
+		throw "LTPNG::update_image(): truecolour pixels cannot be written to a greyscale image";
+
+	if ( stride == 0 )
+		stride = (size_t) width*channels*depth/8;
+
+	image = NULL;
+	sink = &out;
+	output_bit_depth = bit_depth;
+	output_colour_type = colour_type;
+	palette_size = 0;
+	analysed = 0;
+
+	if ( stats ) {
+		stats->reset();
+		stats_start = stats_clock();
+	}
+
+	setup_buffers();
+	out_len = 0;
+	file_size = 0;
+	in_progress = 1;
+
+	/** Bands are about 1 MiB of filtered rows unless told otherwise, as with parallel deflate */
+	band_limit = band_rows ? band_rows : (1 << 20)/(row_size + 1) + 1;
+
+	unsigned int count = (height - 1)/band_limit + 1;
+	bool reuse = band_cache_matches(count);
+	deque<unsigned int> pending;
+	unsigned int i;
+
+	/** Write the PNG file signature per section 5.2, and the IHDR header chunk per 11.2.2 */
+	write_png_signature();
+	write_header_chunk(output_bit_depth, output_colour_type, 0);
+
+	try {
+		/**
+		 * A band is compressed again if it holds a dirty row, or the row after the dirty rectangle, which is filtered
+		 * against the last dirty row.  Up to threads bands are compressed at once, each kept in the cache as it finishes
+		 */
+		for ( i = 0; i < count; i++ ) {
+			unsigned int first = i*band_limit;
+			unsigned int rows = height - first < band_limit ? height - first : band_limit;
+
+			if ( reuse && (dirty_width == 0 || dirty_height == 0 || first > dirty_y + dirty_height || first + rows <= dirty_y) ) {
+				if ( stats )
+					stats->bands_reused++;
+
+				continue;
+			}
+
+			LTPNGBand *b = filter_band(pixels, format, stride, first, rows);
+
+			b->options = options;
+			b->first = i == 0;
+			b->last = i == count - 1;
+			bands.push_back(b);
+			pending.push_back(i);
+
+			if ( threads > 1 )
+				start_band(b);
+			else
+				compress_band(b);
+
+			while ( bands.size() > (threads > 1 ? threads : 0) ) {
+				cache_band(bands.front(), pending.front());
+				bands.pop_front();
+				pending.pop_front();
+			}
+		}
+
+		while ( !bands.empty() ) {
+			cache_band(bands.front(), pending.front());
+			bands.pop_front();
+			pending.pop_front();
+		}
+
+		/** Splice the bands together as IDAT chunks, the last carrying the Adler-32 of the whole stream per 10.1 */
+		unsigned int adler = adler32(0L, Z_NULL, 0);
+
+		for ( i = 0; i < count; i++ ) {
+			LTPNGCachedBand &cached = band_cache[i];
+			unsigned int data_crc = cached.crc;
+			size_t len = cached.out.size();
+
+			adler = adler32_combine(adler, cached.adler, cached.length);
+
+			if ( len + (i == count - 1 ? 4 : 0) > 0x7FFFFFFF )
+				throw "LTPNG::update_image(): compressed band exceeds the maximum chunk length, use fewer band rows";
+
+			if ( i == count - 1 ) {
+				unsigned char trailer[4] = { (unsigned char) (adler >> 24), (unsigned char) (adler >> 16), (unsigned char) (adler >> 8), (unsigned char) adler };
+
+				cached.out.insert(cached.out.end(), trailer, trailer + 4);
+				data_crc = crc_combine(data_crc, update_crc(0xffffffffL, trailer, 4) ^ 0xffffffffL, 4);
+			}
+
+			write_data_chunk(cached.out.data(), cached.out.size(), data_crc);
+			file_size += cached.out.size();
+
+			/** The trailer changes with every image, so the cache keeps the band without it */
+			cached.out.resize(len);
+		}
+	} catch ( ... ) {
+		/** The cache may no longer match any image, and abort_image() waits for the bands still in flight */
+		band_cache.clear();
+		throw;
+	}
+
+	rows_written = height;
+
+	/** Write the IEND end chunk per 11.2.5 */
+	write_end_chunk();
+	flush_output();
+
+	if ( stats )
+		finish_stats();
+
+	in_progress = 0;
+}
+
+/** Drop the compressed bands kept from the last incremental image, so the next one is compressed in full */
+void LTPNG::clear_band_cache() {
+	vector<LTPNGCachedBand>().swap(band_cache);
+}
+
+/**
+ * Check the band cache holds count bands encoded the way this image would be, or else empty it and record how this
+ * image is encoded so its bands can be cached
+ */
+bool LTPNG::band_cache_matches(unsigned int count) {
+	if ( band_cache.size() == count && cache_width == width && cache_height == height && cache_rows == band_limit && cache_depth == output_bit_depth && cache_type == output_colour_type && cache_filter == filter_type && cache_options.level == options.level && cache_options.strategy == options.strategy && cache_options.mem_level == options.mem_level && cache_options.window_bits == options.window_bits )
+		return true;
+
+	band_cache.assign(count, LTPNGCachedBand());
+	cache_width = width;
+	cache_height = height;
+	cache_rows = band_limit;
+	cache_depth = output_bit_depth;
+	cache_type = output_colour_type;
+	cache_filter = filter_type;
+	cache_options = options;
+
+	return false;
+}
+
+/**
+ * Filter rows rows of the caller's pixels from row first into a new band, filtering the first against the row above
+ * it as the whole image would, or against zeros at the top of the image per 9.2
+ */
+LTPNGBand *LTPNG::filter_band(const unsigned char *pixels, unsigned char format, size_t stride, unsigned int first, unsigned int rows) {
+	unsigned char channels = format_channels(format);
+	unsigned char depth = format == PIXELS_RGB8 || format == PIXELS_RGBA8 || format == PIXELS_GREY8 || format == PIXELS_GREYA8 ? 8 : 16;
+	bool direct = depth == bit_depth && channels == channel_count(colour_type);
+	const unsigned char *src = pixels + (size_t) first*stride;
+	unsigned int row;
+
+	if ( first == 0 ) {
+		memset(prior_row, 0, row_size);
+		prior = prior_row;
+	} else if ( direct ) {
+		prior = src - stride;
+	} else {
+		pack_row(src - stride, format, prior_row);
+		prior = prior_row;
+	}
+
+	band = new LTPNGBand;
+	band->in.reserve((size_t) rows*(row_size + 1));
+
+	/** Every row is passed as the last so compress_row() only gathers the band and never sends it off itself */
+	for ( row = 0; row < rows; row++, src += stride ) {
+		if ( direct ) {
+			compress_row(src, true);
+		} else {
+			double start = stats ? stats_clock() : 0;
+
+			pack_row(src, format, current_row);
+
+			if ( stats ) {
+				stats->pack_seconds += stats_clock() - start;
+				stats->pack_in += (unsigned long long) width*channels*depth/8;
+				stats->pack_out += row_size;
+			}
+
+			compress_row(current_row, true);
+		}
+	}
+
+	LTPNGBand *filled = band;
+
+	band = NULL;
+
+	return filled;
+}
+
+/** Wait for a band to finish compressing and keep its output in the band cache in place of what was there */
+void LTPNG::cache_band(LTPNGBand *b, unsigned int index) {
+	/** Any error thrown on the worker comes back out here */
+	if ( b->done.valid() )
+		b->done.get();
+
+	LTPNGCachedBand &cached = band_cache[index];
+
+	cached.out.swap(b->out);
+	cached.adler = b->adler;
+	cached.crc = b->crc;
+	cached.length = b->in.size();
+
+	if ( stats ) {
+		stats->deflate_seconds += b->deflate_seconds;
+		stats->crc_seconds += b->crc_seconds;
+		stats->crc_bytes += cached.out.size();
+		stats->bands_encoded++;
+	}
+
+	delete b;
+}
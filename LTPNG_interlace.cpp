@@ -0,0 +1,89 @@
+/**
+ * Lowe Technologies PNG Encoder (LTPNG)
+ *
+ * Adam7 interlacing per 8.2.  Every pass takes pixels from across the whole image, so the rows of an interlaced
+ * image are held in the output format as they are pushed, and end_image() pulls each pass out of them a row at a
+ * time, filtering and compressing every reduced image the same way as the rows of a plain one.
+ *
+ * @author Rich Lowe
+ * @version See LTPNG.cpp for revision and revision history
+ */
+
+/** Header includes */
+#include <cstring>
+#include "LTPNG.h"
+
+using namespace std;
+
+/** Starting column and row, and column and row spacing, of each of the seven passes per figure 8.3 */
+const unsigned char LTPNG::adam7[7][4] = {
+	{ 0, 0, 8, 8 },
+	{ 4, 0, 8, 8 },
+	{ 0, 4, 4, 8 },
+	{ 2, 0, 4, 4 },
+	{ 0, 2, 2, 4 },
+	{ 1, 0, 2, 2 },
+	{ 0, 1, 1, 2 }
+};
+
+/** Write the seven passes of the held image, each a reduced image whose scanlines are filtered from a zero prior row */
+void LTPNG::encode_passes() {
+	unsigned int bits = channel_count(output_colour_type)*output_bit_depth;
+	unsigned int full_row_size = row_size;
+	unsigned int pass_width[7], pass_height[7];
+	unsigned int pass, row, rows_left = 0;
+
+	/** Work out the size of each pass, passes with no pixels have no scanlines at all per 8.2 */
+	for ( pass = 0; pass < 7; pass++ ) {
+		pass_width[pass] = width > adam7[pass][0] ? (width - adam7[pass][0] + adam7[pass][2] - 1)/adam7[pass][2] : 0;
+		pass_height[pass] = height > adam7[pass][1] ? (height - adam7[pass][1] + adam7[pass][3] - 1)/adam7[pass][3] : 0;
+
+		if ( pass_width[pass] )
+			rows_left += pass_height[pass];
+	}
+
+	for ( pass = 0; pass < 7; pass++ ) {
+		if ( !pass_width[pass] || !pass_height[pass] )
+			continue;
+
+		/** Each pass is filtered as an image of its own, starting from a prior row of zeros */
+		row_size = ((unsigned long long) pass_width[pass]*bits + 7)/8;
+		memset(prior_row, 0, row_size);
+		prior = prior_row;
+
+		for ( row = 0; row < pass_height[pass]; row++ ) {
+			const unsigned char *image_row = image_rows + (size_t) (adam7[pass][1] + row*adam7[pass][3])*full_row_size;
+
+			interlace_row(current_row, image_row, pass_width[pass], adam7[pass][0], adam7[pass][2]);
+			compress_row(current_row, --rows_left == 0);
+		}
+	}
+
+	row_size = full_row_size;
+}
+
+/** Gather count pixels of a held row, starting at column start and spaced step apart, into one pass scanline */
+void LTPNG::interlace_row(unsigned char *out, const unsigned char *image_row, unsigned int count, unsigned int start, unsigned int step) {
+	unsigned int bits = channel_count(output_colour_type)*output_bit_depth;
+	unsigned int col, x;
+
+	/** Whole-byte pixels are copied as they are */
+	if ( bits >= 8 ) {
+		for ( col = 0, x = start; col < count; col++, x += step )
+			memcpy(out + col*pixel_size, image_row + x*pixel_size, pixel_size);
+
+		return;
+	}
+
+	/** Pixels under 8 bits are picked out of their bytes and repacked leftmost pixel first per 7.2 */
+	unsigned int per_byte = 8/bits;
+	unsigned char mask = (1 << bits) - 1;
+	unsigned char value;
+
+	memset(out, 0, (count*bits + 7)/8);
+
+	for ( col = 0, x = start; col < count; col++, x += step ) {
+		value = (image_row[x/per_byte] >> (8 - bits*(x % per_byte + 1))) & mask;
+		out[col/per_byte] |= value << (8 - bits*(col % per_byte + 1));
+	}
+}
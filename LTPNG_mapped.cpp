@@ -0,0 +1,141 @@
+/**
+ * Lowe Technologies PNG Encoder (LTPNG)
+ *
+ * Out-of-core encoding from raw interleaved pixels in a file.  The file is mapped into memory a band of rows at a
+ * time and each band is pushed through write_rows() like pixels in memory, so only one band is ever mapped and the
+ * file is read front to back once per pass.  Files that cannot be mapped are read into a band buffer with pread().
+ *
+ * @author Rich Lowe
+ * @version See LTPNG.cpp for revision and revision history
+ */
+
+/** Header includes */
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "LTPNG.h"
+
+using namespace std;
+
+/** Create a PNG image of set size from raw pixels in one of the PIXELS_* formats held in a file, written to a file stream */
+void LTPNG::create_image_from_file(ofstream &file, unsigned int pixel_width, unsigned int pixel_height, const char *path, unsigned char format, unsigned long long offset, size_t stride) {
+	use_file(file);
+	create_image_from_file(file_sink, pixel_width, pixel_height, path, format, offset, stride);
+	image = &file;
+}
+
+/**
+ * Create a PNG image of set size from raw pixels in one of the PIXELS_* formats held in a file, starting offset
+ * bytes in with rows stride bytes apart (0 for tightly packed rows), written to a sink.  With reduce set, the file
+ * is read through twice, once to analyse it and once to encode it
+ */
+void LTPNG::create_image_from_file(LTPNGSink &out, unsigned int pixel_width, unsigned int pixel_height, const char *path, unsigned char format, unsigned long long offset, size_t stride) {
+	int fd = open(path, O_RDONLY);
+
+	if ( fd < 0 )
+		throw "LTPNG::create_image_from_file(): could not open the raw pixel file";
+
+	try {
+		if ( reduce ) {
+			begin_analysis(pixel_width, pixel_height, bit_depth, colour_type);
+			write_file_rows(pixel_height, fd, format, offset, stride);
+			end_analysis();
+		}
+
+		begin_image(out, pixel_width, pixel_height, bit_depth, colour_type);
+		write_file_rows(pixel_height, fd, format, offset, stride);
+		end_image();
+	} catch ( ... ) {
+		close(fd);
+		throw;
+	}
+
+	close(fd);
+}
+
+/**
+ * Push the next rows of the image in progress from raw pixels in one of the PIXELS_* formats in an open file,
+ * starting offset bytes in with rows stride bytes apart (0 for tightly packed rows).  Up to map_size bytes of rows
+ * are mapped at once, and each band is unmapped before the next so the pages it used can go back to the page cache
+ */
+void LTPNG::write_file_rows(unsigned int rows, int fd, unsigned char format, unsigned long long offset, size_t stride) {
+	if ( !in_progress )
+		throw "LTPNG::write_file_rows(): begin_image() must be called first";
+
+	if ( rows > height - rows_written )
+		throw "LTPNG::write_file_rows(): more rows written than the image height";
+
+	if ( format > PIXELS_GREYA16BE )
+		throw "LTPNG::write_file_rows(): invalid pixel format";
+
+	if ( rows == 0 )
+		return;
+
+	unsigned char depth = format == PIXELS_RGB8 || format == PIXELS_RGBA8 || format == PIXELS_GREY8 || format == PIXELS_GREYA8 ? 8 : 16;
+	size_t row_bytes = (size_t) width*format_channels(format)*depth/8;
+
+	if ( stride == 0 )
+		stride = row_bytes;
+
+	/** Reading past the end of a mapped file faults rather than failing, so the whole span is checked up front */
+	struct stat info;
+	unsigned long long span = (unsigned long long) (rows - 1)*stride + row_bytes;
+
+	if ( fstat(fd, &info) != 0 )
+		throw "LTPNG::write_file_rows(): could not read the raw pixel file";
+
+	if ( offset + span > (unsigned long long) info.st_size )
+		throw "LTPNG::write_file_rows(): raw pixel file is too short for the rows asked for";
+
+	/** Tell the kernel the file is read front to back, so it reads ahead and drops pages behind */
+	posix_fadvise(fd, offset, span, POSIX_FADV_SEQUENTIAL);
+
+	/** Bands are whole rows, at least one even if a single row is larger than map_size */
+	unsigned int per_band = map_size/stride > rows ? rows : map_size/stride > 0 ? map_size/stride : 1;
+	unsigned long long page = sysconf(_SC_PAGESIZE);
+	vector<unsigned char> buffer;
+
+	while ( rows > 0 ) {
+		unsigned int count = rows < per_band ? rows : per_band;
+		size_t len = (size_t) (count - 1)*stride + row_bytes;
+
+		/** Mappings start on a page boundary, so map from the page holding the first row */
+		unsigned long long start = offset - offset % page;
+		size_t lead = offset - start;
+		void *map = mmap(NULL, lead + len, PROT_READ, MAP_PRIVATE, fd, start);
+
+		if ( map != MAP_FAILED ) {
+			madvise(map, lead + len, MADV_SEQUENTIAL);
+
+			try {
+				write_rows(count, (unsigned char *) map + lead, format, stride);
+			} catch ( ... ) {
+				munmap(map, lead + len);
+				throw;
+			}
+
+			/** write_rows() has kept its own copy of the last row, so nothing points into the band any more */
+			munmap(map, lead + len);
+		} else {
+			size_t done = 0;
+
+			buffer.resize(len);
+
+			while ( done < len ) {
+				ssize_t got = pread(fd, buffer.data() + done, len - done, offset + done);
+
+				if ( got <= 0 )
+					throw "LTPNG::write_file_rows(): could not read the raw pixel file";
+
+				done += got;
+			}
+
+			write_rows(count, buffer.data(), format, stride);
+		}
+
+		offset += (unsigned long long) count*stride;
+		rows -= count;
+	}
+}
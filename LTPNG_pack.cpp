@@ -0,0 +1,126 @@
+/**
+ * Lowe Technologies PNG Encoder (LTPNG)
+ *
+ * Row packing kernels, turning the caller's pixels into scanlines in PNG byte order.  Each kernel is a template
+ * instantiated for one source layout, bit depth, and channel count, so the loop over a row has no branches left in
+ * it and the compiler can unroll the channels of a pixel; the kernel is picked once per call to write_rows().  The
+ * generic loops they replace are kept in png_bench as references, which the kernels must match byte for byte.
+ *
+ * @author Rich Lowe
+ * @version See LTPNG.cpp for revision and revision history
+ */
+
+/** Header includes */
+#include "LTPNG.h"
+
+using namespace std;
+
+/**
+ * Store one sample from a channel as OutBytes bytes, 16-bit samples most significant byte first.  8-bit samples
+ * written at 16 bits repeat in both bytes so 0xFF becomes 0xFFFF, and 16-bit samples written at 8 bits keep only
+ * their low byte, as write_rows() always has
+ */
+template <typename Sample, unsigned int OutBytes>
+static inline void put_sample(unsigned char *out, Sample value) {
+	if ( OutBytes == 2 ) {
+		out[0] = sizeof(Sample) == 2 ? value >> 8 : value;
+		out[1] = value & 0xFF;
+	} else {
+		out[0] = value;
+	}
+}
+
+/** Pack count pixels from channels of Sample values starting at pixel first, grey taken from red */
+template <typename Sample, unsigned int OutBytes, bool Colour, bool Alpha>
+static void pack_planes(unsigned char *out, const void *red, const void *green, const void *blue, const void *alpha, size_t first, unsigned int count) {
+	const Sample *r = (const Sample *) red + first;
+	const Sample *g = Colour ? (const Sample *) green + first : NULL;
+	const Sample *b = Colour ? (const Sample *) blue + first : NULL;
+	const Sample *a = Alpha ? (const Sample *) alpha + first : NULL;
+	const unsigned int step = ((Colour ? 3 : 1) + (Alpha ? 1 : 0))*OutBytes;
+	unsigned int col;
+
+	for ( col = 0; col < count; col++, out += step ) {
+		put_sample<Sample, OutBytes>(out, r[col]);
+
+		if ( Colour ) {
+			put_sample<Sample, OutBytes>(out + OutBytes, g[col]);
+			put_sample<Sample, OutBytes>(out + 2*OutBytes, b[col]);
+		}
+
+		if ( Alpha )
+			put_sample<Sample, OutBytes>(out + step - OutBytes, a[col]);
+	}
+}
+
+/**
+ * Pack count pixels interleaved with InChannels samples of InBytes bytes into OutChannels samples of OutBytes bytes.
+ * Grey fills each colour channel, missing alpha is fully opaque, and 8-bit samples scale up by repeating in both
+ * bytes while 16-bit samples scale down to their most significant byte
+ */
+template <unsigned int InChannels, unsigned int InBytes, unsigned int OutChannels, unsigned int OutBytes>
+static void pack_pixels(unsigned char *out, const unsigned char *src, unsigned int count) {
+	const unsigned int in_colour = InChannels >= 3 ? 3 : 1, out_colour = OutChannels >= 3 ? 3 : 1;
+	unsigned int col, channel;
+
+	for ( col = 0; col < count; col++, src += InChannels*InBytes, out += OutChannels*OutBytes ) {
+		for ( channel = 0; channel < OutChannels; channel++ ) {
+			const unsigned int sample = channel < out_colour ? (in_colour == 1 ? 0 : channel) : in_colour;
+
+			out[channel*OutBytes] = sample < InChannels ? src[sample*InBytes] : 0xFF;
+
+			if ( OutBytes == 2 )
+				out[channel*OutBytes + 1] = sample < InChannels ? src[sample*InBytes + InBytes - 1] : 0xFF;
+		}
+	}
+}
+
+/** Kernels from one interleaved source layout to every image channel count and bit depth */
+template <unsigned int InChannels, unsigned int InBytes>
+static LTPNGPixelsKernel pixels_kernel(unsigned char out_channels, unsigned char out_bytes) {
+	static const LTPNGPixelsKernel kernels[4][2] = {
+		{ pack_pixels<InChannels, InBytes, 1, 1>, pack_pixels<InChannels, InBytes, 1, 2> },
+		{ pack_pixels<InChannels, InBytes, 2, 1>, pack_pixels<InChannels, InBytes, 2, 2> },
+		{ pack_pixels<InChannels, InBytes, 3, 1>, pack_pixels<InChannels, InBytes, 3, 2> },
+		{ pack_pixels<InChannels, InBytes, 4, 1>, pack_pixels<InChannels, InBytes, 4, 2> }
+	};
+
+	return kernels[out_channels - 1][out_bytes - 1];
+}
+
+/** Kernels from channels of one sample type to every colour type and bit depth */
+template <typename Sample>
+static LTPNGPlanesKernel planes_kernel(unsigned char type, unsigned char out_bytes) {
+	static const LTPNGPlanesKernel kernels[2][2][2] = {
+		{ { pack_planes<Sample, 1, false, false>, pack_planes<Sample, 1, false, true> },
+		  { pack_planes<Sample, 1, true, false>, pack_planes<Sample, 1, true, true> } },
+		{ { pack_planes<Sample, 2, false, false>, pack_planes<Sample, 2, false, true> },
+		  { pack_planes<Sample, 2, true, false>, pack_planes<Sample, 2, true, true> } }
+	};
+
+	return kernels[out_bytes - 1][(type & 2) != 0][(type & 4) != 0];
+}
+
+/** The kernel packing interleaved pixels in one of the PIXELS_* formats into rows of this image's depth and colour type */
+LTPNGPixelsKernel LTPNG::pixels_packer(unsigned char format) {
+	unsigned char channels = channel_count(colour_type), bytes = bit_depth/8;
+
+	switch ( format ) {
+		case PIXELS_RGB8: return pixels_kernel<3, 1>(channels, bytes);
+		case PIXELS_RGBA8: return pixels_kernel<4, 1>(channels, bytes);
+		case PIXELS_RGB16BE: return pixels_kernel<3, 2>(channels, bytes);
+		case PIXELS_RGBA16BE: return pixels_kernel<4, 2>(channels, bytes);
+		case PIXELS_GREY8: return pixels_kernel<1, 1>(channels, bytes);
+		case PIXELS_GREYA8: return pixels_kernel<2, 1>(channels, bytes);
+		case PIXELS_GREY16BE: return pixels_kernel<1, 2>(channels, bytes);
+		default: return pixels_kernel<2, 2>(channels, bytes);
+	}
+}
+
+/** The kernel packing channels of 8-bit (1) or 16-bit (2) samples into rows of this image's depth and colour type */
+LTPNGPlanesKernel LTPNG::planes_packer(unsigned char sample_bytes) {
+	if ( sample_bytes == 2 )
+		return planes_kernel<unsigned short>(colour_type, bit_depth/8);
+
+	return planes_kernel<unsigned char>(colour_type, bit_depth/8);
+}
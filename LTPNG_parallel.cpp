@@ -0,0 +1,223 @@
+/**
+ * Lowe Technologies PNG Encoder (LTPNG)
+ *
+ * Parallel deflate.  Filtered scanlines are gathered into bands, each band is compressed on one of a fixed pool
+ * of worker threads kept by the encoder, as a raw deflate stream primed with the tail of the band before it and
+ * ended at a sync flush boundary, and the bands are written out in order as IDAT chunks, together forming one
+ * standard zlib stream per 10.1.
+ *
+ * @author Rich Lowe
+ * @version See LTPNG.cpp for revision and revision history
+ */
+
+/** Header includes */
+#include <algorithm>
+#include "LTPNG.h"
+
+using namespace std;
+
+/** Send the band being filled off to a worker, writing out the oldest bands until no more than threads are in flight */
+void LTPNG::dispatch_band(bool last) {
+	LTPNGBand *next = NULL;
+	
+	/** Every band after the first has the previous band's tail as its dictionary */
+	band->options = options;
+	band->first = band->dict.empty();
+	band->last = last;
+	
+	/** The next band may refer back a whole window into this one, so give it a copy as its dictionary */
+	if ( !last ) {
+		size_t keep = min(band->in.size(), (size_t) 1 << options.window_bits);
+		
+		next = new LTPNGBand;
+		next->in.reserve(band->in.capacity());
+		next->dict.assign(band->in.end() - keep, band->in.end());
+	}
+	
+	start_band(band);
+	bands.push_back(band);
+	band = next;
+	
+	while ( bands.size() > threads ) {
+		write_band(bands.front());
+		bands.pop_front();
+	}
+}
+
+/** Hand a band to the worker pool to compress, first starting a pool of threads workers if there is not one already */
+void LTPNG::start_band(LTPNGBand *b) {
+	if ( !workers || workers->size() != threads ) {
+		delete workers;
+		workers = new LTPNGWorkers(threads);
+	}
+	
+	b->done = workers->run([b]() { compress_band(b); });
+}
+
+/** Wait for a band to finish compressing and write it out as one IDAT chunk */
+void LTPNG::write_band(LTPNGBand *b) {
+	/** Any error thrown on the worker comes back out here */
+	b->done.get();
+	
+	stream_adler = adler32_combine(stream_adler, b->adler, b->in.size());
+	
+	/** Time spent on the worker goes into the statistics as it would have been spent here */
+	if ( stats ) {
+		stats->deflate_seconds += b->deflate_seconds;
+		stats->crc_seconds += b->crc_seconds;
+		stats->crc_bytes += b->out.size();
+	}
+	
+	/** The last band carries the Adler-32 of the whole stream per 10.1 */
+	if ( b->last ) {
+		unsigned char trailer[4] = { (unsigned char) (stream_adler >> 24), (unsigned char) (stream_adler >> 16), (unsigned char) (stream_adler >> 8), (unsigned char) stream_adler };
+		
+		b->out.insert(b->out.end(), trailer, trailer + 4);
+		b->crc = crc_combine(b->crc, update_crc(0xffffffffL, trailer, 4) ^ 0xffffffffL, 4);
+	}
+	
+	if ( b->out.size() > 0x7FFFFFFF )
+		throw "LTPNG::write_band(): compressed band exceeds the maximum chunk length, use fewer band rows";
+	
+	write_data_chunk(b->out.data(), b->out.size(), b->crc);
+	file_size += b->out.size();
+	
+	delete b;
+}
+
+/** Compress one band as a raw deflate stream on a worker thread, along with its Adler-32 and the CRC-32 of the output */
+void LTPNG::compress_band(LTPNGBand *b) {
+	z_stream s;
+	size_t header = b->first ? 2 : 0;
+	double start = stats_clock();
+	int ret;
+	
+	/** Allocate deflate state */
+	s.zalloc = Z_NULL;
+	s.zfree = Z_NULL;
+	s.opaque = Z_NULL;
+	
+	/** Initialize a raw deflate stream, the zlib header and trailer are added around the bands */
+	ret = deflateInit2(&s, b->options.level, Z_DEFLATED, -b->options.window_bits, b->options.mem_level, b->options.strategy);
+	
+	/** Handle any errors */
+	if ( ret != Z_OK ) {
+		switch ( ret ) {
+			case Z_MEM_ERROR: throw "LTPNG::compress_band(): not enough memory for deflateInit2()";
+			case Z_STREAM_ERROR: throw "LTPNG::compress_band(): deflateInit2() received invalid parameters";
+			case Z_VERSION_ERROR: throw "LTPNG::compress_band(): zlib library version is incompatible with the version of deflateInit2() assumed";
+			default: throw "LTPNG::compress_band(): unknown error on deflateInit2()";
+		}
+	}
+	
+	if ( !b->dict.empty() )
+		deflateSetDictionary(&s, b->dict.data(), b->dict.size());
+	
+	/** Leave room for the worst case, plus the empty stored block a sync flush ends with */
+	b->out.resize(header + deflateBound(&s, b->in.size()) + 16);
+	
+	/** The first band leads with the 2-byte zlib header per 10.1 */
+	if ( b->first ) {
+		unsigned short zlib = zlib_header(b->options);
+		
+		b->out[0] = zlib >> 8;
+		b->out[1] = zlib & 0xFF;
+	}
+	
+	s.next_in = b->in.data();
+	s.avail_in = b->in.size();
+	s.next_out = b->out.data() + header;
+	s.avail_out = b->out.size() - header;
+	
+	/** The last band finishes the deflate stream, the others end byte aligned so the next band can follow on */
+	for ( ;; ) {
+		ret = deflate(&s, b->last ? Z_FINISH : Z_SYNC_FLUSH);
+		
+		if ( ret == Z_STREAM_ERROR ) {
+			deflateEnd(&s);
+			throw "LTPNG::compress_band(): deflate() stream state was inconsistent";
+		}
+		
+		if ( b->last ? ret == Z_STREAM_END : s.avail_out > 0 )
+			break;
+		
+		/** Grow the output if the bound was somehow not enough */
+		size_t used = b->out.size() - s.avail_out;
+		
+		b->out.resize(b->out.size()*2);
+		s.next_out = b->out.data() + used;
+		s.avail_out = b->out.size() - used;
+	}
+	
+	b->out.resize(header + s.total_out);
+	deflateEnd(&s);
+	
+	b->adler = adler32_z(adler32(0L, Z_NULL, 0), b->in.data(), b->in.size());
+	b->deflate_seconds = stats_clock() - start;
+	
+	start = stats_clock();
+	b->crc = update_crc(0xffffffffL, b->out.data(), b->out.size()) ^ 0xffffffffL;
+	b->crc_seconds = stats_clock() - start;
+}
+
+/** Start a pool of count worker threads, which wait for tasks until the pool is destroyed */
+LTPNGWorkers::LTPNGWorkers(unsigned int count) {
+	stop = false;
+	
+	for ( unsigned int i = 0; i < count; i++ )
+		pool.push_back(thread(&LTPNGWorkers::work, this));
+}
+
+/** Let the workers finish every task already handed to them, then join them */
+LTPNGWorkers::~LTPNGWorkers() {
+	{
+		lock_guard<mutex> guard(lock);
+		stop = true;
+	}
+	
+	changed.notify_all();
+	
+	for ( thread &worker : pool )
+		worker.join();
+}
+
+/** Queue a task for the next free worker, returning a future that holds any error it throws */
+future<void> LTPNGWorkers::run(function<void ()> task) {
+	packaged_task<void ()> job(task);
+	future<void> done = job.get_future();
+	
+	{
+		lock_guard<mutex> guard(lock);
+		tasks.push_back(move(job));
+	}
+	
+	changed.notify_one();
+	
+	return done;
+}
+
+/** Number of worker threads in the pool */
+unsigned int LTPNGWorkers::size() {
+	return pool.size();
+}
+
+/** Run tasks oldest first as they are queued, until the pool is stopped and no tasks are left */
+void LTPNGWorkers::work() {
+	for ( ;; ) {
+		packaged_task<void ()> job;
+		
+		{
+			unique_lock<mutex> guard(lock);
+			
+			changed.wait(guard, [this]() { return stop || !tasks.empty(); });
+			
+			if ( tasks.empty() )
+				return;
+			
+			job = move(tasks.front());
+			tasks.pop_front();
+		}
+		
+		job();
+	}
+}
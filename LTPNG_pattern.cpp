@@ -0,0 +1,397 @@
+/**
+ * Lowe Technologies PNG Encoder (LTPNG)
+ *
+ * Compiled channel patterns.  A pattern is an expression of the gradient ramps, x and y, numbers, the four
+ * arithmetic operators, and sin, cos, abs, and sqrt, compiled once into a list of instructions and then run over
+ * whole rows of values with SSE2 on x86-64.  Each instruction knows whether it varies along a row, down the image,
+ * or both, so x terms are worked out once per image, y terms once per row, and only the rest once per pixel.
+ * Values are doubles so the ramps come out exactly as LTPNG::ramp_n() and the rest do.
+ *
+ * @author Rich Lowe
+ * @version See LTPNG.cpp for revision and revision history
+ */
+
+/** Header includes */
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include "LTPNG.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define LTPNG_PATTERN_SIMD 1
+#endif
+
+using namespace std;
+
+#ifdef LTPNG_PATTERN_SIMD
+/** Two values of an operand, which is either a row of values (step 1) or one value for the whole row (step 0) */
+static inline __m128d load_pair(const double *values, unsigned int step, unsigned int i) {
+	return step ? _mm_loadu_pd(values + i) : _mm_set1_pd(values[0]);
+}
+#endif
+
+/** Apply an arithmetic operator to n values of two operands, either of which may be one value for the whole row */
+static void combine(unsigned char code, double *out, const double *a, unsigned int a_step, const double *b, unsigned int b_step, unsigned int n) {
+	unsigned int i = 0;
+
+#ifdef LTPNG_PATTERN_SIMD
+	switch ( code ) {
+		case LTPNGPattern::OP_ADD:
+			for ( ; i + 2 <= n; i += 2 )
+				_mm_storeu_pd(out + i, _mm_add_pd(load_pair(a, a_step, i), load_pair(b, b_step, i)));
+			break;
+		case LTPNGPattern::OP_SUBTRACT:
+			for ( ; i + 2 <= n; i += 2 )
+				_mm_storeu_pd(out + i, _mm_sub_pd(load_pair(a, a_step, i), load_pair(b, b_step, i)));
+			break;
+		case LTPNGPattern::OP_MULTIPLY:
+			for ( ; i + 2 <= n; i += 2 )
+				_mm_storeu_pd(out + i, _mm_mul_pd(load_pair(a, a_step, i), load_pair(b, b_step, i)));
+			break;
+		default:
+			for ( ; i + 2 <= n; i += 2 )
+				_mm_storeu_pd(out + i, _mm_div_pd(load_pair(a, a_step, i), load_pair(b, b_step, i)));
+	}
+#endif
+
+	for ( ; i < n; i++ ) {
+		double x = a[i*a_step], y = b[i*b_step];
+
+		switch ( code ) {
+			case LTPNGPattern::OP_ADD: out[i] = x + y; break;
+			case LTPNGPattern::OP_SUBTRACT: out[i] = x - y; break;
+			case LTPNGPattern::OP_MULTIPLY: out[i] = x*y; break;
+			default: out[i] = x/y;
+		}
+	}
+}
+
+/** Compile a pattern */
+LTPNGPattern::LTPNGPattern(const string &pattern) {
+	width = 0;
+	height = 0;
+	compile(pattern);
+}
+
+/**
+ * Compile a pattern from an expression such as "se" or "0.5*ramp_se + 0.5*sin(6.28*x)", throwing if it is not
+ * one.  The ramps n, e, s, w, nw, ne, se, and sw (or ramp_n and so on) rise from 0 to 1 towards their edge or
+ * corner as LTPNG::ramp_n() and the rest do, full, half, and none are 1, 0.5, and 0, and x and y run from 0 at
+ * the west and north edges towards 1 at the east and south
+ */
+void LTPNGPattern::compile(const string &pattern) {
+	program.clear();
+	source = pattern;
+	position = 0;
+
+	parse_sum();
+
+	while ( position < source.size() && isspace((unsigned char) source[position]) )
+		position++;
+
+	if ( position < source.size() )
+		throw "LTPNGPattern::compile(): unexpected character in pattern";
+
+	width = 0;
+	height = 0;
+}
+
+/** Returns true if a pattern compiles */
+bool LTPNGPattern::valid(const string &pattern) {
+	try {
+		LTPNGPattern compiled(pattern);
+	} catch ( const char * ) {
+		return false;
+	}
+
+	return true;
+}
+
+/** Skip spaces and take the next character if it is the one given */
+bool LTPNGPattern::accept(char c) {
+	while ( position < source.size() && isspace((unsigned char) source[position]) )
+		position++;
+
+	if ( position < source.size() && source[position] == c ) {
+		position++;
+		return true;
+	}
+
+	return false;
+}
+
+/** sum := product (('+' | '-') product)* */
+unsigned int LTPNGPattern::parse_sum() {
+	unsigned int left = parse_product();
+
+	while ( true ) {
+		if ( accept('+') )
+			left = emit(OP_ADD, left, parse_product());
+		else if ( accept('-') )
+			left = emit(OP_SUBTRACT, left, parse_product());
+		else
+			return left;
+	}
+}
+
+/** product := unary (('*' | '/') unary)* */
+unsigned int LTPNGPattern::parse_product() {
+	unsigned int left = parse_unary();
+
+	while ( true ) {
+		if ( accept('*') )
+			left = emit(OP_MULTIPLY, left, parse_unary());
+		else if ( accept('/') )
+			left = emit(OP_DIVIDE, left, parse_unary());
+		else
+			return left;
+	}
+}
+
+/** unary := '-' unary | primary */
+unsigned int LTPNGPattern::parse_unary() {
+	if ( accept('-') )
+		return emit(OP_NEGATE, parse_unary());
+
+	return parse_primary();
+}
+
+/** primary := number | name | function '(' sum ')' | '(' sum ')' */
+unsigned int LTPNGPattern::parse_primary() {
+	unsigned int operand;
+
+	if ( accept('(') ) {
+		operand = parse_sum();
+
+		if ( !accept(')') )
+			throw "LTPNGPattern::compile(): missing ) in pattern";
+
+		return operand;
+	}
+
+	if ( position >= source.size() )
+		throw "LTPNGPattern::compile(): pattern ends too soon";
+
+	const char *start = source.c_str() + position;
+
+	if ( isdigit((unsigned char) *start) || *start == '.' ) {
+		char *end;
+		double value = strtod(start, &end);
+
+		position += end - start;
+		return emit(OP_NUMBER, 0, 0, value);
+	}
+
+	string name;
+
+	while ( position < source.size() && (isalnum((unsigned char) source[position]) || source[position] == '_') )
+		name += source[position++];
+
+	if ( name.compare(0, 5, "ramp_") == 0 )
+		name = name.substr(5);
+
+	/** The ramps per LTPNG::ramp_n() and the rest, diagonals counting rows and columns from the edges their a bits flip */
+	if ( name == "x" || name == "e" ) return emit(OP_X);
+	if ( name == "y" || name == "s" ) return emit(OP_Y);
+	if ( name == "w" ) return emit(OP_SUBTRACT, emit(OP_NUMBER, 0, 0, 1), emit(OP_X));
+	if ( name == "n" ) return emit(OP_SUBTRACT, emit(OP_NUMBER, 0, 0, 1), emit(OP_Y));
+	if ( name == "se" ) return emit(OP_DIAGONAL, 0);
+	if ( name == "sw" ) return emit(OP_DIAGONAL, 1);
+	if ( name == "ne" ) return emit(OP_DIAGONAL, 2);
+	if ( name == "nw" ) return emit(OP_DIAGONAL, 3);
+	if ( name == "full" ) return emit(OP_NUMBER, 0, 0, 1);
+	if ( name == "half" ) return emit(OP_NUMBER, 0, 0, 0.5);
+	if ( name == "none" ) return emit(OP_NUMBER, 0, 0, 0);
+	if ( name == "pi" ) return emit(OP_NUMBER, 0, 0, M_PI);
+
+	unsigned char code;
+
+	if ( name == "sin" ) code = OP_SIN;
+	else if ( name == "cos" ) code = OP_COS;
+	else if ( name == "abs" ) code = OP_ABS;
+	else if ( name == "sqrt" ) code = OP_SQRT;
+	else throw "LTPNGPattern::compile(): unknown name in pattern";
+
+	if ( !accept('(') )
+		throw "LTPNGPattern::compile(): missing ( after function in pattern";
+
+	operand = parse_sum();
+
+	if ( !accept(')') )
+		throw "LTPNGPattern::compile(): missing ) in pattern";
+
+	return emit(code, operand);
+}
+
+/** Add an instruction to the program, working out what it varies with from its operands */
+unsigned int LTPNGPattern::emit(unsigned char code, unsigned int a, unsigned int b, double value) {
+	LTPNGPatternOp op;
+
+	op.code = code;
+	op.a = a;
+	op.b = b;
+	op.value = value;
+	op.slot = 0;
+
+	switch ( code ) {
+		case OP_NUMBER: op.varies = 0; break;
+		case OP_X: op.varies = 1; break;
+		case OP_Y: op.varies = 2; break;
+		case OP_DIAGONAL: op.varies = 3; break;
+		case OP_ADD: case OP_SUBTRACT: case OP_MULTIPLY: case OP_DIVIDE: op.varies = program[a].varies | program[b].varies; break;
+		default: op.varies = program[a].varies;
+	}
+
+	program.push_back(op);
+	return program.size() - 1;
+}
+
+/**
+ * Start an image of width x height, giving each instruction that varies along a row a row of its own, and working
+ * out every instruction that does not vary down the image
+ */
+void LTPNGPattern::begin(unsigned int image_width, unsigned int image_height) {
+	size_t slots = 0;
+	unsigned int i;
+
+	width = image_width;
+	height = image_height;
+
+	for ( i = 0; i < program.size(); i++ )
+		if ( program[i].varies & 1 )
+			program[i].slot = (slots++)*width;
+
+	scalars.assign(program.size(), 0);
+	rows.resize(slots*width);
+
+	for ( i = 0; i < program.size(); i++ )
+		if ( !(program[i].varies & 2) )
+			evaluate(i, 0);
+}
+
+/**
+ * Fill a row of width samples with the pattern scaled to max_val, working out the instructions that vary down the
+ * image for this row.  Values are clamped to 0 to 1 first, so a formula straying outside them saturates
+ */
+void LTPNGPattern::fill_row(unsigned short *out, unsigned int row, unsigned int max_val) {
+	if ( width == 0 )
+		throw "LTPNGPattern::fill_row(): begin() must be called first";
+
+	const LTPNGPatternOp &result = program.back();
+	unsigned int i;
+
+	for ( i = 0; i < program.size(); i++ )
+		if ( program[i].varies & 2 )
+			evaluate(i, row);
+
+	/** A pattern that does not vary along the row is one sample repeated */
+	if ( !(result.varies & 1) ) {
+		double value = scalars.back();
+		unsigned short sample = max_val*(value > 0 ? (value < 1 ? value : 1) : 0);
+
+		for ( i = 0; i < width; i++ )
+			out[i] = sample;
+
+		return;
+	}
+
+	const double *values = rows.data() + result.slot;
+
+	/** Comparisons written so that NaN, such as the square root of a negative, comes out as 0 */
+	for ( i = 0; i < width; i++ ) {
+		double value = values[i] > 0 ? (values[i] < 1 ? values[i] : 1) : 0;
+
+		out[i] = max_val*value;
+	}
+}
+
+/** Work out one instruction for a row, as one value or a row of values depending on whether it varies along the row */
+void LTPNGPattern::evaluate(unsigned int index, unsigned int row) {
+	const LTPNGPatternOp &op = program[index];
+	unsigned int i = 0;
+
+	if ( !(op.varies & 1) ) {
+		scalars[index] = evaluate_scalar(op, row);
+		return;
+	}
+
+	double *out = rows.data() + op.slot;
+
+	/** Operands either have a row of their own or one value for the whole row */
+	const double *a = op.code >= OP_ADD ? (program[op.a].varies & 1 ? rows.data() + program[op.a].slot : &scalars[op.a]) : NULL;
+	const double *b = op.code >= OP_ADD && op.code <= OP_DIVIDE ? (program[op.b].varies & 1 ? rows.data() + program[op.b].slot : &scalars[op.b]) : NULL;
+
+	switch ( op.code ) {
+		case OP_X:
+			for ( i = 0; i < width; i++ )
+				out[i] = (double) i/width;
+			break;
+		case OP_DIAGONAL: {
+			/** (row + col)/(width + height) with the row counted up from the south edge and col from the east edge as flipped */
+			double base = (op.a & 2 ? (double) (height - row) : (double) row) + (op.a & 1 ? (double) width : 0);
+			double step = op.a & 1 ? -1 : 1;
+			double total = width + height;
+
+#ifdef LTPNG_PATTERN_SIMD
+			__m128d position = _mm_set_pd(base + step, base), advance = _mm_set1_pd(step*2), divisor = _mm_set1_pd(total);
+
+			for ( ; i + 2 <= width; i += 2 ) {
+				_mm_storeu_pd(out + i, _mm_div_pd(position, divisor));
+				position = _mm_add_pd(position, advance);
+			}
+#endif
+
+			for ( ; i < width; i++ )
+				out[i] = (base + step*i)/total;
+			break;
+		}
+		case OP_ADD: case OP_SUBTRACT: case OP_MULTIPLY: case OP_DIVIDE:
+			combine(op.code, out, a, program[op.a].varies & 1, b, program[op.b].varies & 1, width);
+			break;
+		case OP_NEGATE:
+			for ( i = 0; i < width; i++ )
+				out[i] = -a[i];
+			break;
+		case OP_ABS:
+			for ( i = 0; i < width; i++ )
+				out[i] = fabs(a[i]);
+			break;
+		case OP_SQRT:
+#ifdef LTPNG_PATTERN_SIMD
+			for ( ; i + 2 <= width; i += 2 )
+				_mm_storeu_pd(out + i, _mm_sqrt_pd(_mm_loadu_pd(a + i)));
+#endif
+
+			for ( ; i < width; i++ )
+				out[i] = sqrt(a[i]);
+			break;
+		case OP_SIN:
+			for ( i = 0; i < width; i++ )
+				out[i] = sin(a[i]);
+			break;
+		default:
+			for ( i = 0; i < width; i++ )
+				out[i] = cos(a[i]);
+	}
+}
+
+/** Work out one instruction that does not vary along the row */
+double LTPNGPattern::evaluate_scalar(const LTPNGPatternOp &op, unsigned int row) {
+	double a = op.code >= OP_ADD ? scalars[op.a] : 0;
+	double b = op.code >= OP_ADD && op.code <= OP_DIVIDE ? scalars[op.b] : 0;
+
+	switch ( op.code ) {
+		case OP_NUMBER: return op.value;
+		case OP_Y: return (double) row/height;
+		case OP_ADD: return a + b;
+		case OP_SUBTRACT: return a - b;
+		case OP_MULTIPLY: return a*b;
+		case OP_DIVIDE: return a/b;
+		case OP_NEGATE: return -a;
+		case OP_SIN: return sin(a);
+		case OP_COS: return cos(a);
+		case OP_ABS: return fabs(a);
+		default: return sqrt(a);
+	}
+}
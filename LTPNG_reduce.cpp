@@ -0,0 +1,256 @@
+/**
+ * Lowe Technologies PNG Encoder (LTPNG)
+ *
+ * Lossless format reduction.  When create_image() is asked to reduce, the whole image is passed through the
+ * same packing as encoding but only analysed, and the smallest format that holds every pixel exactly is picked
+ * before the header is written.  Each row is then converted from the caller's format into that format on its
+ * way to the filters.
+ *
+ * @author Rich Lowe
+ * @version See LTPNG.cpp for revision and revision history
+ */
+
+/** Header includes */
+#include <cstring>
+#include "LTPNG.h"
+
+using namespace std;
+
+/** Start an analysis pass over an image, which has rows pushed with write_rows() as if it were being encoded */
+void LTPNG::begin_analysis(unsigned int pixel_width, unsigned int pixel_height, unsigned char depth, unsigned char type) {
+	if ( in_progress )
+		throw "LTPNG::create_image(): previous image was not finished with end_image()";
+
+	setup_source(pixel_width, pixel_height, depth, type);
+
+	if ( stats ) {
+		stats->reset();
+		stats_start = stats_clock();
+	}
+
+	/** Start with every reduction asked for still possible, and rule them out as pixels are seen */
+	palette_possible = (reduce & REDUCE_PALETTE) != 0;
+	grey_possible = (reduce & REDUCE_GREY) != 0 && (type & 2);
+	alpha_possible = (reduce & REDUCE_ALPHA) != 0 && (type & 4);
+	depth_possible = (reduce & REDUCE_DEPTH) != 0;
+	grey_depth = 1;
+	colour_count = 0;
+	memset(colour_slots, 0xFF, sizeof(colour_slots));
+
+	prior = prior_row;
+	analysing = 1;
+	in_progress = 1;
+}
+
+/** Look at one row in the caller's format for what it rules out */
+void LTPNG::analyse_row(const unsigned char *raw) {
+	unsigned char channels = channel_count(colour_type);
+	unsigned char bytes = bit_depth/8;
+	unsigned int last = 0, key, slot, col, i;
+
+	/** Greyscale needs red, green, and blue equal to the last bit in every pixel */
+	if ( grey_possible ) {
+		const unsigned char *pixel = raw;
+
+		for ( col = 0; col < width && grey_possible; col++, pixel += channels*bytes )
+			if ( memcmp(pixel, pixel + bytes, bytes) || memcmp(pixel, pixel + bytes*2, bytes) )
+				grey_possible = 0;
+	}
+
+	/** Alpha can be dropped when every pixel is fully opaque */
+	if ( alpha_possible ) {
+		const unsigned char *pixel = raw + (channels - 1)*bytes;
+
+		for ( col = 0; col < width && alpha_possible; col++, pixel += channels*bytes )
+			if ( pixel[0] != 0xFF || pixel[bytes - 1] != 0xFF )
+				alpha_possible = 0;
+	}
+
+	/** 
+	 * 16-bit samples fit in 8 bits when they repeat their most significant byte, and grey fits in 1, 2, or 4 bits
+	 * when every value is a multiple of 255, 85, or 17, which scale back up to it exactly per 12.5
+	 */
+	if ( depth_possible ) {
+		const unsigned char *pixel = raw;
+
+		for ( col = 0; col < width && depth_possible; col++, pixel += channels*bytes ) {
+			if ( bytes == 2 )
+				for ( i = 0; i < channels; i++ )
+					if ( pixel[i*2] != pixel[i*2 + 1] )
+						depth_possible = 0;
+
+			if ( grey_depth < 8 ) {
+				unsigned char needed = pixel[0] % 255 == 0 ? 1 : pixel[0] % 85 == 0 ? 2 : pixel[0] % 17 == 0 ? 4 : 8;
+
+				if ( needed > grey_depth )
+					grey_depth = needed;
+			}
+		}
+	}
+
+	if ( !palette_possible )
+		return;
+
+	for ( col = 0; col < width; col++, raw += channels*bytes ) {
+		/** Palette entries are 8-bit, so 16-bit samples must repeat their most significant byte */
+		if ( bytes == 2 ) {
+			for ( i = 0; i < channels; i++ ) {
+				if ( raw[i*2] != raw[i*2 + 1] ) {
+					palette_possible = 0;
+					return;
+				}
+			}
+		}
+
+		key = pixel_key(raw);
+
+		/** Runs of one colour are common, so only look up colours that differ from the pixel before */
+		if ( col > 0 && key == last )
+			continue;
+
+		last = key;
+		slot = colour_slot(key);
+
+		if ( colour_slots[slot] < 0 ) {
+			if ( colour_count == 256 ) {
+				palette_possible = 0;
+				return;
+			}
+
+			colour_slots[slot] = colour_count;
+			palette[colour_count++] = key;
+		}
+	}
+}
+
+/** Finish the analysis pass and pick the format begin_image() will write */
+void LTPNG::end_analysis() {
+	if ( rows_written != height )
+		throw "LTPNG::create_image(): fewer rows analysed than the image height";
+
+	analysing = 0;
+	in_progress = 0;
+	analysed = 1;
+
+	if ( stats )
+		stats->analyse_seconds = stats_clock() - stats_start;
+
+	output_bit_depth = bit_depth;
+	output_colour_type = colour_type;
+	palette_size = 0;
+
+	/** Indexed-colour with indices only as wide as the number of colours needs */
+	unsigned char index_bits = colour_count <= 2 ? 1 : colour_count <= 4 ? 2 : colour_count <= 16 ? 4 : 8;
+
+	/** Opaque alpha is dropped, taking truecolour with alpha (6) to truecolour (2) and greyscale with alpha (4) to greyscale (0) */
+	if ( alpha_possible )
+		output_colour_type -= 4;
+
+	/** Greyscale drops the colour channels, taking truecolour to the matching greyscale type */
+	if ( grey_possible )
+		output_colour_type -= 2;
+
+	/** Greyscale alone may go below 8 bits per 11.2.2, every other type stops at 8 */
+	if ( depth_possible )
+		output_bit_depth = output_colour_type == 0 ? grey_depth : 8;
+
+	/** A palette has to beat the pixels it replaces, so greyscale wins over indices no smaller per pixel */
+	if ( palette_possible && index_bits < channel_count(output_colour_type)*output_bit_depth ) {
+		index_palette();
+
+		output_colour_type = 3;
+		palette_size = colour_count;
+		output_bit_depth = index_bits;
+	}
+}
+
+/**
+ * Reorder the palette with any translucent colours first, so the tRNS chunk only needs to cover them, and rebuild
+ * the hash of slots for the new order
+ */
+void LTPNG::index_palette() {
+	unsigned int sorted[256];
+	unsigned int count = 0, i;
+
+	for ( i = 0; i < colour_count; i++ )
+		if ( (palette[i] & 0xFF) != 0xFF )
+			sorted[count++] = palette[i];
+
+	for ( i = 0; i < colour_count; i++ )
+		if ( (palette[i] & 0xFF) == 0xFF )
+			sorted[count++] = palette[i];
+
+	memset(colour_slots, 0xFF, sizeof(colour_slots));
+
+	for ( i = 0; i < colour_count; i++ ) {
+		palette[i] = sorted[i];
+		colour_slots[colour_slot(palette[i])] = i;
+	}
+}
+
+/** Build the RGBA colour key of one pixel in the caller's format, grey filling red, green, and blue */
+unsigned int LTPNG::pixel_key(const unsigned char *raw) {
+	unsigned char bytes = bit_depth/8;
+	unsigned char colour = colour_type & 2 ? bytes : 0;
+	unsigned char alpha = channel_count(colour_type) - 1;
+
+	return (unsigned int) raw[0] << 24 | raw[colour] << 16 | raw[colour*2] << 8 | (colour_type & 4 ? raw[alpha*bytes] : 0xFF);
+}
+
+/** Find the hash slot holding an RGBA colour, or the empty slot it would go in, probing linearly from its hash */
+unsigned int LTPNG::colour_slot(unsigned int key) {
+	unsigned int slot = (key*2654435761u) >> 22;
+
+	while ( colour_slots[slot] >= 0 && palette[colour_slots[slot]] != key )
+		slot = (slot + 1) & 1023;
+
+	return slot;
+}
+
+/** Convert one row from the caller's format in PNG byte order into the output format */
+void LTPNG::convert_row(const unsigned char *raw, unsigned char *out) {
+	unsigned char channels = channel_count(colour_type);
+	unsigned char bytes = bit_depth/8;
+	unsigned char out_bytes = output_bit_depth/8;
+	unsigned char out_colour = output_colour_type & 2 ? 3 : 1;
+	unsigned char per_byte = 8/output_bit_depth;
+	unsigned int last = 0, key, index = 0, col, i;
+
+	for ( col = 0; col < width; col++, raw += channels*bytes ) {
+		if ( output_colour_type == 3 ) {
+			/** Look up the palette index, only hashing colours that differ from the pixel before */
+			key = pixel_key(raw);
+
+			if ( col == 0 || key != last )
+				index = colour_slots[colour_slot(key)];
+
+			last = key;
+		} else if ( output_bit_depth < 8 ) {
+			/** Greyscale under 8 bits is the most significant byte scaled down, which the analysis found exact */
+			index = raw[0]/(255/((1 << output_bit_depth) - 1));
+		} else {
+			/** Anything else keeps the samples it needs, grey from red and alpha last, cut to their most significant byte for 8 bits */
+			for ( i = 0; i < out_colour; i++ ) {
+				memcpy(out, raw + i*bytes, out_bytes);
+				out += out_bytes;
+			}
+
+			if ( output_colour_type & 4 ) {
+				memcpy(out, raw + (channels - 1)*bytes, out_bytes);
+				out += out_bytes;
+			}
+
+			continue;
+		}
+
+		/** Values under 8 bits are packed leftmost pixel first into the high bits of each byte per 7.2 */
+		if ( per_byte == 1 ) {
+			out[col] = index;
+		} else {
+			if ( col % per_byte == 0 )
+				out[col/per_byte] = 0;
+
+			out[col/per_byte] |= index << (8 - output_bit_depth*(col % per_byte + 1));
+		}
+	}
+}
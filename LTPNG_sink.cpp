@@ -0,0 +1,82 @@
+/**
+ * Lowe Technologies PNG Encoder (LTPNG)
+ *
+ * Output sinks the encoder writes finished bytes to.  The encoder builds chunks in its own output buffer and
+ * hands them over in large blocks, so a sink sees few calls per image whatever it writes to.
+ *
+ * @author Rich Lowe
+ * @version See LTPNG.cpp for revision and revision history
+ */
+
+/** Header includes */
+#include <cstring>
+#include "LTPNG.h"
+
+using namespace std;
+
+/** Wrap an open file stream */
+LTPNGFileSink::LTPNGFileSink(ofstream *stream) {
+	file = stream;
+}
+
+/** Write a block to the file stream */
+void LTPNGFileSink::write(const unsigned char *data, size_t len) {
+	if ( !file )
+		throw "LTPNGFileSink::write(): no file stream to write to";
+
+	file->write((const char *) data, len);
+}
+
+/** Append a block to the memory buffer, which grows geometrically as needed */
+void LTPNGMemorySink::write(const unsigned char *block, size_t len) {
+	data.insert(data.end(), block, block + len);
+}
+
+/** Wrap a caller-provided buffer of size bytes, starting empty */
+LTPNGBufferSink::LTPNGBufferSink(unsigned char *buf, size_t buf_size) {
+	buffer = buf;
+	size = buf_size;
+	length = 0;
+}
+
+/** Copy a block onto the end of the caller's buffer */
+void LTPNGBufferSink::write(const unsigned char *data, size_t len) {
+	if ( len > size - length )
+		throw "LTPNGBufferSink::write(): image does not fit in the buffer";
+
+	memcpy(buffer + length, data, len);
+	length += len;
+}
+
+/** Wrap a callback taking each block and its length */
+LTPNGCallbackSink::LTPNGCallbackSink(function<void (const unsigned char *, size_t)> write_callback) {
+	callback = write_callback;
+}
+
+/** Hand a block to the callback */
+void LTPNGCallbackSink::write(const unsigned char *data, size_t len) {
+	callback(data, len);
+}
+
+/** Pass blocks on to a sink, keeping a copy of up to copy_limit bytes */
+LTPNGCopySink::LTPNGCopySink(LTPNGSink *sink, size_t copy_limit) {
+	out = sink;
+	limit = copy_limit;
+	complete = true;
+}
+
+/** Pass a block on and add it to the copy, giving the copy up once the image outgrows the limit */
+void LTPNGCopySink::write(const unsigned char *block, size_t len) {
+	out->write(block, len);
+
+	if ( !complete )
+		return;
+
+	if ( len > limit - data.size() ) {
+		vector<unsigned char>().swap(data);
+		complete = false;
+		return;
+	}
+
+	data.insert(data.end(), block, block + len);
+}
@@ -0,0 +1,259 @@
+/**
+ * PNG Animate
+ *
+ * A command-line driven animated PNG maker, drawing a spinner and progress bar over a gradient the way a status
+ * animation would, and reporting what each frame cost to write.
+ *
+ * @author Rich Lowe
+ */
+
+/** Header includes */
+#include <iostream>
+#include <fstream>
+#include <cmath>
+#include <cstring>
+#include <unistd.h>
+#include "LTPNG.h"
+
+using namespace std;
+
+/** Function declarations */
+void draw_frame(unsigned char *, unsigned int, unsigned int, unsigned int, unsigned int, bool);
+void usage();
+
+/** Beginning of program */
+int main(int argc, char **argv) {
+	string filename;
+	int width = 0, height = 0, frames = 24, rate = 12, plays = 0, bit_depth = 8, filter_type = 4, threads = 1, level = -1;
+	bool alpha = false, interlace = false;
+	LTPNGOptions options;
+	int c;
+
+	opterr = 0;
+
+	/** Look for option switches */
+	while ( (c = getopt(argc, argv, "f:w:h:c:r:n:d:t:j:p:l:ai")) != -1 ) {
+		switch ( c ) {
+			case 'f': filename = string(optarg); break;
+			case 'w': width = atoi(optarg); break;
+			case 'h': height = atoi(optarg); break;
+			case 'c': frames = atoi(optarg); break;
+			case 'r': rate = atoi(optarg); break;
+			case 'n': plays = atoi(optarg); break;
+			case 'd': bit_depth = atoi(optarg); break;
+			case 't': filter_type = atoi(optarg); break;
+			case 'j': threads = atoi(optarg); break;
+			case 'l': level = atoi(optarg); break;
+			case 'a': alpha = true; break;
+			case 'i': interlace = true; break;
+			case 'p':
+				try {
+					options = LTPNGOptions::preset(optarg);
+				} catch ( const char * ) {
+					cout<<"png_animate: unknown compression preset, only fastest, balanced, and smallest are allowed."<<endl<<endl;
+					usage();
+					return 1;
+				}
+				break;
+			case '?':
+				if ( optopt == 'f' || optopt == 'w' || optopt == 'h' || optopt == 'c' || optopt == 'r' || optopt == 'n' || optopt == 'd' || optopt == 't' || optopt == 'j' || optopt == 'p' || optopt == 'l' )
+					cout<<"png_animate: Option -"<<static_cast<char>(optopt)<<" requires an argument."<<endl;
+				else
+					cout<<"png_animate: Unknown option `-"<<static_cast<char>(optopt)<<"'."<<endl;
+				return 1;
+			default: abort();
+		}
+	}
+
+	/** Verify the options */
+	if ( width <= 0 || height <= 0 ) {
+		cout<<"png_animate: please specify a valid width and height of the animation."<<endl<<endl;
+		usage();
+		return 1;
+	}
+
+	if ( frames <= 0 || rate <= 0 || rate > 65535 || plays < 0 ) {
+		cout<<"png_animate: please specify at least one frame, a frame rate of 1 to 65535, and 0 or more plays."<<endl<<endl;
+		usage();
+		return 1;
+	}
+
+	if ( bit_depth != 8 && bit_depth != 16 ) {
+		cout<<"png_animate: only 8 and 16-bit depths are allowed."<<endl<<endl;
+		usage();
+		return 1;
+	}
+
+	if ( filter_type < 0 || filter_type > 6 ) {
+		cout<<"png_animate: invalid filter type, only methods 0-6 are allowed."<<endl<<endl;
+		usage();
+		return 1;
+	}
+
+	if ( level < -1 || level > 9 ) {
+		cout<<"png_animate: invalid compression level, only levels 0-9 are allowed."<<endl<<endl;
+		usage();
+		return 1;
+	}
+
+	if ( level != -1 )
+		options.level = level;
+
+	if ( threads < 1 ) {
+		cout<<"png_animate: please specify at least one thread."<<endl<<endl;
+		usage();
+		return 1;
+	}
+
+	if ( filename.length() <= 0 ) {
+		cout<<"png_animate: please specify a valid filename for the animation."<<endl<<endl;
+		usage();
+		return 1;
+	}
+
+	/** Try to create the animation, report any errors */
+	try {
+		const char *dispose_names[] = { "none", "background", "previous" };
+		const char *blend_names[] = { "source", "over" };
+		unsigned int channels = alpha ? 4 : 3;
+		unsigned char *pixels = new unsigned char[(size_t) width*height*channels];
+		unsigned long long bytes_in = 0, bytes_out = 0;
+		double seconds = 0;
+		int frame;
+
+		LTPNG image(bit_depth, alpha ? 6 : 2, filter_type);
+
+		image.threads = threads;
+		image.options = options;
+		image.interlace = interlace ? 1 : 0;
+
+		ofstream file(filename, ios::binary);
+
+		if ( !file ) {
+			delete[] pixels;
+			throw "png_animate: could not open the image file";
+		}
+
+		cout<<"Creating new "<<bit_depth<<"-bit truecolour animation";
+
+		if ( alpha )
+			cout<<" with alpha";
+
+		cout<<"..."<<endl;
+		cout<<" Pixel width: "<<width<<endl;
+		cout<<" Pixel height: "<<height<<endl;
+		cout<<" Frames: "<<frames<<" at "<<rate<<" per second"<<endl;
+
+		image.begin_animation(file, width, height, frames, plays);
+
+		for ( frame = 0; frame < frames; frame++ ) {
+			draw_frame(pixels, width, height, frame, frames, alpha);
+			image.write_frame(pixels, alpha ? LTPNG::PIXELS_RGBA8 : LTPNG::PIXELS_RGB8, 0, 1, rate);
+		}
+
+		image.end_animation();
+		file.close();
+		delete[] pixels;
+
+		/** Each frame is reported once it is written, which is once the frame after it was given */
+		for ( frame = 0; frame < frames; frame++ ) {
+			const LTPNGFrameStats &written = image.frame_stats[frame];
+
+			cout<<" Frame "<<frame + 1<<": "<<written.width<<"x"<<written.height<<" at "<<written.x<<","<<written.y;
+			cout<<", dispose "<<dispose_names[written.dispose_op]<<", blend "<<blend_names[written.blend_op];
+			cout<<", "<<written.bytes_in<<" bytes in, "<<written.bytes_out<<" bytes out, "<<written.seconds<<"s, ";
+			cout<<written.bytes_in/written.seconds/1e6<<" MB/s"<<endl;
+
+			bytes_in += written.bytes_in;
+			bytes_out += written.bytes_out;
+			seconds += written.seconds;
+		}
+
+		cout<<" Total scanline data: "<<bytes_in<<" bytes of "<<(unsigned long long) frames*image.frame_stats[0].bytes_in<<" across every whole frame"<<endl;
+		cout<<" Total compressed image data size: "<<bytes_out<<endl;
+		cout<<" Frames per second: "<<frames/seconds<<endl<<endl;
+		cout<<"Done!"<<endl;
+	} catch ( const char *error ) {
+		cout<<error<<endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Draw one frame in 8-bit RGB or RGBA: a gradient, or nothing with alpha, under a ring of dots with one lit dot
+ * going round and a progress bar filling along the bottom
+ */
+void draw_frame(unsigned char *pixels, unsigned int width, unsigned int height, unsigned int frame, unsigned int frames, bool alpha) {
+	unsigned int channels = alpha ? 4 : 3;
+	unsigned int size = (width < height ? width : height)/16 + 1;
+	unsigned int row, col, dot, x, y;
+	unsigned char *pixel;
+
+	for ( row = 0; row < height; row++ ) {
+		pixel = pixels + (size_t) row*width*channels;
+
+		for ( col = 0; col < width; col++, pixel += channels ) {
+			if ( alpha ) {
+				memset(pixel, 0, 4);
+			} else {
+				pixel[0] = 255*LTPNG::ramp_s(row, col, width, height);
+				pixel[1] = 255*LTPNG::ramp_se(row, col, width, height);
+				pixel[2] = 255*LTPNG::ramp_nw(row, col, width, height);
+			}
+		}
+	}
+
+	/** Eight dots in a ring about the centre, the lit one moving on a dot each frame */
+	for ( dot = 0; dot < 8; dot++ ) {
+		double angle = dot*M_PI/4;
+		unsigned char shade = dot == frame % 8 ? 255 : 96;
+
+		x = width/2 + cos(angle)*size*3;
+		y = height/2 + sin(angle)*size*3;
+
+		for ( row = y >= size/2 ? y - size/2 : 0; row < y + size/2 + 1 && row < height; row++ ) {
+			for ( col = x >= size/2 ? x - size/2 : 0; col < x + size/2 + 1 && col < width; col++ ) {
+				pixel = pixels + ((size_t) row*width + col)*channels;
+				memset(pixel, shade, channels);
+
+				if ( alpha )
+					pixel[3] = 255;
+			}
+		}
+	}
+
+	/** The progress bar fills the bottom rows from the left */
+	for ( row = height > size ? height - size : 0; row < height; row++ ) {
+		pixel = pixels + (size_t) row*width*channels;
+
+		for ( col = 0; col < (unsigned long long) width*(frame + 1)/frames; col++, pixel += channels ) {
+			pixel[0] = 32;
+			pixel[1] = 192;
+			pixel[2] = 64;
+
+			if ( alpha )
+				pixel[3] = 255;
+		}
+	}
+}
+
+/** Print usage instructions */
+void usage() {
+	cout<<"Usage: png_animate [options]"<<endl<<endl;
+	cout<<"  -f FILENAME   Desired filename of the generated animated PNG image"<<endl;
+	cout<<"  -w WIDTH      Specifies the width of the animation in pixels"<<endl;
+	cout<<"  -h HEIGHT     Specifies the height of the animation in pixels"<<endl;
+	cout<<"  -c FRAMES     Number of frames, 24 by default [optional]"<<endl;
+	cout<<"  -r RATE       Frames per second, 12 by default [optional]"<<endl;
+	cout<<"  -n PLAYS      Number of times to play the animation, 0 = forever [optional]"<<endl;
+	cout<<"  -d DEPTH      Can be 8 or 16-bit pixel channel sizes [optional]"<<endl;
+	cout<<"  -t FILTER     Can be 0 = None, 1 = Sub, 2 = Up, 3 = Average, 4 = Paeth, 5 = Adaptive,"<<endl;
+	cout<<"                6 = Adaptive by entropy [optional]"<<endl;
+	cout<<"  -j THREADS    Number of threads to compress each frame with [optional]"<<endl;
+	cout<<"  -p PRESET     Compression preset, fastest, balanced, or smallest [optional]"<<endl;
+	cout<<"  -l LEVEL      Compression level from 0 = None to 9 = Smallest, overriding the preset [optional]"<<endl;
+	cout<<"  -a            Draw over a transparent background rather than a gradient [optional]"<<endl;
+	cout<<"  -i            Interlace the frames with Adam7 for progressive display [optional]"<<endl<<endl;
+}
@@ -0,0 +1,1172 @@
+/**
+ * PNG Bench
+ *
+ * Microbenchmarks for the stages of the LTPNG encoder, and a benchmark suite timing every stage and the whole
+ * encoder over a deterministic corpus of images, written out as JSON for comparing runs.
+ *
+ * @author Rich Lowe
+ */
+
+/** Header includes */
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "LTPNG.h"
+
+using namespace std;
+
+/** CRC update function signature shared by all of the engines */
+typedef unsigned int (*crc_function)(unsigned int, const unsigned char *, size_t);
+
+/** Row filter function signature shared by all of the kernels */
+typedef void (*filter_function)(unsigned char *, const unsigned char *, const unsigned char *, unsigned int, unsigned char, unsigned char);
+
+/** One timed stage of one image in the benchmark suite */
+struct SuiteResult {
+	const char *image;
+	unsigned int width;
+	unsigned int height;
+	unsigned char bit_depth;
+	unsigned char colour_type;
+	const char *stage;
+	const char *variant;
+	double bytes_in;
+	double bytes_out;
+	double seconds;
+	long peak_rss;
+};
+
+/** Encoder exposing its row packing, so the packing stage can be timed apart from the rest of the encoder */
+class PackingEncoder : public LTPNG {
+	public:
+		PackingEncoder(unsigned char depth, unsigned char type, unsigned int pixel_width) : LTPNG(depth, type, 0) {
+			setup_source(pixel_width, 1, depth, type);
+		}
+
+		/** Pack rows of RGBA pixels at the image's bit depth into PNG byte order, each row_bytes apart in out */
+		void pack(const unsigned char *pixels, unsigned int rows, unsigned char *out, size_t row_bytes) {
+			unsigned char format = bit_depth == 8 ? PIXELS_RGBA8 : PIXELS_RGBA16BE;
+			unsigned char *kept = current_row;
+			unsigned int row;
+
+			/** Point the row packing writes to at each row of the output in turn */
+			for ( row = 0; row < rows; row++ ) {
+				current_row = out + row*row_bytes;
+				pack_row(pixels + (size_t) row*width*4*(bit_depth/8), format);
+			}
+
+			current_row = kept;
+		}
+
+		/** The specialised packing kernels, timed against the reference loops they replaced */
+		using LTPNG::pixels_packer;
+		using LTPNG::planes_packer;
+
+		/**
+		 * Reference packing of one row of interleaved pixels in one of the PIXELS_* formats, the loop pack_row() ran
+		 * before the packing kernels, looking at every sample
+		 */
+		void pack_row_reference(const unsigned char *src, unsigned char format, unsigned char *packed) {
+			unsigned char in_channels = format_channels(format);
+			unsigned char in_bytes = format == PIXELS_RGB8 || format == PIXELS_RGBA8 || format == PIXELS_GREY8 || format == PIXELS_GREYA8 ? 1 : 2;
+			unsigned char in_colour = in_channels >= 3 ? 3 : 1;
+			unsigned char out_channels = LTPNG::channel_count(colour_type);
+			unsigned char out_colour = colour_type & 2 ? 3 : 1;
+			unsigned char channel, sample, msb, lsb;
+			unsigned int col, i = 0;
+
+			for ( col = 0; col < width; col++, src += in_channels*in_bytes ) {
+				for ( channel = 0; channel < out_channels; channel++ ) {
+					/** Grey fills each colour channel, and alpha is the sample after the colour ones */
+					sample = channel < out_colour ? (in_colour == 1 ? 0 : channel) : in_colour;
+
+					/** 8-bit samples scale up by repeating in both bytes, and missing alpha is fully opaque */
+					if ( sample < in_channels ) {
+						msb = src[sample*in_bytes];
+						lsb = src[sample*in_bytes + in_bytes - 1];
+					} else {
+						msb = lsb = 0xFF;
+					}
+
+					/** 16-bit samples scale down to their most significant byte */
+					packed[i++] = msb;
+
+					if ( bit_depth == 16 )
+						packed[i++] = lsb;
+				}
+			}
+		}
+
+		/** Reference packing of one row from channels of 8-bit (1) or 16-bit (2) samples, starting at pixel first */
+		void pack_planes_reference(unsigned char *packed, const void *red, const void *green, const void *blue, const void *alpha, size_t first, unsigned char sample_bytes) {
+			if ( sample_bytes == 2 )
+				pack_planes16_reference(packed, (const unsigned short *) red, (const unsigned short *) green, (const unsigned short *) blue, (const unsigned short *) alpha, first);
+			else
+				pack_planes8_reference(packed, (const unsigned char *) red, (const unsigned char *) green, (const unsigned char *) blue, (const unsigned char *) alpha, first);
+		}
+
+		/** The loop write_rows() ran for one row of 16-bit channels before the packing kernels */
+		void pack_planes16_reference(unsigned char *packed, const unsigned short *red, const unsigned short *green, const unsigned short *blue, const unsigned short *alpha, size_t first) {
+			unsigned int col, i = 0;
+			size_t pixel;
+			unsigned char colour = colour_type & 2, has_alpha = colour_type & 4;
+
+			for ( col = 0; col < width; col++ ) {
+				pixel = first + col;
+
+				/** If 8-bit, store each channel as is */
+				if ( bit_depth == 8 ) {
+					packed[i++] = red[pixel];
+
+					if ( colour ) {
+						packed[i++] = green[pixel];
+						packed[i++] = blue[pixel];
+					}
+
+					if ( has_alpha )
+						packed[i++] = alpha[pixel];
+				}
+
+				/** If 16-bit, store each channel most significant byte first */
+				if ( bit_depth == 16 ) {
+					packed[i++] = red[pixel] >> 8;
+					packed[i++] = red[pixel] & 0xFF;
+
+					if ( colour ) {
+						packed[i++] = green[pixel] >> 8;
+						packed[i++] = green[pixel] & 0xFF;
+						packed[i++] = blue[pixel] >> 8;
+						packed[i++] = blue[pixel] & 0xFF;
+					}
+
+					if ( has_alpha ) {
+						packed[i++] = alpha[pixel] >> 8;
+						packed[i++] = alpha[pixel] & 0xFF;
+					}
+				}
+			}
+		}
+
+		/** The loop write_rows() ran for one row of 8-bit channels before the packing kernels */
+		void pack_planes8_reference(unsigned char *packed, const unsigned char *red, const unsigned char *green, const unsigned char *blue, const unsigned char *alpha, size_t first) {
+			unsigned int col, i = 0;
+			size_t pixel;
+			unsigned char colour = colour_type & 2, has_alpha = colour_type & 4;
+
+			for ( col = 0; col < width; col++ ) {
+				pixel = first + col;
+
+				/** If 8-bit, store each channel as is */
+				if ( bit_depth == 8 ) {
+					packed[i++] = red[pixel];
+
+					if ( colour ) {
+						packed[i++] = green[pixel];
+						packed[i++] = blue[pixel];
+					}
+
+					if ( has_alpha )
+						packed[i++] = alpha[pixel];
+				}
+
+				/** If 16-bit, scale each channel up by repeating it in both bytes, so 0xFF becomes 0xFFFF */
+				if ( bit_depth == 16 ) {
+					packed[i++] = red[pixel];
+					packed[i++] = red[pixel];
+
+					if ( colour ) {
+						packed[i++] = green[pixel];
+						packed[i++] = green[pixel];
+						packed[i++] = blue[pixel];
+						packed[i++] = blue[pixel];
+					}
+
+					if ( has_alpha ) {
+						packed[i++] = alpha[pixel];
+						packed[i++] = alpha[pixel];
+					}
+				}
+			}
+		}
+};
+
+/** Images in the suite's corpus */
+const char *corpus[] = { "gradient", "stencil", "noise", "flat" };
+
+/** The png_imprint stencil, drawn over the gradient in the stencil image */
+const char *imprint[] = {
+	"................................................................",
+	"................................................................",
+	"................................................................",
+	"................................................................",
+	"................................................................",
+	"................................................................",
+	"................................................................",
+	"................................................................",
+	"................................................................",
+	".......xxxxxxxx..............xxxxxxxxxxxxxxxxxxxxxxxxxxxx.......",
+	".......xxxxxxxx..............xxxxxxxxxxxxxxxxxxxxxxxxxxxx.......",
+	".......xxxxxxxx..............xxxxxxxxxxxxxxxxxxxxxxxxxxxx.......",
+	".......xxxxxxxx..............xxxxxxxxxxxxxxxxxxxxxxxxxxxx.......",
+	".......xxxxxxxx..............xxxxxxxxxxxxxxxxxxxxxxxxxxxx.......",
+	".......xxxxxxxx..............xxxxxxxxxxxxxxxxxxxxxxxxxxxx.......",
+	".......xxxxxxxx..............xxxxxxxxxxxxxxxxxxxxxxxxxxxx.......",
+	".......xxxxxxxx..............xxxxxxxxxxxxxxxxxxxxxxxxxxxx.......",
+	".......xxxxxxxx........................xxxxxxxx.................",
+	".......xxxxxxxx........................xxxxxxxx.................",
+	".......xxxxxxxx........................xxxxxxxx.................",
+	".......xxxxxxxx........................xxxxxxxx.................",
+	".......xxxxxxxx........................xxxxxxxx.................",
+	".......xxxxxxxx........................xxxxxxxx.................",
+	".......xxxxxxxx........................xxxxxxxx.................",
+	".......xxxxxxxxxxxxxxxxxxxxxxx.........xxxxxxxx.................",
+	".......xxxxxxxxxxxxxxxxxxxxxxx.........xxxxxxxx.................",
+	".......xxxxxxxxxxxxxxxxxxxxxxx.........xxxxxxxx.................",
+	".......xxxxxxxxxxxxxxxxxxxxxxx.........xxxxxxxx.................",
+	".......xxxxxxxxxxxxxxxxxxxxxxx.........xxxxxxxx.................",
+	".......xxxxxxxxxxxxxxxxxxxxxxx.........xxxxxxxx.................",
+	".......xxxxxxxxxxxxxxxxxxxxxxx.........xxxxxxxx.................",
+	".......xxxxxxxxxxxxxxxxxxxxxxx.........xxxxxxxx.................",
+	"................................................................",
+	"................................................................",
+	"................................................................",
+	"................................................................",
+	"................................................................",
+	"................................................................",
+	"................................................................"
+};
+
+/** Scratch file the suite writes images to, removed when it finishes */
+const char *suite_file = "png_bench.tmp";
+
+/** Primary function declarations */
+void bench_crc(size_t, unsigned int);
+double time_crc(crc_function, const unsigned char *, size_t, unsigned int, unsigned int &);
+unsigned int zlib_crc(unsigned int, const unsigned char *, size_t);
+void bench_filter(size_t, unsigned int);
+double time_filter(filter_function, unsigned char *, const unsigned char *, unsigned int, unsigned int, unsigned char, unsigned char, unsigned int);
+bool check_filters();
+void bench_pack(size_t, unsigned int);
+unsigned int channel_count(unsigned char);
+unsigned int pixel_bytes(unsigned char, unsigned char);
+void bench_encode(unsigned int, unsigned int);
+double time_encode(const unsigned char *, unsigned int, unsigned int, unsigned int, bool, size_t &);
+void bench_options(unsigned int);
+void bench_incremental(unsigned int);
+void bench_cache(unsigned int);
+void bench_suite(unsigned int, unsigned int, const char *);
+void suite_stages(unsigned int, unsigned int, unsigned char, unsigned char, unsigned int, vector<SuiteResult> &);
+void suite_encode(unsigned int, unsigned int, unsigned char, unsigned char, unsigned int, vector<SuiteResult> &);
+void fill_corpus(unsigned int, unsigned char *, unsigned int, unsigned int, unsigned int, unsigned int, unsigned char);
+void write_json(ostream &, const vector<SuiteResult> &, unsigned int);
+long peak_rss();
+void fill_noise(unsigned char *, size_t, unsigned int);
+void usage();
+
+/** Beginning of program */
+int main(int argc, char **argv) {
+	int size = 64;
+	int iterations = 5;
+	int tile = 64;
+	int max_size = 2048;
+	const char *json = NULL;
+	int c;
+
+	opterr = 0;
+
+	/** Look for option switches */
+	while ( (c = getopt(argc, argv, "s:i:t:j:z:")) != -1 ) {
+		switch ( c ) {
+			case 's': size = atoi(optarg); break;
+			case 'i': iterations = atoi(optarg); break;
+			case 't': tile = atoi(optarg); break;
+			case 'j': json = optarg; break;
+			case 'z': max_size = atoi(optarg); break;
+			case '?':
+				if ( optopt == 's' || optopt == 'i' || optopt == 't' || optopt == 'j' || optopt == 'z' )
+					cout<<"png_bench: Option -"<<static_cast<char>(optopt)<<" requires an argument."<<endl;
+				else
+					cout<<"png_bench: Unknown option `-"<<static_cast<char>(optopt)<<"'."<<endl;
+				return 1;
+			default: abort();
+		}
+	}
+
+	/** Verify size and iterations entered */
+	if ( size <= 0 || iterations <= 0 || tile <= 0 || max_size < 32 ) {
+		cout<<"png_bench: please specify a valid buffer size, iteration count, tile size, and largest suite image."<<endl<<endl;
+		usage();
+		return 1;
+	}
+
+	/** Run the benchmarks, report any errors */
+	try {
+		if ( json ) {
+			bench_suite(max_size, iterations, json);
+			return 0;
+		}
+
+		bench_crc((size_t) size << 20, iterations);
+		bench_filter((size_t) size << 20, iterations);
+		bench_pack((size_t) size << 20, iterations);
+		bench_encode(tile, iterations);
+		bench_options(iterations);
+		bench_incremental(iterations);
+		bench_cache(iterations);
+	} catch ( const char *error ) {
+		cout<<error<<endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+/** Measure the throughput of each CRC-32 engine against the byte-at-a-time reference, checking they all agree */
+void bench_crc(size_t size, unsigned int iterations) {
+	unsigned char *buf = new unsigned char[size];
+	unsigned int reference, result;
+
+	fill_noise(buf, size, 0x12345678);
+
+	cout<<"CRC-32 throughput over "<<(size >> 20)<<" MiB, best of "<<iterations<<" (update_crc() engine: "<<LTPNG::crc_engine()<<")"<<endl;
+
+	double seconds = time_crc(LTPNG::update_crc_reference, buf, size, iterations, reference);
+	cout<<" reference (byte-at-a-time): "<<fixed<<setprecision(2)<<setw(8)<<size/seconds/1e9<<" GB/s"<<endl;
+
+	seconds = time_crc(LTPNG::update_crc_slice, buf, size, iterations, result);
+	cout<<" slice-by-8:                 "<<setw(8)<<size/seconds/1e9<<" GB/s"<<(result == reference ? "" : "  MISMATCH")<<endl;
+
+	if ( LTPNG::crc_clmul_supported() ) {
+		seconds = time_crc(LTPNG::update_crc_clmul, buf, size, iterations, result);
+		cout<<" pclmul:                     "<<setw(8)<<size/seconds/1e9<<" GB/s"<<(result == reference ? "" : "  MISMATCH")<<endl;
+	}
+
+	seconds = time_crc(zlib_crc, buf, size, iterations, result);
+	cout<<" zlib crc32():               "<<setw(8)<<size/seconds/1e9<<" GB/s"<<(result == reference ? "" : "  MISMATCH")<<endl;
+
+	/** Check that combining the CRCs of two halves gives the CRC of the whole */
+	size_t half = size/3;
+	unsigned int first = LTPNG::update_crc(0xffffffffL, buf, half) ^ 0xffffffffL;
+	unsigned int second = LTPNG::update_crc(0xffffffffL, buf + half, size - half) ^ 0xffffffffL;
+
+	cout<<" crc_combine():              "<<(LTPNG::crc_combine(first, second, size - half) == (reference ^ 0xffffffffL) ? "ok" : "MISMATCH")<<endl<<endl;
+
+	delete[] buf;
+}
+
+/** Run a CRC engine over the buffer, returning the best time in seconds and the running CRC it produced */
+double time_crc(crc_function update, const unsigned char *buf, size_t size, unsigned int iterations, unsigned int &result) {
+	double best = 0;
+	unsigned int i;
+
+	for ( i = 0; i < iterations; i++ ) {
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		result = update(0xffffffffL, buf, size);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		if ( i == 0 || seconds < best )
+			best = seconds;
+	}
+
+	return best;
+}
+
+/** Adapt zlib's crc32(), which works on the final rather than the running CRC, to the engine signature */
+unsigned int zlib_crc(unsigned int crc, const unsigned char *buf, size_t size) {
+	return crc32(crc ^ 0xffffffffL, buf, size) ^ 0xffffffffL;
+}
+
+/** Measure the throughput of each row filter kernel for each filter method and pixel size */
+void bench_filter(size_t size, unsigned int iterations) {
+	const char *names[] = { "None", "Sub", "Up", "Average", "Paeth" };
+	const unsigned char bpps[] = { 3, 4, 6, 8 };
+	const unsigned int len = 4096*8;
+	unsigned int rows = size/len;
+	unsigned char filter, b;
+
+	/** Two rows of a smooth gradient with noise in the low bits, so the Paeth branches are all taken */
+	unsigned char *rows_buf = new unsigned char[len*2];
+	unsigned char *out = new unsigned char[len];
+	unsigned int i;
+
+	fill_noise(rows_buf, len*2, 0x9e3779b9);
+
+	for ( i = 0; i < len*2; i++ )
+		rows_buf[i] = (i % len)/64 + (rows_buf[i] & 7);
+
+	cout<<"Row filter throughput in GB/s over "<<(size >> 20)<<" MiB, best of "<<iterations<<" (filter_row() kernels: "<<LTPNG::filter_engine()<<")"<<endl;
+	cout<<" filter   bpp  reference      sse2";
+
+	if ( LTPNG::filter_avx2_supported() )
+		cout<<"      avx2";
+
+	cout<<endl;
+
+	for ( filter = 1; filter < 5; filter++ ) {
+		for ( b = 0; b < sizeof(bpps); b++ ) {
+			cout<<" "<<left<<setw(8)<<names[filter]<<right<<setw(4)<<static_cast<unsigned int>(bpps[b]);
+			cout<<setw(11)<<(double) rows*len/time_filter(LTPNG::filter_row_reference, out, rows_buf, len, rows, bpps[b], filter, iterations)/1e9;
+			cout<<setw(10)<<(double) rows*len/time_filter(LTPNG::filter_row_sse2, out, rows_buf, len, rows, bpps[b], filter, iterations)/1e9;
+
+			if ( LTPNG::filter_avx2_supported() )
+				cout<<setw(10)<<(double) rows*len/time_filter(LTPNG::filter_row_avx2, out, rows_buf, len, rows, bpps[b], filter, iterations)/1e9;
+
+			cout<<endl;
+		}
+	}
+
+	cout<<" equivalence with the reference: "<<(check_filters() ? "ok" : "MISMATCH")<<endl<<endl;
+
+	delete[] rows_buf;
+	delete[] out;
+}
+
+/** Run a filter kernel over the same row pair repeatedly, returning the best time in seconds */
+double time_filter(filter_function filter_row, unsigned char *out, const unsigned char *rows_buf, unsigned int len, unsigned int rows, unsigned char bpp, unsigned char filter, unsigned int iterations) {
+	double best = 0;
+	unsigned int i, row;
+
+	for ( i = 0; i < iterations; i++ ) {
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+		for ( row = 0; row < rows; row++ )
+			filter_row(out, rows_buf + len, rows_buf, len, bpp, filter);
+
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		if ( i == 0 || seconds < best )
+			best = seconds;
+	}
+
+	return best;
+}
+
+/** Check the vector kernels against the scalar reference for every filter, pixel size, and row length up to 300 bytes */
+bool check_filters() {
+	unsigned char raw[300], prior[300], expected[300], result[300];
+	unsigned int len, seed;
+	unsigned char bpp, filter;
+
+	for ( seed = 1; seed <= 4; seed++ ) {
+		fill_noise(raw, sizeof(raw), seed);
+		fill_noise(prior, sizeof(prior), seed*7919);
+
+		for ( bpp = 1; bpp <= 8; bpp++ ) {
+			for ( filter = 0; filter < 5; filter++ ) {
+				for ( len = bpp; len <= sizeof(raw); len += bpp ) {
+					LTPNG::filter_row_reference(expected, raw, prior, len, bpp, filter);
+
+					LTPNG::filter_row_sse2(result, raw, prior, len, bpp, filter);
+
+					if ( memcmp(expected, result, len) )
+						return false;
+
+					if ( LTPNG::filter_avx2_supported() ) {
+						LTPNG::filter_row_avx2(result, raw, prior, len, bpp, filter);
+
+						if ( memcmp(expected, result, len) )
+							return false;
+					}
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Measure the throughput of the row packing kernels specialised on source layout, bit depth, and channels against
+ * the generic loops that test the depth and channels for every sample, checking they agree byte for byte
+ */
+void bench_pack(size_t size, unsigned int iterations) {
+	const char *names[] = { "RGB8", "RGBA8", "RGB16", "RGBA16", "GREY8", "GREYA8", "GREY16", "GREYA16" };
+	const char *types[] = { "grey", "", "RGB", "", "grey+alpha", "", "RGBA" };
+	const unsigned char cases[][3] = {
+		{ LTPNG::PIXELS_RGBA8, 8, 2 }, { LTPNG::PIXELS_RGB8, 8, 6 }, { LTPNG::PIXELS_RGB8, 16, 2 }, { LTPNG::PIXELS_RGBA16BE, 8, 6 },
+		{ LTPNG::PIXELS_GREY8, 8, 2 }, { LTPNG::PIXELS_GREYA8, 16, 6 }, { LTPNG::PIXELS_GREY16BE, 8, 0 }, { LTPNG::PIXELS_GREYA8, 8, 4 }
+	};
+	const unsigned int width = 4096;
+	unsigned int rows = size/(width*8) > 0 ? size/(width*8) : 1;
+	unsigned char *pixels = new unsigned char[(size_t) rows*width*8];
+	unsigned short *planes16 = new unsigned short[(size_t) rows*width];
+	unsigned char *planes8 = new unsigned char[(size_t) rows*width];
+	unsigned char *out = new unsigned char[width*8], *check = new unsigned char[width*8];
+	unsigned int c, i, row;
+	double reference = 0, kernel = 0;
+	bool match = true;
+
+	fill_noise(pixels, (size_t) rows*width*8, 0x85ebca6b);
+	fill_noise((unsigned char *) planes16, (size_t) rows*width*2, 0xc2b2ae35);
+	fill_noise(planes8, (size_t) rows*width, 0x27d4eb2f);
+
+	cout<<"Row packing throughput in GB/s of pixels in over "<<rows<<" rows of "<<width<<", best of "<<iterations<<endl;
+	cout<<" source       image            reference    kernel"<<endl;
+
+	for ( c = 0; c < sizeof(cases)/sizeof(cases[0]); c++ ) {
+		PackingEncoder packer(cases[c][1], cases[c][2], width);
+		LTPNGPixelsKernel pack = packer.pixels_packer(cases[c][0]);
+		unsigned int in_bytes;
+
+		/** Colour formats are 3 or 4 samples, grey formats 1 or 2, and the 16-bit formats have the 2 bit set */
+		if ( cases[c][0] < LTPNG::PIXELS_GREY8 )
+			in_bytes = (cases[c][0] & 1 ? 4 : 3)*(cases[c][0] & 2 ? 2 : 1);
+		else
+			in_bytes = (cases[c][0] & 1 ? 2 : 1)*(cases[c][0] & 2 ? 2 : 1);
+
+		for ( i = 0; i < iterations; i++ ) {
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+			for ( row = 0; row < rows; row++ )
+				packer.pack_row_reference(pixels + (size_t) row*width*in_bytes, cases[c][0], out);
+
+			double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+			if ( i == 0 || seconds < reference )
+				reference = seconds;
+
+			start = chrono::steady_clock::now();
+
+			for ( row = 0; row < rows; row++ )
+				pack(out, pixels + (size_t) row*width*in_bytes, width);
+
+			seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+			if ( i == 0 || seconds < kernel )
+				kernel = seconds;
+		}
+
+		for ( row = 0; row < rows; row++ ) {
+			packer.pack_row_reference(pixels + (size_t) row*width*in_bytes, cases[c][0], check);
+			pack(out, pixels + (size_t) row*width*in_bytes, width);
+			match = match && memcmp(out, check, width*pixel_bytes(cases[c][1], cases[c][2])) == 0;
+		}
+
+		cout<<" "<<left<<setw(13)<<names[cases[c][0]]<<setw(3)<<static_cast<unsigned int>(cases[c][1])<<setw(11)<<types[cases[c][2]]<<right;
+		cout<<setw(12)<<(double) rows*width*in_bytes/reference/1e9<<setw(10)<<(double) rows*width*in_bytes/kernel/1e9<<endl;
+	}
+
+	/** Channels of 16-bit and then 8-bit samples as create_image() takes them, all four channels sharing one buffer */
+	for ( c = 0; c < 4; c++ ) {
+		unsigned char sample_bytes = c < 2 ? 2 : 1, depth = c % 2 ? 16 : 8, type = c % 2 ? 6 : 2;
+		PackingEncoder packer(depth, type, width);
+		LTPNGPlanesKernel pack = packer.planes_packer(sample_bytes);
+		const void *plane = sample_bytes == 2 ? (const void *) planes16 : (const void *) planes8;
+		unsigned int in_bytes = channel_count(type)*sample_bytes;
+
+		for ( i = 0; i < iterations; i++ ) {
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+			for ( row = 0; row < rows; row++ )
+				packer.pack_planes_reference(out, plane, plane, plane, plane, (size_t) row*width, sample_bytes);
+
+			double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+			if ( i == 0 || seconds < reference )
+				reference = seconds;
+
+			start = chrono::steady_clock::now();
+
+			for ( row = 0; row < rows; row++ )
+				pack(out, plane, plane, plane, plane, (size_t) row*width, width);
+
+			seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+			if ( i == 0 || seconds < kernel )
+				kernel = seconds;
+		}
+
+		for ( row = 0; row < rows; row++ ) {
+			packer.pack_planes_reference(check, plane, plane, plane, plane, (size_t) row*width, sample_bytes);
+			pack(out, plane, plane, plane, plane, (size_t) row*width, width);
+			match = match && memcmp(out, check, width*pixel_bytes(depth, type)) == 0;
+		}
+
+		cout<<" "<<left<<setw(13)<<(sample_bytes == 2 ? "planes16" : "planes8")<<setw(3)<<static_cast<unsigned int>(depth)<<setw(11)<<types[type]<<right;
+		cout<<setw(12)<<(double) rows*width*in_bytes/reference/1e9<<setw(10)<<(double) rows*width*in_bytes/kernel/1e9<<endl;
+	}
+
+	cout<<" equivalence with the reference: "<<(match ? "ok" : "MISMATCH")<<endl<<endl;
+
+	delete[] pixels;
+	delete[] planes16;
+	delete[] planes8;
+	delete[] out;
+	delete[] check;
+}
+
+/** Samples in a pixel of a colour type */
+unsigned int channel_count(unsigned char type) {
+	return type == 2 ? 3 : type == 4 ? 2 : type == 6 ? 4 : 1;
+}
+
+/** Bytes in a pixel of a bit depth and colour type */
+unsigned int pixel_bytes(unsigned char depth, unsigned char type) {
+	return channel_count(type)*depth/8;
+}
+
+/** 
+ * Measure the steady-state cost of encoding a batch of small tiles to memory, with a new encoder for every tile
+ * against one encoder reused for all of them
+ */
+void bench_encode(unsigned int tile, unsigned int iterations) {
+	const unsigned int count = 200;
+	unsigned char *pixels = new unsigned char[(size_t) tile*tile*4];
+	size_t fresh_bytes, reused_bytes;
+	size_t i;
+
+	/** A gradient with noise in the low bits, roughly as compressible as a rendered map tile */
+	fill_noise(pixels, (size_t) tile*tile*4, 0x2545f491);
+
+	for ( i = 0; i < (size_t) tile*tile*4; i++ )
+		pixels[i] = (i/4 % tile + i/4/tile)/2 + (pixels[i] & 1);
+
+	cout<<"Encoding "<<count<<" "<<tile<<"x"<<tile<<" RGBA tiles to memory, best of "<<iterations<<endl;
+
+	double fresh = time_encode(pixels, tile, count, iterations, false, fresh_bytes);
+	cout<<" new encoder per tile: "<<setw(10)<<fresh/count*1e6<<" us/tile "<<setw(10)<<count/fresh<<" tiles/s"<<endl;
+
+	double reused = time_encode(pixels, tile, count, iterations, true, reused_bytes);
+	cout<<" reused encoder:       "<<setw(10)<<reused/count*1e6<<" us/tile "<<setw(10)<<count/reused<<" tiles/s"<<(reused_bytes == fresh_bytes ? "" : "  MISMATCH")<<endl<<endl;
+
+	delete[] pixels;
+}
+
+/** Encode the same tile count times, returning the best time in seconds and the size of the last PNG */
+double time_encode(const unsigned char *pixels, unsigned int tile, unsigned int count, unsigned int iterations, bool reuse, size_t &bytes) {
+	LTPNG encoder(8, 6, 4);
+	LTPNGMemorySink sink;
+	double best = 0;
+	unsigned int i, n;
+
+	for ( i = 0; i < iterations; i++ ) {
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+		for ( n = 0; n < count; n++ ) {
+			sink.data.clear();
+
+			if ( reuse ) {
+				encoder.create_image(sink, tile, tile, pixels, LTPNG::PIXELS_RGBA8);
+			} else {
+				LTPNG image(8, 6, 4);
+				image.create_image(sink, tile, tile, pixels, LTPNG::PIXELS_RGBA8);
+			}
+		}
+
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		if ( i == 0 || seconds < best )
+			best = seconds;
+	}
+
+	bytes = sink.data.size();
+
+	return best;
+}
+
+/** Measure encode throughput and compressed size of a synthetic image for each compression preset and filter */
+void bench_options(unsigned int iterations) {
+	const char *presets[] = { "fastest", "balanced", "smallest" };
+	const char *filters[] = { "None", "Sub", "Up", "Average", "Paeth", "Adaptive" };
+	const unsigned int width = 1024, height = 512;
+	unsigned char *pixels = new unsigned char[width*height*3];
+	LTPNGMemorySink sink;
+	unsigned int i, p, f, x, y;
+
+	/** Smooth diagonal ramps with a few hard-edged stripes, like rendered charts and tiles */
+	for ( y = 0; y < height; y++ ) {
+		for ( x = 0; x < width; x++ ) {
+			pixels[(y*width + x)*3] = (x + y)/6;
+			pixels[(y*width + x)*3 + 1] = y/2;
+			pixels[(y*width + x)*3 + 2] = (x/64) & 1 ? 255 : x/4;
+		}
+	}
+
+	cout<<"Encoding a "<<width<<"x"<<height<<" synthetic RGB image per preset and filter, best of "<<iterations<<endl;
+	cout<<" preset    filter       MB/s     bytes"<<endl;
+
+	for ( p = 0; p < 3; p++ ) {
+		for ( f = 0; f < 6; f++ ) {
+			LTPNG encoder(8, 2, f);
+			double best = 0;
+
+			encoder.options = LTPNGOptions::preset(presets[p]);
+
+			for ( i = 0; i < iterations; i++ ) {
+				sink.data.clear();
+
+				chrono::steady_clock::time_point start = chrono::steady_clock::now();
+				encoder.create_image(sink, width, height, pixels, LTPNG::PIXELS_RGB8);
+				double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+				if ( i == 0 || seconds < best )
+					best = seconds;
+			}
+
+			cout<<" "<<left<<setw(10)<<presets[p]<<setw(9)<<filters[f]<<right<<setw(8)<<width*height*3/best/1e6<<setw(10)<<sink.data.size()<<endl;
+		}
+	}
+
+	cout<<endl;
+
+	delete[] pixels;
+}
+
+/**
+ * Measure re-encoding a 4K dashboard-like framebuffer when only a small widget changes, against encoding it in full,
+ * checking the incremental image matches one encoded from scratch
+ */
+void bench_incremental(unsigned int iterations) {
+	const unsigned int width = 3840, height = 2160, widget_x = 3400, widget_y = 1000, widget_width = 240, widget_height = 120;
+	unsigned char *pixels = new unsigned char[(size_t) width*height*3];
+	LTPNGMemorySink sink, check;
+	LTPNGStats stats;
+	LTPNG full(8, 2, 4), incremental(8, 2, 4), fresh(8, 2, 4);
+	double full_best = 0, first_best = 0, update_best = 0;
+	unsigned int i, x, y;
+
+	for ( y = 0; y < height; y++ ) {
+		for ( x = 0; x < width; x++ ) {
+			pixels[((size_t) y*width + x)*3] = (x + y)/24;
+			pixels[((size_t) y*width + x)*3 + 1] = y/9;
+			pixels[((size_t) y*width + x)*3 + 2] = (x/64) & 1 ? 255 : x/16;
+		}
+	}
+
+	incremental.stats = &stats;
+
+	for ( i = 0; i < iterations; i++ ) {
+		sink.data.clear();
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		full.create_image(sink, width, height, pixels, LTPNG::PIXELS_RGB8);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		if ( i == 0 || seconds < full_best )
+			full_best = seconds;
+
+		/** Clearing the cache times the first incremental image, which compresses every band */
+		incremental.clear_band_cache();
+		sink.data.clear();
+
+		start = chrono::steady_clock::now();
+		incremental.update_image(sink, width, height, pixels, LTPNG::PIXELS_RGB8, 0, 0, width, height);
+		seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		if ( i == 0 || seconds < first_best )
+			first_best = seconds;
+	}
+
+	/** Each update ticks the widget over, a block whose shade changes every time */
+	for ( i = 0; i < iterations; i++ ) {
+		for ( y = widget_y; y < widget_y + widget_height; y++ )
+			memset(pixels + ((size_t) y*width + widget_x)*3, 40*i + (y/8 + i)%3*20, widget_width*3);
+
+		sink.data.clear();
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		incremental.update_image(sink, width, height, pixels, LTPNG::PIXELS_RGB8, widget_x, widget_y, widget_width, widget_height);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		if ( i == 0 || seconds < update_best )
+			update_best = seconds;
+	}
+
+	fresh.update_image(check, width, height, pixels, LTPNG::PIXELS_RGB8, 0, 0, width, height);
+
+	cout<<"Re-encoding a "<<width<<"x"<<height<<" RGB image with a "<<widget_width<<"x"<<widget_height<<" widget changing, best of "<<iterations<<endl;
+	cout<<" create_image():             "<<setw(8)<<full_best*1000<<" ms"<<endl;
+	cout<<" update_image(), cold cache: "<<setw(8)<<first_best*1000<<" ms"<<endl;
+	cout<<" update_image(), widget:     "<<setw(8)<<update_best*1000<<" ms, "<<stats.bands_encoded<<" of "<<stats.bands_encoded + stats.bands_reused<<" bands compressed";
+	cout<<(sink.data == check.data ? "" : "  MISMATCH")<<endl<<endl;
+
+	delete[] pixels;
+}
+
+/**
+ * Measure a stream of tile requests where most tiles have been asked for before, encoded every time and then through
+ * an encode cache whose budget holds most but not all of the tiles, checking every cached tile matches
+ */
+void bench_cache(unsigned int iterations) {
+	const unsigned int size = 256, tiles = 48, requests = 2000;
+	vector<vector<unsigned char> > pixels(tiles, vector<unsigned char>(size*size*4));
+	vector<unsigned int> order(requests);
+	LTPNGMemorySink sink, check;
+	LTPNG plain(8, 6, 5), cached(8, 6, 5);
+	double plain_best = 0, cached_best = 0;
+	unsigned int i, r, t;
+	bool match = true;
+
+	/** Blank tiles, flat placeholders, and gradients, asked for with the low tiles far more often than the high ones */
+	for ( t = 0; t < tiles; t++ ) {
+		for ( i = 0; i < size*size; i++ ) {
+			pixels[t][i*4] = t < 8 ? 0 : t < 16 ? t*16 : (i % size + t)/2;
+			pixels[t][i*4 + 1] = t < 8 ? 0 : t < 16 ? 96 : i/size;
+			pixels[t][i*4 + 2] = t < 8 ? 0 : t*5;
+			pixels[t][i*4 + 3] = t < 8 ? 0 : 255;
+		}
+	}
+
+	srand(1);
+
+	for ( r = 0; r < requests; r++ )
+		order[r] = (unsigned int) (tiles*pow((double) rand()/RAND_MAX, 3)) % tiles;
+
+	LTPNGCache cache(16 << 10);
+
+	cached.cache = &cache;
+
+	for ( i = 0; i < iterations; i++ ) {
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+		for ( r = 0; r < requests; r++ ) {
+			sink.data.clear();
+			plain.create_image(sink, size, size, pixels[order[r]].data(), LTPNG::PIXELS_RGBA8);
+		}
+
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		if ( i == 0 || seconds < plain_best )
+			plain_best = seconds;
+
+		/** Each iteration starts with nothing cached, so every tile is encoded once before it can be a hit */
+		cache.clear();
+		cache.hits = cache.misses = cache.evictions = cache.evicted_bytes = 0;
+		start = chrono::steady_clock::now();
+
+		for ( r = 0; r < requests; r++ ) {
+			sink.data.clear();
+			cached.create_image(sink, size, size, pixels[order[r]].data(), LTPNG::PIXELS_RGBA8);
+		}
+
+		seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		if ( i == 0 || seconds < cached_best )
+			cached_best = seconds;
+	}
+
+	cout<<"Encoding "<<requests<<" requests for "<<tiles<<" distinct "<<size<<"x"<<size<<" RGBA tiles, best of "<<iterations<<endl;
+	cout<<" uncached:   "<<setw(8)<<requests/plain_best<<" images/s"<<endl;
+	cout<<" cached:     "<<setw(8)<<requests/cached_best<<" images/s, "<<cache.hits<<" hits, "<<cache.misses<<" misses, ";
+	cout<<cache.evictions<<" evictions of "<<cache.evicted_bytes<<" bytes, "<<cache.bytes()<<" bytes held";
+
+	for ( t = 0; t < tiles; t++ ) {
+		sink.data.clear();
+		check.data.clear();
+		cached.create_image(sink, size, size, pixels[t].data(), LTPNG::PIXELS_RGBA8);
+		plain.create_image(check, size, size, pixels[t].data(), LTPNG::PIXELS_RGBA8);
+		match = match && sink.data == check.data;
+	}
+
+	cout<<(match ? "" : "  MISMATCH")<<endl<<endl;
+}
+
+/**
+ * Run the suite over every corpus image at each size up to max_size square, at 8 and 16 bits, with and without alpha,
+ * printing a table as it goes and writing every result as JSON to path, or to standard output in place of the table
+ */
+void bench_suite(unsigned int max_size, unsigned int iterations, const char *path) {
+	const unsigned int sizes[] = { 32, 256, 2048, 16384 };
+	const unsigned char depths[] = { 8, 16 };
+	const unsigned char types[] = { 2, 6 };
+	bool table = strcmp(path, "-") != 0;
+	vector<SuiteResult> results;
+	unsigned int kind, s, d, t;
+	size_t i, shown = 0;
+
+	if ( table ) {
+		cout<<"Benchmark suite, best of "<<iterations<<" (update_crc() engine: "<<LTPNG::crc_engine()<<", filter_row() kernels: "<<LTPNG::filter_engine()<<")"<<endl;
+		cout<<" image        size depth type stage      variant        MB/s     ns/px    ratio  peak RSS KiB"<<endl;
+	}
+
+	for ( kind = 0; kind < sizeof(corpus)/sizeof(corpus[0]); kind++ ) {
+		for ( s = 0; s < sizeof(sizes)/sizeof(sizes[0]) && sizes[s] <= max_size; s++ ) {
+			for ( d = 0; d < sizeof(depths); d++ ) {
+				for ( t = 0; t < sizeof(types); t++ ) {
+					suite_stages(kind, sizes[s], depths[d], types[t], iterations, results);
+					suite_encode(kind, sizes[s], depths[d], types[t], iterations, results);
+
+					if ( !table )
+						continue;
+
+					for ( i = shown; i < results.size(); i++ ) {
+						const SuiteResult &r = results[i];
+
+						cout<<" "<<left<<setw(9)<<r.image<<right<<setw(8)<<r.width<<setw(6)<<static_cast<unsigned int>(r.bit_depth)<<setw(5)<<static_cast<unsigned int>(r.colour_type)<<" "<<left<<setw(11)<<r.stage<<setw(9)<<r.variant<<right;
+						cout<<fixed<<setprecision(2)<<setw(10)<<r.bytes_in/r.seconds/1e6<<setw(10)<<r.seconds*1e9/((double) r.width*r.height)<<setw(9)<<r.bytes_in/r.bytes_out<<setw(14)<<r.peak_rss<<endl;
+					}
+
+					shown = results.size();
+				}
+			}
+		}
+	}
+
+	remove(suite_file);
+
+	if ( table ) {
+		ofstream file(path);
+
+		if ( !file )
+			throw "png_bench: could not open the JSON output file";
+
+		write_json(file, results, iterations);
+		cout<<endl<<"Results written to "<<path<<endl;
+	} else {
+		write_json(cout, results, iterations);
+	}
+}
+
+/**
+ * Time each encoder stage on its own over one image: packing RGBA pixels, each standard filter, then deflate of the
+ * Paeth filtered rows with the CRC and file write of each block of compressed output.  The image is generated a band
+ * of rows at a time outside the timing, so even the largest sizes need no image-sized buffers.
+ */
+void suite_stages(unsigned int kind, unsigned int size, unsigned char depth, unsigned char type, unsigned int iterations, vector<SuiteResult> &results) {
+	const char *filters[] = { "None", "Sub", "Up", "Average", "Paeth" };
+	const char *stages[] = { "pack", "filter", "filter", "filter", "filter", "filter", "deflate", "crc", "write" };
+	unsigned char pixel_size = (type == 6 ? 4 : 3)*depth/8;
+	size_t source_size = (size_t) size*4*depth/8;
+	size_t row_size = (size_t) size*pixel_size;
+	unsigned int band_rows = min((size_t) size, max((size_t) 1, ((size_t) 16 << 20)/source_size));
+	vector<unsigned char> source(band_rows*source_size), packed(band_rows*row_size), filtered(band_rows*(row_size + 1));
+	vector<unsigned char> prior(row_size), scratch(row_size), out(65536);
+	double best[9], compressed = 0;
+	PackingEncoder packer(depth, type, size);
+	unsigned int i, first, rows, row, f, stage;
+
+	for ( i = 0; i < iterations; i++ ) {
+		double spent[9] = { 0 };
+		ofstream file(suite_file, ios::binary);
+		LTPNGFileSink sink(&file);
+		unsigned int crc = 0xffffffffL;
+		z_stream strm;
+
+		strm.zalloc = Z_NULL;
+		strm.zfree = Z_NULL;
+		strm.opaque = Z_NULL;
+
+		if ( deflateInit(&strm, Z_DEFAULT_COMPRESSION) != Z_OK )
+			throw "png_bench: deflateInit() failed";
+
+		fill(prior.begin(), prior.end(), 0);
+
+		for ( first = 0; first < size; first += rows ) {
+			rows = min(band_rows, size - first);
+			fill_corpus(kind, source.data(), first, rows, size, size, depth);
+
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			packer.pack(source.data(), rows, packed.data(), row_size);
+			spent[0] += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+			/** Every filter runs over the band, and the Paeth rows are kept with their filter type byte for deflate */
+			for ( f = 0; f < 5; f++ ) {
+				start = chrono::steady_clock::now();
+
+				for ( row = 0; row < rows; row++ )
+					LTPNG::filter_row(f == 4 ? &filtered[row*(row_size + 1) + 1] : scratch.data(), &packed[row*row_size], row ? &packed[(row - 1)*row_size] : prior.data(), row_size, pixel_size, f);
+
+				spent[1 + f] += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			}
+
+			for ( row = 0; row < rows; row++ )
+				filtered[row*(row_size + 1)] = 4;
+
+			memcpy(prior.data(), &packed[(rows - 1)*row_size], row_size);
+
+			/** Compress the band, checksumming and writing each block of output as it comes like the encoder does */
+			strm.next_in = filtered.data();
+			strm.avail_in = rows*(row_size + 1);
+
+			do {
+				strm.next_out = out.data();
+				strm.avail_out = out.size();
+
+				start = chrono::steady_clock::now();
+				deflate(&strm, first + rows == size ? Z_FINISH : Z_NO_FLUSH);
+				spent[6] += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+				size_t have = out.size() - strm.avail_out;
+
+				start = chrono::steady_clock::now();
+				crc = LTPNG::update_crc(crc, out.data(), have);
+				spent[7] += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+				start = chrono::steady_clock::now();
+				sink.write(out.data(), have);
+				spent[8] += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			} while ( strm.avail_out == 0 );
+		}
+
+		compressed = strm.total_out;
+		deflateEnd(&strm);
+
+		for ( stage = 0; stage < 9; stage++ )
+			if ( i == 0 || spent[stage] < best[stage] )
+				best[stage] = spent[stage];
+	}
+
+	/** Bytes in and out of each stage, pack turning RGBA samples into rows, and deflate rows into compressed data */
+	double pixels = (double) size*size;
+	double in[9] = { pixels*source_size/size, 0, 0, 0, 0, 0, pixels*pixel_size + size, compressed, compressed };
+	double result[9] = { pixels*pixel_size, 0, 0, 0, 0, 0, compressed, compressed, compressed };
+	long rss = peak_rss();
+
+	for ( stage = 0; stage < 9; stage++ ) {
+		if ( stage >= 1 && stage <= 5 )
+			in[stage] = result[stage] = pixels*pixel_size;
+
+		SuiteResult r = { corpus[kind], size, size, depth, type, stages[stage], stage >= 1 && stage <= 5 ? filters[stage - 1] : "", in[stage], result[stage], max(best[stage], 1e-9), rss };
+		results.push_back(r);
+	}
+}
+
+/** Time the whole encoder end to end over one image, pushing RGBA pixels through the same path create_image() takes */
+void suite_encode(unsigned int kind, unsigned int size, unsigned char depth, unsigned char type, unsigned int iterations, vector<SuiteResult> &results) {
+	unsigned char format = depth == 8 ? LTPNG::PIXELS_RGBA8 : LTPNG::PIXELS_RGBA16BE;
+	size_t source_size = (size_t) size*4*depth/8;
+	unsigned int band_rows = min((size_t) size, max((size_t) 1, ((size_t) 16 << 20)/source_size));
+	vector<unsigned char> source(band_rows*source_size);
+	LTPNG encoder(depth, type, 4);
+	double best = 0, written = 0;
+	unsigned int i, first, rows;
+
+	/** The image is pushed a band at a time as it is generated, and only the encoder's own work is timed */
+	for ( i = 0; i < iterations; i++ ) {
+		ofstream file(suite_file, ios::binary);
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		encoder.begin_image(file, size, size, depth, type);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		for ( first = 0; first < size; first += rows ) {
+			rows = min(band_rows, size - first);
+			fill_corpus(kind, source.data(), first, rows, size, size, depth);
+
+			start = chrono::steady_clock::now();
+			encoder.write_rows(rows, source.data(), format);
+			seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		}
+
+		start = chrono::steady_clock::now();
+		encoder.end_image();
+		file.flush();
+		seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		written = file.tellp();
+
+		if ( i == 0 || seconds < best )
+			best = seconds;
+	}
+
+	SuiteResult r = { corpus[kind], size, size, depth, type, "end_to_end", "Paeth", (double) size*size*(type == 6 ? 4 : 3)*depth/8, written, max(best, 1e-9), peak_rss() };
+	results.push_back(r);
+}
+
+/**
+ * Generate rows first to first + rows - 1 of a corpus image as RGBA samples at the given bit depth, 16-bit samples
+ * big endian, every image the same from run to run
+ */
+void fill_corpus(unsigned int kind, unsigned char *buf, unsigned int first, unsigned int rows, unsigned int width, unsigned int height, unsigned char depth) {
+	const unsigned char flat[4] = { 0x33, 0x66, 0xCC, 0xFF };
+	unsigned int max_val = depth == 16 ? 65535 : 255;
+	unsigned int row, col, channel, sample[4];
+	unsigned char bytes = depth/8;
+
+	for ( row = first; row < first + rows; row++ ) {
+		/** Noise is seeded by row so any band comes out the same however the image is split */
+		if ( !strcmp(corpus[kind], "noise") ) {
+			fill_noise(buf, (size_t) width*4*bytes, 0x2545f491 ^ (row*2654435761u));
+			buf += (size_t) width*4*bytes;
+			continue;
+		}
+
+		for ( col = 0; col < width; col++ ) {
+			if ( !strcmp(corpus[kind], "flat") ) {
+				for ( channel = 0; channel < 4; channel++ )
+					sample[channel] = flat[channel]*(max_val/255);
+			} else if ( !strcmp(corpus[kind], "stencil") && imprint[row*39/height][col*63/width] == 'x' ) {
+				sample[0] = max_val*LTPNG::ramp_e(row, col, width, height);
+				sample[1] = max_val*LTPNG::ramp_n(row, col, width, height);
+				sample[2] = max_val*LTPNG::pattern_full(row, col, width, height);
+				sample[3] = max_val*LTPNG::ramp_e(row, col, width, height);
+			} else {
+				sample[0] = max_val*LTPNG::ramp_s(row, col, width, height);
+				sample[1] = max_val*LTPNG::ramp_se(row, col, width, height);
+				sample[2] = max_val*LTPNG::ramp_nw(row, col, width, height);
+				sample[3] = max_val*LTPNG::ramp_e(row, col, width, height);
+			}
+
+			for ( channel = 0; channel < 4; channel++ ) {
+				if ( bytes == 2 )
+					*buf++ = sample[channel] >> 8;
+
+				*buf++ = sample[channel] & 0xFF;
+			}
+		}
+	}
+}
+
+/** Write the suite results as a JSON object, with the CRC and filter engines they were measured with */
+void write_json(ostream &out, const vector<SuiteResult> &results, unsigned int iterations) {
+	size_t i;
+
+	out<<"{"<<endl;
+	out<<"  \"crc_engine\": \""<<LTPNG::crc_engine()<<"\","<<endl;
+	out<<"  \"filter_engine\": \""<<LTPNG::filter_engine()<<"\","<<endl;
+	out<<"  \"iterations\": "<<iterations<<","<<endl;
+	out<<"  \"results\": ["<<endl;
+
+	for ( i = 0; i < results.size(); i++ ) {
+		const SuiteResult &r = results[i];
+		double pixels = (double) r.width*r.height;
+
+		out<<defaultfloat<<setprecision(6);
+		out<<"    { \"image\": \""<<r.image<<"\", \"width\": "<<r.width<<", \"height\": "<<r.height;
+		out<<", \"bit_depth\": "<<static_cast<unsigned int>(r.bit_depth)<<", \"colour_type\": "<<static_cast<unsigned int>(r.colour_type);
+		out<<", \"stage\": \""<<r.stage<<"\", \"variant\": \""<<r.variant<<"\"";
+		out<<", \"bytes_in\": "<<setprecision(15)<<r.bytes_in<<", \"bytes_out\": "<<r.bytes_out<<setprecision(6);
+		out<<", \"seconds\": "<<r.seconds<<", \"mb_per_s\": "<<r.bytes_in/r.seconds/1e6<<", \"ns_per_pixel\": "<<r.seconds*1e9/pixels;
+		out<<", \"ratio\": "<<r.bytes_in/r.bytes_out<<", \"peak_rss_kib\": "<<r.peak_rss<<" }"<<(i + 1 < results.size() ? "," : "")<<endl;
+	}
+
+	out<<"  ]"<<endl;
+	out<<"}"<<endl;
+}
+
+/** Peak resident set size of the process so far in KiB, which only ever grows as larger images are run */
+long peak_rss() {
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_maxrss;
+}
+
+/** Fill a buffer with deterministic noise from a linear congruential generator */
+void fill_noise(unsigned char *buf, size_t size, unsigned int seed) {
+	size_t i;
+
+	for ( i = 0; i < size; i++ ) {
+		seed = seed*1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+}
+
+/** Print usage instructions */
+void usage() {
+	cout<<"Usage: png_bench [options]"<<endl<<endl;
+	cout<<"  -s SIZE       Amount of data each benchmark runs over in MiB [optional]"<<endl;
+	cout<<"  -i COUNT      Number of timed iterations, the best is reported [optional]"<<endl;
+	cout<<"  -t TILE       Width and height of the tiles in the encode benchmark [optional]"<<endl;
+	cout<<"  -j FILE       Run the benchmark suite instead, writing its results as JSON to FILE, or - for standard output [optional]"<<endl;
+	cout<<"  -z SIZE       Largest image width and height in the suite, from 32 up to 16384 [optional]"<<endl<<endl;
+}
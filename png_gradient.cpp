@@ -9,47 +9,124 @@
 /** Header includes */
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
 #include <unistd.h>
 #include "LTPNG.h"
 
 using namespace std;
 
-/** Primary function declarations */
-void create_gradient(string, unsigned int, unsigned int, unsigned char, unsigned char, string, string, string, string, unsigned char);
-double get_pattern(string, unsigned int, unsigned int, unsigned int, unsigned int);
-bool valid_pattern(string);
-void usage();
-
-/** Beginning of program */
-int main(int argc, char **argv) {
+/** Options of one image, from the command line or from one line of a batch manifest */
+struct GradientJob {
 	string filename;
 	string red_pattern;
 	string green_pattern;
 	string blue_pattern;
 	string alpha_pattern;
-	int width = 0;
-	int height = 0;
-	int bit_depth = 8;
-	int colour_type = 2;
-	int filter_type = 4;
+	int width;
+	int height;
+	int bit_depth;
+	int colour_type;
+	int filter_type;
+	int threads;
+	LTPNGOptions options;
+	int level;
+	bool reduce;
+	bool interlace;
+	bool stats;
+	string manifest;
+	int workers;
+
+	GradientJob();
+};
+
+/** Primary function declarations */
+int parse_options(int, char **, GradientJob &);
+int check_options(GradientJob &);
+int run_batch(string, int);
+void create_gradient(const GradientJob &, LTPNG &, ostream &);
+void usage();
+
+/** Beginning of program */
+int main(int argc, char **argv) {
+	GradientJob job;
+
+	if ( parse_options(argc, argv, job) )
+		return 1;
+
+	/** A manifest runs a batch of images in place of the one on the command line */
+	if ( job.manifest.length() > 0 )
+		return run_batch(job.manifest, job.workers);
+
+	if ( check_options(job) )
+		return 1;
+
+	/** Try to create the gradient, report any errors */
+	try {
+		LTPNG image(job.bit_depth, job.colour_type, job.filter_type);
+
+		create_gradient(job, image, cout);
+	} catch ( const char *error ) {
+		cout<<error<<endl;
+		return 1;
+	}
+
+    return 0;
+}
+
+/** Options before any switches are read */
+GradientJob::GradientJob() {
+	width = 0;
+	height = 0;
+	bit_depth = 8;
+	colour_type = 2;
+	filter_type = 4;
+	threads = 1;
+	level = -1;
+	reduce = false;
+	interlace = false;
+	stats = false;
+	workers = 0;
+}
+
+/** Read option switches into a job, returning non-zero if they could not be read */
+int parse_options(int argc, char **argv, GradientJob &job) {
 	int c;
 
+	/** Setting optind to 0 starts getopt() over from the first argument, as the switches of each manifest line are read in turn */
 	opterr = 0;
+	optind = 0;
 
 	/** Look for option switches */
-	while ( (c = getopt(argc, argv, "f:d:p:a:w:h:r:g:b:t:")) != -1 ) {
+	while ( (c = getopt(argc, argv, "f:d:p:l:a:w:h:r:g:b:t:j:oism:n:")) != -1 ) {
 		switch ( c ) {
-			case 'f': filename = string(optarg); break;
-			case 'd': bit_depth = atoi(optarg); break;
-			case 'a': alpha_pattern = string(optarg); colour_type = 6; break;
-			case 'w': width = atoi(optarg); break;
-			case 'h': height = atoi(optarg); break;
-			case 'r': red_pattern = string(optarg); break;
-			case 'g': green_pattern = string(optarg); break;
-			case 'b': blue_pattern = string(optarg); break;
-			case 't': filter_type = atoi(optarg); break;
+			case 'f': job.filename = string(optarg); break;
+			case 'd': job.bit_depth = atoi(optarg); break;
+			case 'a': job.alpha_pattern = string(optarg); job.colour_type = 6; break;
+			case 'w': job.width = atoi(optarg); break;
+			case 'h': job.height = atoi(optarg); break;
+			case 'r': job.red_pattern = string(optarg); break;
+			case 'g': job.green_pattern = string(optarg); break;
+			case 'b': job.blue_pattern = string(optarg); break;
+			case 't': job.filter_type = atoi(optarg); break;
+			case 'j': job.threads = atoi(optarg); break;
+			case 'l': job.level = atoi(optarg); break;
+			case 'o': job.reduce = true; break;
+			case 'i': job.interlace = true; break;
+			case 's': job.stats = true; break;
+			case 'm': job.manifest = string(optarg); break;
+			case 'n': job.workers = atoi(optarg); break;
+			case 'p':
+				try {
+					job.options = LTPNGOptions::preset(optarg);
+				} catch ( const char * ) {
+					cout<<"png_gradient: unknown compression preset, only fastest, balanced, and smallest are allowed."<<endl<<endl;
+					usage();
+					return 1;
+				}
+				break;
 			case '?':
-				if ( optopt == 'f' || optopt == 'd' || optopt == 'w' || optopt == 'h' || optopt == 'r' || optopt == 'g' || optopt == 'b' || optopt == 'b' )
+				if ( optopt == 'f' || optopt == 'd' || optopt == 'w' || optopt == 'h' || optopt == 'r' || optopt == 'g' || optopt == 'b' || optopt == 't' || optopt == 'j' || optopt == 'p' || optopt == 'l' || optopt == 'm' || optopt == 'n' )
 					cout<<"png_gradient: Option -"<<static_cast<char>(optopt)<<" requires an argument."<<endl;
 				else
 					cout<<"png_gradient: Unknown option `-"<<static_cast<char>(optopt)<<"'."<<endl;
@@ -58,159 +135,259 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	return 0;
+}
+
+/** Check the options of a job, returning non-zero once what is wrong with them has been printed */
+int check_options(GradientJob &job) {
 	/** Verify width and height entered */
-	if ( width <= 0 || height <= 0 ) {
+	if ( job.width <= 0 || job.height <= 0 ) {
 		cout<<"png_gradient: please specify a valid width and height of the image."<<endl<<endl;
 		usage();
 		return 1;
 	}
 
 	/** Check for valid bit depth */
-	if ( bit_depth != 8 && bit_depth != 16 ) {
+	if ( job.bit_depth != 8 && job.bit_depth != 16 ) {
 		cout<<"png_gradient: only 8 and 16-bit depths are allowed."<<endl<<endl;
 		usage();
 		return 1;
 	}
 
 	/** Check for valid filter type */
-	if ( filter_type < 0 || filter_type > 4 ) {
-		cout<<"png_gradient: invalid filter type, only methods 0-4 are allowed."<<endl<<endl;
+	if ( job.filter_type < 0 || job.filter_type > 6 ) {
+		cout<<"png_gradient: invalid filter type, only methods 0-6 are allowed."<<endl<<endl;
+		usage();
+		return 1;
+	}
+
+	/** Check for a valid compression level, which overrides the preset's */
+	if ( job.level < -1 || job.level > 9 ) {
+		cout<<"png_gradient: invalid compression level, only levels 0-9 are allowed."<<endl<<endl;
+		usage();
+		return 1;
+	}
+
+	if ( job.level != -1 )
+		job.options.level = job.level;
+
+	/** Check for a valid thread count */
+	if ( job.threads < 1 ) {
+		cout<<"png_gradient: please specify at least one thread."<<endl<<endl;
 		usage();
 		return 1;
 	}
 
 	/** Make sure filename was provided */
-	if ( filename.length() <= 0 ) {
+	if ( job.filename.length() <= 0 ) {
 		cout<<"png_gradient: please specify a valid filename for the image."<<endl<<endl;
 		usage();
 		return 1;
 	}
 
 	/** Verify valid patterns are used */
-	if ( !valid_pattern(red_pattern) || !valid_pattern(green_pattern) || !valid_pattern(blue_pattern) || (colour_type == 6 && !valid_pattern(alpha_pattern)) ) {
+	if ( !LTPNGPattern::valid(job.red_pattern) || !LTPNGPattern::valid(job.green_pattern) || !LTPNGPattern::valid(job.blue_pattern) || (job.colour_type == 6 && !LTPNGPattern::valid(job.alpha_pattern)) ) {
 		cout<<"png_gradient: invalid pattern specified."<<endl<<endl;
 		usage();
 		return 1;
 	}
 
-	/** Try to create the gradient, report any errors */
-	try {
-		create_gradient(filename, width, height, bit_depth, colour_type, red_pattern, green_pattern, blue_pattern, alpha_pattern, filter_type);
-	} catch ( const char *error ) {
-		cout<<error<<endl;
+	return 0;
+}
+
+/**
+ * Create every image in a manifest, one per line with the same switches as the command line, on a pool of workers
+ * each reusing one encoder, and print the throughput of the whole batch.  Blank lines and lines starting with # are
+ * skipped
+ */
+int run_batch(string manifest, int workers) {
+	ifstream file(manifest);
+	vector<GradientJob> jobs;
+	string line, word;
+	unsigned int line_number = 0;
+
+	if ( !file ) {
+		cout<<"png_gradient: could not open the manifest "<<manifest<<"."<<endl;
 		return 1;
 	}
 
-    return 0;
-}
+	if ( workers < 0 ) {
+		cout<<"png_gradient: please specify at least one worker, or 0 for one per hardware thread."<<endl<<endl;
+		usage();
+		return 1;
+	}
 
-/** Create an example truecolour image with a gradient */
-void create_gradient(string filename, unsigned int width, unsigned int height, unsigned char bit_depth, unsigned char colour_type, string red_pattern, string green_pattern, string blue_pattern, string alpha_pattern, unsigned char filter_type) {
-	/** Self-allocate uncompressed reference channel arrays */
-	unsigned short *red = new unsigned short[height*width];
-	unsigned short *green = new unsigned short[height*width];
-	unsigned short *blue = new unsigned short[height*width];
-	unsigned short *alpha;
+	/** Read and check every line before starting, so a mistake does not leave the batch half written */
+	while ( getline(file, line) ) {
+		istringstream words(line);
+		vector<string> args(1, "png_gradient");
+		vector<char *> argv;
+		GradientJob job;
 
-	/** If with alpha, allocate alpha array */
-	if ( colour_type == 6 )
-		alpha = new unsigned short[height*width];
-
-	unsigned int row, col;
-	
-	/** Instantiate the image with the bit depth, colour type, and filter type */
-	LTPNG image(bit_depth, colour_type, filter_type);
-
-	/** Load the reference channel arrays with test pixels */
-	for ( row = 0; row < height; row++ ) {
-		for ( col = 0; col < width; col++ ) { /** r = s, g = se, b = nw is nice */
-			red[row*width + col] = image.max_val*get_pattern(red_pattern, row, col, width, height);
-			green[row*width + col] = image.max_val*get_pattern(green_pattern, row, col, width, height);
-			blue[row*width + col] = image.max_val*get_pattern(blue_pattern, row, col, width, height);
-
-			if ( colour_type == 6 )
-				alpha[row*width + col] = image.max_val*get_pattern(alpha_pattern, row, col, width, height);
+		line_number++;
+
+		/** Switches are split on whitespace as a shell would, so a pattern with spaces in it is kept whole in double quotes */
+		while ( words>>quoted(word) )
+			args.push_back(word);
+
+		if ( args.size() == 1 || args[1][0] == '#' )
+			continue;
+
+		for ( string &arg : args )
+			argv.push_back(&arg[0]);
+
+		argv.push_back(NULL);
+
+		/** What is wrong with the switches has already been printed, all that is left to say is which line they are on */
+		if ( parse_options(args.size(), argv.data(), job) || (job.manifest.length() == 0 && check_options(job)) ) {
+			cout<<"png_gradient: invalid switches on line "<<line_number<<" of the manifest."<<endl;
+			return 1;
 		}
+
+		if ( job.manifest.length() > 0 ) {
+			cout<<"png_gradient: line "<<line_number<<" of the manifest names another manifest, a manifest cannot run another."<<endl;
+			return 1;
+		}
+
+		jobs.push_back(job);
+	}
+
+	/** Each image reports to a stream of its own with nowhere to write to, so the workers stay quiet */
+	LTPNGBatch batch(workers);
+
+	for ( const GradientJob &job : jobs ) {
+		batch.add([&job](LTPNG &image) {
+			ostream quiet(NULL);
+
+			create_gradient(job, image, quiet);
+		});
 	}
 
+	batch.run();
+
+	for ( const pair<size_t, const char *> &error : batch.errors )
+		cout<<jobs[error.first].filename<<": "<<error.second<<endl;
+
+	cout<<"Batch of "<<jobs.size()<<" images..."<<endl;
+	cout<<" Images written: "<<batch.images<<endl;
+	cout<<" Images failed: "<<batch.failed<<endl;
+	cout<<" Time: "<<batch.seconds<<"s"<<endl;
+	cout<<" Images per second: "<<batch.images/batch.seconds<<endl;
+	cout<<" Scanline data encoded: "<<batch.bytes_in<<" bytes, "<<batch.bytes_in/batch.seconds/1e6<<" MB/s"<<endl;
+	cout<<" Compressed image data written: "<<batch.bytes_out<<" bytes, "<<batch.bytes_out/batch.seconds/1e6<<" MB/s"<<endl<<endl;
+
+	return batch.failed ? 1 : 0;
+}
+
+/** Create an example truecolour image with a gradient on an encoder, which may have written other images before */
+void create_gradient(const GradientJob &job, LTPNG &image, ostream &out) {
+	string filename = job.filename, red_pattern = job.red_pattern, green_pattern = job.green_pattern, blue_pattern = job.blue_pattern, alpha_pattern = job.alpha_pattern;
+	unsigned int width = job.width, height = job.height;
+	unsigned char bit_depth = job.bit_depth, colour_type = job.colour_type;
+	unsigned int row;
+
+	/** Set the encoder up for the bit depth, colour type, and filter type of this image */
+	image.bit_depth = bit_depth;
+	image.colour_type = colour_type;
+	image.filter_type = job.filter_type;
+	image.max_val = bit_depth == 16 ? 65535 : 255;
+	image.threads = job.threads;
+	image.options = job.options;
+	image.reduce = job.reduce ? LTPNG::REDUCE_ALL : 0;
+	image.interlace = job.interlace ? 1 : 0;
+
+	/** Collect statistics on each stage of the encode when asked, in the encoder's own if it already keeps them */
+	LTPNGStats own_stats;
+
+	if ( job.stats && !image.stats )
+		image.stats = &own_stats;
+
+	const LTPNGStats &image_stats = image.stats ? *image.stats : own_stats;
+
+	/**
+	 * Compile the patterns once, r = s, g = se, b = nw is nice, and generate each row straight into the encoder as it
+	 * is needed, so the image is never held whole.  Every generating thread has its own copy of the programs
+	 */
+	LTPNGPattern red_program(red_pattern), green_program(green_pattern), blue_program(blue_pattern), alpha_program(colour_type == 6 ? alpha_pattern : "none");
+	unsigned int max_val = image.max_val;
+
+	red_program.begin(width, height);
+	green_program.begin(width, height);
+	blue_program.begin(width, height);
+	alpha_program.begin(width, height);
+
+	LTPNGGenerator generate = [=](unsigned int row, unsigned short *red, unsigned short *green, unsigned short *blue, unsigned short *alpha) mutable {
+		red_program.fill_row(red, row, max_val);
+		green_program.fill_row(green, row, max_val);
+		blue_program.fill_row(blue, row, max_val);
+
+		if ( colour_type == 6 )
+			alpha_program.fill_row(alpha, row, max_val);
+	};
+
 	/** Calculate pixel size */
 	unsigned char pixel_size = colour_type == 2 ? 3 : 4;
 
-	cout<<"Creating new "<<static_cast<unsigned int>(bit_depth)<<"-bit truecolour image";
+	out<<"Creating new "<<static_cast<unsigned int>(bit_depth)<<"-bit truecolour image";
 
 	if ( colour_type == 6 )
-		cout<<" with alpha";
+		out<<" with alpha";
 
-	cout<<"..."<<endl;
-	cout<<" Red pixel pattern: "<<red_pattern<<endl;
-	cout<<" Green pixel pattern: "<<green_pattern<<endl;
-	cout<<" Blue pixel pattern: "<<blue_pattern<<endl;
+	out<<"..."<<endl;
+	out<<" Red pixel pattern: "<<red_pattern<<endl;
+	out<<" Green pixel pattern: "<<green_pattern<<endl;
+	out<<" Blue pixel pattern: "<<blue_pattern<<endl;
 
 	if ( colour_type == 6 )
-		cout<<" Alpha pixel pattern: "<<alpha_pattern<<endl;
+		out<<" Alpha pixel pattern: "<<alpha_pattern<<endl;
 
-	cout<<" Number of pixels/channel size: "<<(height*width)<<endl;
-	cout<<" Pixel width: "<<width<<endl;
-	cout<<" Pixel height: "<<height<<endl;
-	cout<<" Pixel size: "<<(pixel_size*(3-16/bit_depth))<<endl;
-	cout<<" Scan line size: "<<(width*pixel_size*(3-16/bit_depth) + 1)<<endl;
-	cout<<" Total uncompressed image data size: "<<(width*height*pixel_size*(3-16/bit_depth) + height + 1)<<endl;
+	out<<" Number of pixels/channel size: "<<((unsigned long long) height*width)<<endl;
+	out<<" Pixel width: "<<width<<endl;
+	out<<" Pixel height: "<<height<<endl;
+	out<<" Pixel size: "<<(pixel_size*(3-16/bit_depth))<<endl;
+	out<<" Scan line size: "<<((unsigned long long) width*pixel_size*(3-16/bit_depth) + 1)<<endl;
+	out<<" Total uncompressed image data size: "<<((unsigned long long) width*height*pixel_size*(3-16/bit_depth) + height + 1)<<endl;
 
 	/** Image file */
 	ofstream file(filename, ios::binary);
 
-	/** Pass file and create image */
-	image.create_image(file, width, height, red, green, blue, alpha);
+	if ( !file )
+		throw "png_gradient: could not open the image file";
+
+	/** Pass file and create image from the generated rows */
+	image.create_image_from_generator(file, width, height, generate);
 
 	/** Close the image file */
 	file.close();
 
-	cout<<" Total compressed image data size: "<<image.file_size<<endl<<endl;
+	if ( job.reduce )
+		out<<" Written as: "<<static_cast<unsigned int>(image.output_bit_depth)<<"-bit colour type "<<static_cast<unsigned int>(image.output_colour_type)<<endl;
 
-	cout<<"Done!"<<endl;
+	out<<" Total compressed image data size: "<<image.file_size<<endl<<endl;
 
-	/** Clean up self-allocated memory */
-	delete[] red;
-	delete[] green;
-	delete[] blue;
+	if ( job.stats ) {
+		const char *filter_names[] = { "None", "Sub", "Up", "Average", "Paeth" };
 
-	/** Clean up self-allocated memory if with alpha */
-	if ( colour_type == 6 )
-		delete[] alpha;
-}
+		out<<"Statistics:"<<endl;
+		out<<" Analyse: "<<image_stats.analyse_seconds<<"s"<<endl;
+		out<<" Pack: "<<image_stats.pack_seconds<<"s, "<<image_stats.pack_in<<" bytes in, "<<image_stats.pack_out<<" bytes out"<<endl;
+		out<<" Filter: "<<image_stats.filter_seconds<<"s, "<<image_stats.filter_in<<" bytes in, "<<image_stats.filter_out<<" bytes out"<<endl;
+		out<<" Deflate: "<<image_stats.deflate_seconds<<"s, "<<image_stats.deflate_in<<" bytes in, "<<image_stats.deflate_out<<" bytes out"<<endl;
+		out<<" CRC: "<<image_stats.crc_seconds<<"s, "<<image_stats.crc_bytes<<" bytes"<<endl;
+		out<<" Write: "<<image_stats.write_seconds<<"s, "<<image_stats.write_bytes<<" bytes"<<endl;
+		out<<" Total: "<<image_stats.total_seconds<<"s"<<endl;
 
-/** Return channel pattern multiplier for pixel */
-double get_pattern(string pattern, unsigned int row, unsigned int col, unsigned int width, unsigned int height) {
-	if ( !pattern.compare("n") ) return LTPNG::ramp_n(row, col, width, height);
-	else if ( !pattern.compare("e") ) return LTPNG::ramp_e(row, col, width, height);
-	else if ( !pattern.compare("s") ) return LTPNG::ramp_s(row, col, width, height);
-	else if ( !pattern.compare("w") ) return LTPNG::ramp_w(row, col, width, height);
-	else if ( !pattern.compare("nw") ) return LTPNG::ramp_nw(row, col, width, height);
-	else if ( !pattern.compare("ne") ) return LTPNG::ramp_ne(row, col, width, height);
-	else if ( !pattern.compare("se") ) return LTPNG::ramp_se(row, col, width, height);
-	else if ( !pattern.compare("sw") ) return LTPNG::ramp_sw(row, col, width, height);
-	else if ( !pattern.compare("full") ) return LTPNG::pattern_full(row, col, width, height);
-	else if ( !pattern.compare("half") ) return LTPNG::pattern_half(row, col, width, height);
-	else if ( !pattern.compare("none") ) return LTPNG::pattern_none(row, col, width, height);
-
-	throw "png_gradient: Invalid pattern made it to get_pattern().";
-}
+		for ( row = 0; row < 5; row++ )
+			out<<" "<<filter_names[row]<<" rows: "<<image_stats.filter_rows[row]<<endl;
+
+		out<<" Memory allocated: "<<image_stats.allocated<<" bytes"<<endl;
+		out<<" Compression ratio: "<<image_stats.ratio<<endl<<endl;
+	}
+
+	if ( image.stats == &own_stats )
+		image.stats = NULL;
 
-/** Validate channel pattern */
-bool valid_pattern(string pattern) {
-	if ( !pattern.compare("n") ) return true;
-	else if ( !pattern.compare("s") ) return true;
-	else if ( !pattern.compare("e") ) return true;
-	else if ( !pattern.compare("w") ) return true;
-	else if ( !pattern.compare("nw") ) return true;
-	else if ( !pattern.compare("ne") ) return true;
-	else if ( !pattern.compare("se") ) return true;
-	else if ( !pattern.compare("sw") ) return true;
-	else if ( !pattern.compare("full") ) return true;
-	else if ( !pattern.compare("half") ) return true;
-	else if ( !pattern.compare("none") ) return true;
-
-	return false;
+	out<<"Done!"<<endl;
 }
 
 /** Print usage instructions */
@@ -220,7 +397,17 @@ void usage() {
 	cout<<"  -w WIDTH      Specifies the width of image in pixels"<<endl;
 	cout<<"  -h HEIGHT     Specifies the height of image in pixels"<<endl;
 	cout<<"  -d DEPTH      Can be 8 or 16-bit pixel channel sizes [optional]"<<endl;
-	cout<<"  -t FILTER     Can be 0 = None, 1 = Sub, 2 = Up, 3 = Average, 4 = Paeth [optional]"<<endl;
+	cout<<"  -t FILTER     Can be 0 = None, 1 = Sub, 2 = Up, 3 = Average, 4 = Paeth, 5 = Adaptive,"<<endl;
+	cout<<"                6 = Adaptive by entropy [optional]"<<endl;
+	cout<<"  -j THREADS    Number of threads to compress the image data with [optional]"<<endl;
+	cout<<"  -p PRESET     Compression preset, fastest, balanced, or smallest [optional]"<<endl;
+	cout<<"  -l LEVEL      Compression level from 0 = None to 9 = Smallest, overriding the preset [optional]"<<endl;
+	cout<<"  -o            Write the smallest format that holds the image exactly [optional]"<<endl;
+	cout<<"  -i            Interlace the image with Adam7 for progressive display [optional]"<<endl;
+	cout<<"  -s            Print the time and bytes of each encoding stage [optional]"<<endl;
+	cout<<"  -m MANIFEST   Create every image in a manifest, one line of these switches per image, in place of"<<endl;
+	cout<<"                the switches given here, with patterns holding spaces in double quotes [optional]"<<endl;
+	cout<<"  -n WORKERS    Number of images a manifest creates at once, 0 = one per hardware thread [optional]"<<endl;
 	cout<<"  -r PATTERN    Red pattern"<<endl;
 	cout<<"  -g PATTERN    Green pattern"<<endl;
 	cout<<"  -b PATTERN    Blue pattern"<<endl;
@@ -237,4 +424,7 @@ void usage() {
 	cout<<"  full          Constant full expression"<<endl;
 	cout<<"  half          Constant half expression"<<endl;
 	cout<<"  none          Constant absent expression"<<endl<<endl;
+	cout<<"Patterns may also be expressions of these with numbers, x and y running from 0 at the west"<<endl;
+	cout<<"and north edges towards 1, pi, + - * / and parentheses, and sin, cos, abs, and sqrt, such as"<<endl;
+	cout<<"0.5*se+0.5*sin(pi*x), clamped to between absent and full expression"<<endl<<endl;
 }
@@ -9,15 +9,41 @@
 /** Header includes */
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
 #include <unistd.h>
 #include "LTPNG.h"
 
 using namespace std;
 
+/** Options of one image, from the command line or from one line of a batch manifest */
+struct ImprintJob {
+	string filename;
+	string red_pattern;
+	string green_pattern;
+	string blue_pattern;
+	string alpha_pattern;
+	int width;
+	int height;
+	int bit_depth;
+	int colour_type;
+	int filter_type;
+	int threads;
+	LTPNGOptions options;
+	int level;
+	bool reduce;
+	bool interlace;
+	string manifest;
+	int workers;
+	
+	ImprintJob();
+};
+
 /** Primary function declarations */
-void create_gradient(string, unsigned int, unsigned int, unsigned char, unsigned char, string, string, string, string, unsigned char);
-double get_pattern(string, unsigned int, unsigned int, unsigned int, unsigned int);
-bool valid_pattern(string);
+int parse_options(int, char **, ImprintJob &);
+int check_options(ImprintJob &);
+int run_batch(string, int);
+void create_gradient(const ImprintJob &, LTPNG &, ostream &);
 void usage();
 
 /** Pattern to insert in gradient */
@@ -65,204 +91,337 @@ const char *imprint[] = {
 
 /** Beginning of program */
 int main(int argc, char **argv) {
-	string filename;
-	string red_pattern;
-	string green_pattern;
-	string blue_pattern;
-	string alpha_pattern;
-	int width = 0;
-	int height = 0;
-	int bit_depth = 8;
-	int filter_type = 4;
-	int colour_type = 2;
-	int c;
+	ImprintJob job;
+	
+	if ( parse_options(argc, argv, job) )
+		return 1;
+	
+	/** A manifest runs a batch of images in place of the one on the command line */
+	if ( job.manifest.length() > 0 )
+		return run_batch(job.manifest, job.workers);
+	
+	if ( check_options(job) )
+		return 1;
+	
+	/** Try to create the gradient, report any errors */
+	try {
+		LTPNG image(job.bit_depth, job.colour_type, job.filter_type);
+	
+		create_gradient(job, image, cout);
+	} catch ( const char *error ) {
+		cout<<error<<endl;
+		return 1;
+	}
+	
+    return 0;
+}
 
+/** Options before any switches are read */
+ImprintJob::ImprintJob() {
+	width = 0;
+	height = 0;
+	bit_depth = 8;
+	colour_type = 2;
+	filter_type = 4;
+	threads = 1;
+	level = -1;
+	reduce = false;
+	interlace = false;
+	workers = 0;
+}
+
+/** Read option switches into a job, returning non-zero if they could not be read */
+int parse_options(int argc, char **argv, ImprintJob &job) {
+	int c;
+	
+	/** Setting optind to 0 starts getopt() over from the first argument, as the switches of each manifest line are read in turn */
 	opterr = 0;
+	optind = 0;
 	
 	/** Look for option switches */
-	while ( (c = getopt(argc, argv, "f:d:p:a:w:h:r:g:b:t:")) != -1 ) {
+	while ( (c = getopt(argc, argv, "f:d:p:l:a:w:h:r:g:b:t:j:oim:n:")) != -1 ) {
 		switch ( c ) {
-			case 'f': filename = string(optarg); break;
-			case 'd': bit_depth = atoi(optarg); break;
-			case 'a': alpha_pattern = string(optarg); colour_type = 6; break;
-			case 'w': width = atoi(optarg); break;
-			case 'h': height = atoi(optarg); break;
-			case 'r': red_pattern = string(optarg); break;
-			case 'g': green_pattern = string(optarg); break;
-			case 'b': blue_pattern = string(optarg); break;
-			case 't': filter_type = atoi(optarg); break;
+			case 'f': job.filename = string(optarg); break;
+			case 'd': job.bit_depth = atoi(optarg); break;
+			case 'a': job.alpha_pattern = string(optarg); job.colour_type = 6; break;
+			case 'w': job.width = atoi(optarg); break;
+			case 'h': job.height = atoi(optarg); break;
+			case 'r': job.red_pattern = string(optarg); break;
+			case 'g': job.green_pattern = string(optarg); break;
+			case 'b': job.blue_pattern = string(optarg); break;
+			case 't': job.filter_type = atoi(optarg); break;
+			case 'j': job.threads = atoi(optarg); break;
+			case 'l': job.level = atoi(optarg); break;
+			case 'o': job.reduce = true; break;
+			case 'i': job.interlace = true; break;
+			case 'm': job.manifest = string(optarg); break;
+			case 'n': job.workers = atoi(optarg); break;
+			case 'p':
+				try {
+					job.options = LTPNGOptions::preset(optarg);
+				} catch ( const char * ) {
+					cout<<"png_imprint: unknown compression preset, only fastest, balanced, and smallest are allowed."<<endl<<endl;
+					usage();
+					return 1;
+				}
+				break;
 			case '?':
-				if ( optopt == 'f' || optopt == 'd' || optopt == 'w' || optopt == 'h' || optopt == 'r' || optopt == 'g' || optopt == 'b' || optopt == 'b' )
-					cout<<"png_gradient: Option -"<<static_cast<char>(optopt)<<" requires an argument."<<endl;
+				if ( optopt == 'f' || optopt == 'd' || optopt == 'w' || optopt == 'h' || optopt == 'r' || optopt == 'g' || optopt == 'b' || optopt == 't' || optopt == 'j' || optopt == 'p' || optopt == 'l' || optopt == 'm' || optopt == 'n' )
+					cout<<"png_imprint: Option -"<<static_cast<char>(optopt)<<" requires an argument."<<endl;
 				else
-					cout<<"png_gradient: Unknown option `-"<<static_cast<char>(optopt)<<"'."<<endl;
+					cout<<"png_imprint: Unknown option `-"<<static_cast<char>(optopt)<<"'."<<endl;
 				return 1;
 			default: abort();
 		}
 	}
 	
+	return 0;
+}
+
+/** Check the options of a job, returning non-zero once what is wrong with them has been printed */
+int check_options(ImprintJob &job) {
 	/** Verify width and height entered */
-	if ( width <= 0 || height <= 0 ) {
-		cout<<"png_gradient: please specify a valid width and height of the image."<<endl<<endl;
+	if ( job.width <= 0 || job.height <= 0 ) {
+		cout<<"png_imprint: please specify a valid width and height of the image."<<endl<<endl;
 		usage();
 		return 1;
 	}
 	
 	/** Check for valid bit depth */
-	if ( bit_depth != 8 && bit_depth != 16 ) {
-		cout<<"png_gradient: only 8 and 16-bit depths are allowed."<<endl<<endl;
+	if ( job.bit_depth != 8 && job.bit_depth != 16 ) {
+		cout<<"png_imprint: only 8 and 16-bit depths are allowed."<<endl<<endl;
 		usage();
 		return 1;
 	}
 	
 	/** Check for valid filter type */
-	if ( filter_type < 0 || filter_type > 4 ) {
-		cout<<"png_gradient: invalid filter type, only methods 0-4 are allowed."<<endl<<endl;
+	if ( job.filter_type < 0 || job.filter_type > 6 ) {
+		cout<<"png_imprint: invalid filter type, only methods 0-6 are allowed."<<endl<<endl;
+		usage();
+		return 1;
+	}
+
+	/** Check for a valid compression level, which overrides the preset's */
+	if ( job.level < -1 || job.level > 9 ) {
+		cout<<"png_imprint: invalid compression level, only levels 0-9 are allowed."<<endl<<endl;
+		usage();
+		return 1;
+	}
+
+	if ( job.level != -1 )
+		job.options.level = job.level;
+
+	/** Check for a valid thread count */
+	if ( job.threads < 1 ) {
+		cout<<"png_imprint: please specify at least one thread."<<endl<<endl;
 		usage();
 		return 1;
 	}
 	
 	/** Make sure filename was provided */
-	if ( filename.length() <= 0 ) {
-		cout<<"png_gradient: please specify a valid filename for the image."<<endl<<endl;
+	if ( job.filename.length() <= 0 ) {
+		cout<<"png_imprint: please specify a valid filename for the image."<<endl<<endl;
 		usage();
 		return 1;
 	}
 	
 	/** Verify valid patterns are used */
-	if ( !valid_pattern(red_pattern) || !valid_pattern(green_pattern) || !valid_pattern(blue_pattern) || (colour_type == 6 && !valid_pattern(alpha_pattern)) ) {
-		cout<<"png_gradient: invalid pattern specified."<<endl<<endl;
+	if ( !LTPNGPattern::valid(job.red_pattern) || !LTPNGPattern::valid(job.green_pattern) || !LTPNGPattern::valid(job.blue_pattern) || (job.colour_type == 6 && !LTPNGPattern::valid(job.alpha_pattern)) ) {
+		cout<<"png_imprint: invalid pattern specified."<<endl<<endl;
 		usage();
 		return 1;
 	}
 	
-	/** Try to create the gradient, report any errors */
-	try {
-		create_gradient(filename, width, height, bit_depth, colour_type, red_pattern, green_pattern, blue_pattern, alpha_pattern, filter_type);
-	} catch ( const char *error ) {
-		cout<<error<<endl;
+	return 0;
+}
+
+/**
+ * Create every image in a manifest, one per line with the same switches as the command line, on a pool of workers
+ * each reusing one encoder, and print the throughput of the whole batch.  Blank lines and lines starting with # are
+ * skipped
+ */
+int run_batch(string manifest, int workers) {
+	ifstream file(manifest);
+	vector<ImprintJob> jobs;
+	string line, word;
+	unsigned int line_number = 0;
+	
+	if ( !file ) {
+		cout<<"png_imprint: could not open the manifest "<<manifest<<"."<<endl;
 		return 1;
 	}
 	
-    return 0;
+	if ( workers < 0 ) {
+		cout<<"png_imprint: please specify at least one worker, or 0 for one per hardware thread."<<endl<<endl;
+		usage();
+		return 1;
+	}
+	
+	/** Read and check every line before starting, so a mistake does not leave the batch half written */
+	while ( getline(file, line) ) {
+		istringstream words(line);
+		vector<string> args(1, "png_imprint");
+		vector<char *> argv;
+		ImprintJob job;
+	
+		line_number++;
+	
+		/** Switches are split on whitespace as a shell would, so a pattern with spaces in it is kept whole in double quotes */
+		while ( words>>quoted(word) )
+			args.push_back(word);
+	
+		if ( args.size() == 1 || args[1][0] == '#' )
+			continue;
+	
+		for ( string &arg : args )
+			argv.push_back(&arg[0]);
+	
+		argv.push_back(NULL);
+	
+		/** What is wrong with the switches has already been printed, all that is left to say is which line they are on */
+		if ( parse_options(args.size(), argv.data(), job) || (job.manifest.length() == 0 && check_options(job)) ) {
+			cout<<"png_imprint: invalid switches on line "<<line_number<<" of the manifest."<<endl;
+			return 1;
+		}
+	
+		if ( job.manifest.length() > 0 ) {
+			cout<<"png_imprint: line "<<line_number<<" of the manifest names another manifest, a manifest cannot run another."<<endl;
+			return 1;
+		}
+	
+		jobs.push_back(job);
+	}
+	
+	/** Each image reports to a stream of its own with nowhere to write to, so the workers stay quiet */
+	LTPNGBatch batch(workers);
+	
+	for ( const ImprintJob &job : jobs ) {
+		batch.add([&job](LTPNG &image) {
+			ostream quiet(NULL);
+	
+			create_gradient(job, image, quiet);
+		});
+	}
+	
+	batch.run();
+	
+	for ( const pair<size_t, const char *> &error : batch.errors )
+		cout<<jobs[error.first].filename<<": "<<error.second<<endl;
+	
+	cout<<"Batch of "<<jobs.size()<<" images..."<<endl;
+	cout<<" Images written: "<<batch.images<<endl;
+	cout<<" Images failed: "<<batch.failed<<endl;
+	cout<<" Time: "<<batch.seconds<<"s"<<endl;
+	cout<<" Images per second: "<<batch.images/batch.seconds<<endl;
+	cout<<" Scanline data encoded: "<<batch.bytes_in<<" bytes, "<<batch.bytes_in/batch.seconds/1e6<<" MB/s"<<endl;
+	cout<<" Compressed image data written: "<<batch.bytes_out<<" bytes, "<<batch.bytes_out/batch.seconds/1e6<<" MB/s"<<endl<<endl;
+	
+	return batch.failed ? 1 : 0;
 }
 
-/** Create an example truecolour image with a gradient */
-void create_gradient(string filename, unsigned int width, unsigned int height, unsigned char bit_depth, unsigned char colour_type, string red_pattern, string green_pattern, string blue_pattern, string alpha_pattern, unsigned char filter_type) {	
-	/** Instantiate the image with the bit depth and colour type */
-	LTPNG image(bit_depth, colour_type, filter_type);
-	
-	/** Self-allocate uncompressed reference channel arrays */
-	unsigned short *red = new unsigned short[height*width];
-	unsigned short *green = new unsigned short[height*width];
-	unsigned short *blue = new unsigned short[height*width];
-	unsigned short *alpha;
-	
-	/** If with alpha, allocate alpha array */
-	if ( colour_type == 6 )
-		alpha = new unsigned short[height*width];
-	
-	/** Load the reference channel arrays with pixels */
-	unsigned int row, col;
-	unsigned short imprint_row, imprint_col;
-	
-	for ( row = 0; row < height; row++ ) {		
-		for ( col = 0; col < width; col++ ) { /** r = s, g = se, b = nw is nice */
-			imprint_row = row*39/height;
-			imprint_col = col*63/width;
-			
-			if ( imprint[imprint_row][imprint_col] == '.' ) {
-				red[row*width + col] = image.max_val*get_pattern(red_pattern, row, col, width, height);
-				green[row*width + col] = image.max_val*get_pattern(green_pattern, row, col, width, height);
-				blue[row*width + col] = image.max_val*get_pattern(blue_pattern, row, col, width, height);
-			} else {
-				red[row*width + col] = image.max_val*get_pattern("e", row, col, width, height);
-				green[row*width + col] = image.max_val*get_pattern("n", row, col, width, height);
-				blue[row*width + col] = image.max_val*get_pattern("full", row, col, width, height);
+/** Create an example truecolour image with a gradient on an encoder, which may have written other images before */
+void create_gradient(const ImprintJob &job, LTPNG &image, ostream &out) {
+	string filename = job.filename, red_pattern = job.red_pattern, green_pattern = job.green_pattern, blue_pattern = job.blue_pattern, alpha_pattern = job.alpha_pattern;
+	unsigned int width = job.width, height = job.height;
+	unsigned char bit_depth = job.bit_depth, colour_type = job.colour_type;
+	
+	/** Set the encoder up for the bit depth, colour type, and filter type of this image */
+	image.bit_depth = bit_depth;
+	image.colour_type = colour_type;
+	image.filter_type = job.filter_type;
+	image.max_val = bit_depth == 16 ? 65535 : 255;
+	image.threads = job.threads;
+	image.options = job.options;
+	image.reduce = job.reduce ? LTPNG::REDUCE_ALL : 0;
+	image.interlace = job.interlace ? 1 : 0;
+	
+	/** Compile the patterns once, the imprint being drawn with e, n, and full wherever the stencil is set */
+	LTPNGPattern red_program(red_pattern), green_program(green_pattern), blue_program(blue_pattern), alpha_program(colour_type == 6 ? alpha_pattern : "none");
+	LTPNGPattern red_imprint("e"), green_imprint("n"), blue_imprint("full");
+	LTPNGPattern *programs[] = { &red_program, &green_program, &blue_program, &alpha_program, &red_imprint, &green_imprint, &blue_imprint };
+	unsigned int max_val = image.max_val, col, i;
+	
+	for ( i = 0; i < 7; i++ )
+		programs[i]->begin(width, height);
+	
+	/** Look the stencil up once per stencil row and image column rather than once per pixel */
+	vector<unsigned char> stencil((size_t) 39*width);
+	const unsigned char *stencil_rows = stencil.data();
+	
+	for ( i = 0; i < 39; i++ )
+		for ( col = 0; col < width; col++ )
+			stencil[(size_t) i*width + col] = imprint[i][col*63/width] != '.';
+	
+	/**
+	 * Generate each row straight into the encoder as it is needed, stamping the imprint over the patterns, so the
+	 * image is never held whole.  Every generating thread has its own copy of the programs and imprint row
+	 */
+	vector<unsigned short> imprint_row((size_t) width*3);
+	
+	LTPNGGenerator generate = [=](unsigned int row, unsigned short *red, unsigned short *green, unsigned short *blue, unsigned short *alpha) mutable {
+		const unsigned char *stamp = stencil_rows + (size_t) (row*39/height)*width;
+		unsigned short *stamp_red = imprint_row.data(), *stamp_green = stamp_red + width, *stamp_blue = stamp_red + width*2;
+		
+		red_program.fill_row(red, row, max_val);
+		green_program.fill_row(green, row, max_val);
+		blue_program.fill_row(blue, row, max_val);
+		
+		if ( colour_type == 6 )
+			alpha_program.fill_row(alpha, row, max_val);
+		
+		red_imprint.fill_row(stamp_red, row, max_val);
+		green_imprint.fill_row(stamp_green, row, max_val);
+		blue_imprint.fill_row(stamp_blue, row, max_val);
+		
+		for ( unsigned int col = 0; col < width; col++ ) {
+			if ( stamp[col] ) {
+				red[col] = stamp_red[col];
+				green[col] = stamp_green[col];
+				blue[col] = stamp_blue[col];
 			}
-			
-			if ( colour_type == 6 )
-				alpha[row*width + col] = image.max_val*get_pattern(alpha_pattern, row, col, width, height);
 		}
-	}
+	};
 	
 	/** Calculate pixel size */
 	unsigned char pixel_size = colour_type == 2 ? 3 : 4;
 	
-	cout<<"Creating new "<<static_cast<unsigned int>(bit_depth)<<"-bit truecolour image";
+	out<<"Creating new "<<static_cast<unsigned int>(bit_depth)<<"-bit truecolour image";
 	
 	if ( colour_type == 6 )
-		cout<<" with alpha";
+		out<<" with alpha";
 		
-	cout<<"..."<<endl;
-	cout<<" Red pixel pattern: "<<red_pattern<<endl;
-	cout<<" Green pixel pattern: "<<green_pattern<<endl;
-	cout<<" Blue pixel pattern: "<<blue_pattern<<endl;
+	out<<"..."<<endl;
+	out<<" Red pixel pattern: "<<red_pattern<<endl;
+	out<<" Green pixel pattern: "<<green_pattern<<endl;
+	out<<" Blue pixel pattern: "<<blue_pattern<<endl;
 	
 	if ( colour_type == 6 )
-		cout<<" Alpha pixel pattern: "<<alpha_pattern<<endl;
-	
-	cout<<" Number of pixels/channel size: "<<(height*width)<<endl;
-	cout<<" Pixel width: "<<width<<endl;
-	cout<<" Pixel height: "<<height<<endl;
-	cout<<" Pixel size: "<<(pixel_size*(3-16/bit_depth))<<endl;
-	cout<<" Scan line size: "<<(width*pixel_size*(3-16/bit_depth) + 1)<<endl;
-	cout<<" Total uncompressed image data size: "<<(width*height*pixel_size*(3-16/bit_depth) + height + 1)<<endl;
+		out<<" Alpha pixel pattern: "<<alpha_pattern<<endl;
+	
+	out<<" Number of pixels/channel size: "<<((unsigned long long) height*width)<<endl;
+	out<<" Pixel width: "<<width<<endl;
+	out<<" Pixel height: "<<height<<endl;
+	out<<" Pixel size: "<<(pixel_size*(3-16/bit_depth))<<endl;
+	out<<" Scan line size: "<<((unsigned long long) width*pixel_size*(3-16/bit_depth) + 1)<<endl;
+	out<<" Total uncompressed image data size: "<<((unsigned long long) width*height*pixel_size*(3-16/bit_depth) + height + 1)<<endl;
 		
 	/** Image file */
 	ofstream file(filename, ios::binary);
 	
-	image.create_image(file, width, height, red, green, blue, alpha);
+	if ( !file )
+		throw "png_imprint: could not open the image file";
+	
+	image.create_image_from_generator(file, width, height, generate);
 		
 	/** Close the image file */
 	file.close();
 	
-	cout<<" Total compressed image data size: "<<image.file_size<<endl<<endl;
-
-	cout<<"Done!"<<endl;
-	
-	/** Clean up self-allocated memory */
-	delete[] red;
-	delete[] green;
-	delete[] blue;
+	if ( job.reduce )
+		out<<" Written as: "<<static_cast<unsigned int>(image.output_bit_depth)<<"-bit colour type "<<static_cast<unsigned int>(image.output_colour_type)<<endl;
 	
-	/** Clean up self-allocated memory if with alpha */
-	if ( colour_type == 6 )
-		delete[] alpha;
-}
-
-/** Return channel pattern multiplier for pixel */
-double get_pattern(string pattern, unsigned int row, unsigned int col, unsigned int width, unsigned int height) {
-	if ( !pattern.compare("n") ) return LTPNG::ramp_n(row, col, width, height);
-	else if ( !pattern.compare("e") ) return LTPNG::ramp_e(row, col, width, height);
-	else if ( !pattern.compare("s") ) return LTPNG::ramp_s(row, col, width, height);
-	else if ( !pattern.compare("w") ) return LTPNG::ramp_w(row, col, width, height);
-	else if ( !pattern.compare("nw") ) return LTPNG::ramp_nw(row, col, width, height);
-	else if ( !pattern.compare("ne") ) return LTPNG::ramp_ne(row, col, width, height);
-	else if ( !pattern.compare("se") ) return LTPNG::ramp_se(row, col, width, height);
-	else if ( !pattern.compare("sw") ) return LTPNG::ramp_sw(row, col, width, height);
-	else if ( !pattern.compare("full") ) return LTPNG::pattern_full(row, col, width, height);
-	else if ( !pattern.compare("half") ) return LTPNG::pattern_half(row, col, width, height);
-	else if ( !pattern.compare("none") ) return LTPNG::pattern_none(row, col, width, height);
-
-	throw "png_gradient: Invalid pattern made it to get_pattern().";
-}
-
-/** Validate channel pattern */
-bool valid_pattern(string pattern) {
-	if ( !pattern.compare("n") ) return true; 
-	else if ( !pattern.compare("s") ) return true; 
-	else if ( !pattern.compare("e") ) return true; 
-	else if ( !pattern.compare("w") ) return true; 
-	else if ( !pattern.compare("nw") ) return true; 
-	else if ( !pattern.compare("ne") ) return true; 
-	else if ( !pattern.compare("se") ) return true; 
-	else if ( !pattern.compare("sw") ) return true; 
-	else if ( !pattern.compare("full") ) return true; 
-	else if ( !pattern.compare("half") ) return true; 
-	else if ( !pattern.compare("none") ) return true; 
+	out<<" Total compressed image data size: "<<image.file_size<<endl<<endl;
 
-	return false;
+	out<<"Done!"<<endl;
 }
 
 /** Print usage instructions */
@@ -272,7 +431,16 @@ void usage() {
 	cout<<"  -w WIDTH      Specifies the width of image in pixels"<<endl;
 	cout<<"  -h HEIGHT     Specifies the height of image in pixels"<<endl;
 	cout<<"  -d DEPTH      Can be 8 or 16-bit pixel channel sizes [optional]"<<endl;
-	cout<<"  -t FILTER     Can be 0 = None, 1 = Sub, 2 = Up, 3 = Average, 4 = Paeth [optional]"<<endl;
+	cout<<"  -t FILTER     Can be 0 = None, 1 = Sub, 2 = Up, 3 = Average, 4 = Paeth, 5 = Adaptive,"<<endl;
+	cout<<"                6 = Adaptive by entropy [optional]"<<endl;
+	cout<<"  -j THREADS    Number of threads to compress the image data with [optional]"<<endl;
+	cout<<"  -p PRESET     Compression preset, fastest, balanced, or smallest [optional]"<<endl;
+	cout<<"  -l LEVEL      Compression level from 0 = None to 9 = Smallest, overriding the preset [optional]"<<endl;
+	cout<<"  -o            Write the smallest format that holds the image exactly [optional]"<<endl;
+	cout<<"  -i            Interlace the image with Adam7 for progressive display [optional]"<<endl;
+	cout<<"  -m MANIFEST   Create every image in a manifest, one line of these switches per image, in place of"<<endl;
+	cout<<"                the switches given here, with patterns holding spaces in double quotes [optional]"<<endl;
+	cout<<"  -n WORKERS    Number of images a manifest creates at once, 0 = one per hardware thread [optional]"<<endl;
 	cout<<"  -r PATTERN    Red pattern"<<endl;
 	cout<<"  -g PATTERN    Green pattern"<<endl;
 	cout<<"  -b PATTERN    Blue pattern"<<endl;
@@ -289,4 +457,7 @@ void usage() {
 	cout<<"  full          Constant full expression"<<endl;
 	cout<<"  half          Constant half expression"<<endl;
 	cout<<"  none          Constant absent expression"<<endl<<endl;
+	cout<<"Patterns may also be expressions of these with numbers, x and y running from 0 at the west"<<endl;
+	cout<<"and north edges towards 1, pi, + - * / and parentheses, and sin, cos, abs, and sqrt, such as"<<endl;
+	cout<<"0.5*se+0.5*sin(pi*x), clamped to between absent and full expression"<<endl<<endl;
 }
\ No newline at end of file
@@ -0,0 +1,69 @@
+/**
+ * PNG Info
+ *
+ * Reads PNG images back with the LTPNG decoder, printing their header and checking every chunk CRC, the zlib
+ * stream, and every scanline decode cleanly.
+ *
+ * @author Rich Lowe
+ */
+
+/** Header includes */
+#include <iostream>
+#include <fstream>
+#include "LTPNG.h"
+
+using namespace std;
+
+/** Beginning of program */
+int main(int argc, char **argv) {
+	const char *colour_types[] = { "greyscale", "", "truecolour", "indexed-colour", "greyscale with alpha", "", "truecolour with alpha" };
+	LTPNGDecoder decoder;
+	int i, failed = 0;
+
+	if ( argc < 2 ) {
+		cout<<"Usage: png_info FILE..."<<endl<<endl;
+		return 1;
+	}
+
+	for ( i = 1; i < argc; i++ ) {
+		ifstream file(argv[i], ios::binary);
+
+		if ( !file ) {
+			cout<<argv[i]<<": could not be opened"<<endl;
+			failed = 1;
+			continue;
+		}
+
+		LTPNGFileSource source(&file);
+
+		/** Stream the rows through one scanline at a time so images of any size can be checked */
+		try {
+			decoder.begin_read(source);
+
+			cout<<argv[i]<<": "<<decoder.width<<"x"<<decoder.height<<" "<<static_cast<unsigned int>(decoder.bit_depth)<<"-bit "<<colour_types[decoder.colour_type];
+
+			if ( !decoder.palette.empty() )
+				cout<<", "<<decoder.palette.size()/3<<" palette entries";
+
+			if ( !decoder.transparency.empty() )
+				cout<<", transparency";
+
+			vector<unsigned char> row(decoder.row_size);
+			unsigned int y;
+
+			for ( y = 0; y < decoder.height; y++ )
+				decoder.read_rows(1, row.data());
+
+			decoder.end_read();
+
+			cout<<", ok"<<endl;
+		} catch ( const char *error ) {
+			decoder.abort_read();
+
+			cout<<endl<<argv[i]<<": "<<error<<endl;
+			failed = 1;
+		}
+	}
+
+	return failed;
+}